@@ -0,0 +1,89 @@
+#include <string.h>
+#include <pthread.h>
+
+#include "du-cdc.h"
+
+//top bits that must be zero to cut, 2 more than CDC_AVG_SZ's 13 before
+//it and 2 fewer after
+#define CDC_MASK_HARD   (~0ULL << (64 - 15))
+#define CDC_MASK_EASY   (~0ULL << (64 - 11))
+#define CDC_SEED        0x6475667470636463ULL
+
+#define CDC_ROTL(x, b)  (((x) << (b)) | ((x) >> (64 - (b))))
+
+static uint64_t _cdcGear[256];
+static pthread_once_t _cdcOnce = PTHREAD_ONCE_INIT;
+
+//splitmix64, the same table on every host
+static void cdc_init(){
+    uint64_t x = CDC_SEED, z;
+    int i;
+
+    for (i = 0; i < 256; i++) {
+        z = (x += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        _cdcGear[i] = z ^ (z >> 31);
+    }
+}
+
+static uint64_t cdc_mix(uint64_t h){
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    return h ^ (h >> 33);
+}
+
+/*
+ *  Returns how long the chunk starting at data is, len if the data runs
+ *  out first.  Nothing before CDC_MIN_SZ is looked at, the gear hash only
+ *  remembers the last 64 bytes anyway.
+ */
+int cdc_cut(const uint8_t *data, long len){
+    uint64_t h = 0;
+    long i, mid;
+
+    pthread_once(&_cdcOnce, cdc_init);
+    if (len <= CDC_MIN_SZ)
+        return (int)len;
+    if (len > CDC_MAX_SZ)
+        len = CDC_MAX_SZ;
+    mid = (len < CDC_AVG_SZ) ? len : CDC_AVG_SZ;
+
+    for (i = CDC_MIN_SZ; i < mid; i++) {
+        h = (h << 1) + _cdcGear[data[i]];
+        if ((h & CDC_MASK_HARD) == 0)
+            return (int)(i + 1);
+    }
+    for (; i < len; i++) {
+        h = (h << 1) + _cdcGear[data[i]];
+        if ((h & CDC_MASK_EASY) == 0)
+            return (int)(i + 1);
+    }
+    return (int)len;
+}
+
+//two 64 bit lanes over the data a word at a time, mixed together at the end
+void cdc_digest(const uint8_t *data, int len, cdc_sum *sum){
+    uint64_t a = CDC_SEED ^ (uint64_t)len;
+    uint64_t b = cdc_mix(CDC_SEED + (uint64_t)len);
+    uint64_t w;
+    int i;
+
+    for (i = 0; i + 8 <= len; i += 8) {
+        memcpy(&w, data + i, 8);
+        a = CDC_ROTL(a ^ (w * 0x87c37b91114253d5ULL), 31) * 0x4cf5ad432745937fULL;
+        b = CDC_ROTL(b + (w * 0x4cf5ad432745937fULL), 27) * 0x87c37b91114253d5ULL + a;
+    }
+    if (i < len) {
+        w = 0;
+        memcpy(&w, data + i, len - i);
+        a = CDC_ROTL(a ^ (w * 0x87c37b91114253d5ULL), 31) * 0x4cf5ad432745937fULL;
+        b = CDC_ROTL(b + (w * 0x4cf5ad432745937fULL), 27) * 0x87c37b91114253d5ULL + a;
+    }
+    sum->h[0] = cdc_mix(a ^ CDC_ROTL(b, 17));
+    sum->h[1] = cdc_mix(b + sum->h[0]);
+    sum->len = len;
+    sum->pad = 0;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Content defined chunking for du-ftp's delta sync (-d).  A gear hash
+ * rolls over the data and a chunk ends where its top bits come up zero,
+ * so an insert or delete only moves the cut points near the edit and the
+ * chunks after it still line up with the old file's (FastCDC, Xia et al.).
+ * The cut is harder to hit before CDC_AVG_SZ and easier after it, which
+ * keeps most chunks close to the average.  Both ends have to cut the same
+ * way, the gear table comes from a fixed seed.
+ */
+#define CDC_MIN_SZ      2048
+#define CDC_AVG_SZ      8192
+#define CDC_MAX_SZ      65536
+
+//a chunk's digest, 128 bits of a fast non cryptographic hash
+typedef struct cdc_sum{
+    uint64_t    h[2];
+    uint32_t    len;
+    uint32_t    pad;
+} cdc_sum;
+
+int  cdc_cut(const uint8_t *data, long len);
+void cdc_digest(const uint8_t *data, int len, cdc_sum *sum);
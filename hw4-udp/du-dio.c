@@ -0,0 +1,258 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "du-dio.h"
+
+#ifndef O_DIRECT
+#define O_DIRECT    0                   //no such thing here, pages get dropped instead
+#endif
+
+#define DIO_ROUNDUP(n)  (((n) + DIO_ALIGN - 1) & ~((long)DIO_ALIGN - 1))
+
+static void *dio_reader(void *arg);
+static void *dio_writer(void *arg);
+
+//done with this block, do not let it sit in the page cache
+static void dio_drop(dio_file *d, long off, long len){
+    if (d->direct)
+        return;
+#ifdef __linux__
+    //dirty pages cannot be dropped, push them out first
+    if (d->write)
+        sync_file_range(d->fd, off, len, SYNC_FILE_RANGE_WAIT_BEFORE |
+            SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+#endif
+#ifdef POSIX_FADV_DONTNEED
+    posix_fadvise(d->fd, off, len, POSIX_FADV_DONTNEED);
+#endif
+}
+
+//the filesystem took O_DIRECT at open but not for I/O, go on without it
+static int dio_fallback(dio_file *d){
+    if (!d->direct || (errno != EINVAL))
+        return false;
+    d->direct = false;
+    return fcntl(d->fd, F_SETFL, fcntl(d->fd, F_GETFL) & ~O_DIRECT) == 0;
+}
+
+/*
+ *  Opens path to read, or to write from scratch, and starts its read
+ *  ahead or write behind thread.  Returns NULL with errno set on failure.
+ */
+dio_file *dio_open(const char *path, int write){
+    int flags = write ? (O_WRONLY | O_CREAT | O_TRUNC) : O_RDONLY;
+    dio_file *d;
+    int i;
+
+    if ((d = calloc(1, sizeof(dio_file))) == NULL)
+        return NULL;
+    d->write = write;
+    d->direct = (O_DIRECT != 0);
+    if ((d->fd = open(path, flags | O_DIRECT, 0644)) < 0) {
+        d->direct = false;
+        d->fd = open(path, flags, 0644);
+    }
+    if (d->fd < 0) {
+        free(d);
+        return NULL;
+    }
+    for (i = 0; i < DIO_BUFS; i++)
+        if (posix_memalign((void **)&d->buf[i].data, DIO_ALIGN, DIO_BUF_SZ) != 0)
+            break;
+    pthread_mutex_init(&d->lock, NULL);
+    pthread_cond_init(&d->cond, NULL);
+    if ((i < DIO_BUFS) ||
+        (pthread_create(&d->tid, NULL, write ? dio_writer : dio_reader, d) != 0)) {
+        while (--i >= 0)
+            free(d->buf[i].data);
+        close(d->fd);
+        free(d);
+        errno = ENOMEM;
+        return NULL;
+    }
+    return d;
+}
+
+//fills the free buffers ahead of dio_read()
+static void *dio_reader(void *arg){
+    dio_file *d = arg;
+    dio_buf *b;
+    long n;
+
+    while (1) {
+        pthread_mutex_lock(&d->lock);
+        while ((d->full == DIO_BUFS) && !d->stop)
+            pthread_cond_wait(&d->cond, &d->lock);
+        if (d->stop) {
+            pthread_mutex_unlock(&d->lock);
+            return NULL;
+        }
+        b = &d->buf[(d->head + d->full) % DIO_BUFS];
+        pthread_mutex_unlock(&d->lock);
+
+        //whole blocks at aligned offsets, only the end of the file comes up short
+        for (b->len = 0, b->pos = 0; b->len < DIO_BUF_SZ; b->len += n) {
+            n = pread(d->fd, b->data + b->len, DIO_BUF_SZ - b->len, d->off + b->len);
+            if ((n < 0) && (errno == EINTR || dio_fallback(d)))
+                n = 0;
+            else if (n <= 0)
+                break;
+        }
+        pthread_mutex_lock(&d->lock);
+        if (n < 0)
+            d->err = errno;
+        else {
+            dio_drop(d, d->off, b->len);
+            d->off += b->len;
+            d->full++;
+        }
+        d->eof = (b->len < DIO_BUF_SZ);
+        pthread_cond_broadcast(&d->cond);
+        pthread_mutex_unlock(&d->lock);
+        if (d->eof)
+            return NULL;
+    }
+}
+
+//writes out the buffers dio_write() filled, the last one may be short
+static void *dio_writer(void *arg){
+    dio_file *d = arg;
+    dio_buf *b;
+    long n, len, done;
+
+    while (1) {
+        pthread_mutex_lock(&d->lock);
+        while ((d->full == 0) && !d->stop)
+            pthread_cond_wait(&d->cond, &d->lock);
+        if (d->full == 0) {
+            pthread_mutex_unlock(&d->lock);
+            return NULL;
+        }
+        b = &d->buf[d->head];
+        pthread_mutex_unlock(&d->lock);
+
+        //O_DIRECT writes whole blocks, dio_close() trims the padding
+        len = d->direct ? DIO_ROUNDUP(b->len) : b->len;
+        if (len > b->len)
+            memset(b->data + b->len, 0, len - b->len);
+        for (done = 0; (done < len) && (d->err == 0); done += n) {
+            n = pwrite(d->fd, b->data + done, (d->direct ? len : b->len) - done, d->off + done);
+            if ((n < 0) && (errno == EINTR || dio_fallback(d))) {
+                len = b->len;
+                n = 0;
+            } else if (n < 0)
+                d->err = errno;
+        }
+        dio_drop(d, d->off, b->len);
+
+        pthread_mutex_lock(&d->lock);
+        d->off += b->len;
+        b->len = 0;
+        d->head = (d->head + 1) % DIO_BUFS;
+        d->full--;
+        pthread_cond_broadcast(&d->cond);
+        pthread_mutex_unlock(&d->lock);
+    }
+}
+
+/*
+ *  fread() from the read ahead ring, returns the bytes copied into buff,
+ *  0 at the end of the file, or -1 with errno set if a read failed.
+ */
+long dio_read(dio_file *d, char *buff, long len){
+    dio_buf *b;
+    long n;
+
+    pthread_mutex_lock(&d->lock);
+    while ((d->full == 0) && !d->eof && (d->err == 0))
+        pthread_cond_wait(&d->cond, &d->lock);
+    if (d->full == 0) {
+        n = d->err ? -1 : 0;
+        errno = d->err;
+        pthread_mutex_unlock(&d->lock);
+        return n;
+    }
+    b = &d->buf[d->head];
+    pthread_mutex_unlock(&d->lock);
+
+    n = (len < b->len - b->pos) ? len : b->len - b->pos;
+    memcpy(buff, b->data + b->pos, n);
+    b->pos += n;
+    if (b->pos == b->len) {
+        pthread_mutex_lock(&d->lock);
+        d->head = (d->head + 1) % DIO_BUFS;
+        d->full--;
+        pthread_cond_broadcast(&d->cond);
+        pthread_mutex_unlock(&d->lock);
+    }
+    return n;
+}
+
+/*
+ *  fwrite() into the write behind ring, waits only when every buffer is
+ *  still on its way to disk.  Returns len, or -1 with errno set once a
+ *  write has failed.
+ */
+long dio_write(dio_file *d, const char *buff, long len){
+    dio_buf *b;
+    long n, done;
+
+    for (done = 0; done < len; done += n) {
+        pthread_mutex_lock(&d->lock);
+        while ((d->full == DIO_BUFS) && (d->err == 0))
+            pthread_cond_wait(&d->cond, &d->lock);
+        if (d->err != 0) {
+            errno = d->err;
+            pthread_mutex_unlock(&d->lock);
+            return -1;
+        }
+        //the buffer after the full ones is ours to fill
+        b = &d->buf[(d->head + d->full) % DIO_BUFS];
+        pthread_mutex_unlock(&d->lock);
+
+        n = (len - done < DIO_BUF_SZ - b->len) ? len - done : DIO_BUF_SZ - b->len;
+        memcpy(b->data + b->len, buff + done, n);
+        b->len += n;
+        if (b->len == DIO_BUF_SZ) {
+            pthread_mutex_lock(&d->lock);
+            d->full++;
+            pthread_cond_broadcast(&d->cond);
+            pthread_mutex_unlock(&d->lock);
+        }
+    }
+    d->size += len;
+    return len;
+}
+
+/*
+ *  Flushes what is left of a write, stops the thread and closes the file.
+ *  Returns 0, or -1 with errno set if any read or write failed.
+ */
+int dio_close(dio_file *d){
+    int i, err;
+
+    pthread_mutex_lock(&d->lock);
+    if (d->write && (d->full < DIO_BUFS) && (d->buf[(d->head + d->full) % DIO_BUFS].len > 0))
+        d->full++;
+    d->stop = true;
+    pthread_cond_broadcast(&d->cond);
+    pthread_mutex_unlock(&d->lock);
+    pthread_join(d->tid, NULL);
+
+    err = d->err;
+    if (d->write && d->direct && (ftruncate(d->fd, d->size) != 0) && (err == 0))
+        err = errno;
+    close(d->fd);
+    for (i = 0; i < DIO_BUFS; i++)
+        free(d->buf[i].data);
+    pthread_mutex_destroy(&d->lock);
+    pthread_cond_destroy(&d->cond);
+    free(d);
+    errno = err;
+    return err ? -1 : 0;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+
+/*
+ * Direct file I/O for du-ftp (-e), so a file much bigger than RAM does not
+ * push everything else out of the page cache.  The file is opened with
+ * O_DIRECT and moved in DIO_BUF_SZ blocks through a ring of DIO_BUFS
+ * aligned buffers, allocated once per file.  A thread of its own keeps the
+ * ring full ahead of dio_read(), or drains what dio_write() filled behind
+ * it, so the disk and the network overlap.  Where the filesystem will not
+ * take O_DIRECT (tmpfs) the file is read and written the normal way and
+ * the pages are dropped from the cache once each block is done.
+ */
+#define DIO_ALIGN       4096            //covers the logical block size of any disk we use
+#define DIO_BUF_SZ      (1 << 20)
+#define DIO_BUFS        4               //read ahead / write behind depth
+
+typedef struct dio_buf{
+    char        *data;                  //DIO_ALIGN aligned, DIO_BUF_SZ bytes
+    long        len;                    //bytes in it
+    long        pos;                    //bytes the reader took already
+} dio_buf;
+
+typedef struct dio_file{
+    int             fd;
+    _Bool           write;
+    _Bool           direct;             //O_DIRECT took, else pages get dropped
+    dio_buf         buf[DIO_BUFS];
+    int             head;               //oldest full buffer
+    int             full;               //full buffers from head on
+    long            off;                //file offset the thread is at
+    long            size;               //writer: bytes handed to dio_write()
+    _Bool           eof;                //reader: the thread hit the end
+    _Bool           stop;               //dio_close() wants the thread out
+    int             err;                //errno of a failed read or write
+    pthread_t       tid;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+} dio_file;
+
+dio_file *dio_open(const char *path, int write);
+long dio_read(dio_file *d, char *buff, long len);
+long dio_write(dio_file *d, const char *buff, long len);
+int  dio_close(dio_file *d);
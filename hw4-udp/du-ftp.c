@@ -1,18 +1,31 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <unistd.h> 
 #include <string.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
 
 #include "du-ftp.h"
 #include "du-proto.h"
+#include "du-cdc.h"
+#include "du-dio.h"
+#include "du-meter.h"
 
 
 #define BUFF_SZ 512
 static char sbuffer[BUFF_SZ];
 static char rbuffer[BUFF_SZ];
 static char full_file_path[FNAME_SZ];
+static int direct_io;                   //-e, the upload file goes through du-dio
+static int meter_ms, meter_json;        //-q
+static __thread prog_meter *meter;      //this thread's transfer, NULL if not reported
 
 /*
  *  Helper function that processes the command line arguements.  Highlights
@@ -26,6 +39,7 @@ static char full_file_path[FNAME_SZ];
  */
 static int initParams(int argc, char *argv[], prog_config *cfg){
     int option;
+    char fmt[8];
     //setup defaults if no arguements are passed
     static char cmdBuffer[64] = {0};
 
@@ -34,8 +48,34 @@ static int initParams(int argc, char *argv[], prog_config *cfg){
     cfg->port_number = DEF_PORT_NO;
     strcpy(cfg->file_name, PROG_DEF_FNAME);
     strcpy(cfg->svr_ip_addr, PROG_DEF_SVR_ADDR);
+    cfg->fec_grp = 0;
+    cfg->fec_parity = 0;
+    cfg->loss_pct = 0;
+    cfg->offload = 0;
+    cfg->uring = 0;
+    cfg->kern_ts = 0;
+    cfg->pmtud = 0;
+    cfg->sockbuf_kb = -1;
+    cfg->busy_us = 0;
+    cfg->busy_cpu = -1;
+    cfg->zerocopy = 0;
+    cfg->cookies = 0;
+    cfg->idle_s = 0;
+    cfg->path_cnt = 0;
+    cfg->delta = 0;
+    cfg->direct = 0;
+    cfg->progress_ms = 0;
+    cfg->progress_json = 0;
+    cfg->pack = 0;
+    cfg->xport = PROG_XP_UDP;
+    cfg->chunk_sz = 0;
+    cfg->coalesce_ms = 0;
+    cfg->more_files = NULL;
+    cfg->more_cnt = 0;
+    cfg->workers = 0;
+    cfg->pace_rate = DP_PACE_OFF;
     
-    while ((option = getopt(argc, argv, ":p:f:a:csh")) != -1){
+    while ((option = getopt(argc, argv, ":p:f:a:k:l:w:r:x:b:n:g:y:i:j:q:outmczvdeAsh")) != -1){
         switch(option) {
             case 'p':
                 strncpy(cmdBuffer, optarg, sizeof(cmdBuffer));
@@ -47,6 +87,87 @@ static int initParams(int argc, char *argv[], prog_config *cfg){
             case 'a':
                 strncpy(cfg->svr_ip_addr, optarg, sizeof(cfg->svr_ip_addr));
                 break;
+            case 'k':
+                cfg->fec_parity = 1;
+                sscanf(optarg, "%d:%d", &cfg->fec_grp, &cfg->fec_parity);
+                break;
+            case 'l':
+                cfg->loss_pct = atoi(optarg);
+                break;
+            case 'o':
+                cfg->offload = 1;
+                break;
+            case 'u':
+                cfg->uring = 1;
+                break;
+            case 't':
+                cfg->kern_ts = 1;
+                break;
+            case 'm':
+                cfg->pmtud = 1;
+                break;
+            case 'z':
+                cfg->zerocopy = 1;
+                break;
+            case 'v':
+                cfg->cookies = 1;
+                break;
+            case 'd':
+                cfg->delta = 1;
+                break;
+            case 'e':
+                cfg->direct = 1;
+                break;
+            case 'A':
+                cfg->pack = 1;
+                break;
+            case 'w':
+                cfg->workers = atoi(optarg);
+                break;
+            case 'r':
+                if (strcmp(optarg, "auto") == 0)
+                    cfg->pace_rate = DP_PACE_AUTO;
+                else
+                    cfg->pace_rate = atol(optarg) * 1024;
+                break;
+            case 'x':
+                if (strcmp(optarg, "unix") == 0)
+                    cfg->xport = PROG_XP_UNIX;
+                else if (strcmp(optarg, "mem") == 0)
+                    cfg->xport = PROG_XP_MEM;
+                else if (strcmp(optarg, "shm") == 0)
+                    cfg->xport = PROG_XP_SHM;
+                else
+                    cfg->xport = PROG_XP_UDP;
+                break;
+            case 'b':
+                cfg->chunk_sz = atoi(optarg);
+                break;
+            case 'n':
+                cfg->coalesce_ms = atoi(optarg);
+                break;
+            case 'g':
+                cfg->sockbuf_kb = atoi(optarg);
+                break;
+            case 'y':
+                sscanf(optarg, "%d:%d", &cfg->busy_us, &cfg->busy_cpu);
+                break;
+            case 'i':
+                cfg->idle_s = atoi(optarg);
+                break;
+            case 'q':
+                fmt[0] = '\0';
+                sscanf(optarg, "%d:%7s", &cfg->progress_ms, fmt);
+                cfg->progress_json = (strcmp(fmt, "json") == 0);
+                break;
+            case 'j':
+                if (cfg->path_cnt == PROG_MAX_PATHS) {
+                    printf("ERROR: At most %d extra paths (-j)\n", PROG_MAX_PATHS);
+                    exit(-1);
+                }
+                strncpy(cfg->paths[cfg->path_cnt], optarg, sizeof(cfg->paths[0]) - 1);
+                cfg->path_cnt++;
+                break;
             case 'c':
                 cfg->prog_mode = PROG_MD_CLI;
                 break;
@@ -54,11 +175,53 @@ static int initParams(int argc, char *argv[], prog_config *cfg){
                 cfg->prog_mode = PROG_MD_SVR;
                 break;
             case 'h':
-                printf("USAGE: %s [-p port] [-f fname] [-a svr_addr] [-s] [-c] [-h]\n", argv[0]);
+                printf("USAGE: %s [-p port] [-f fname] [-a svr_addr] [-k grp[:parity]] [-l loss_pct] [-o] [-u] [-t] [-m] [-z] [-v] [-d] [-e] [-w workers] [-r KBps|auto] [-x udp|unix|mem|shm] [-b bytes] [-n ms] [-g max_KB] [-y us[:cpu]] [-i secs] [-j addr[:port]] [-q ms[:json]] [-A] [-s] [-c] [-h] [files...]\n", argv[0]);
                 printf("WHERE:\n\t[-c] runs in client mode, [-s] runs in server mode; DEFAULT= client_mode\n");
                 printf("\t[-a svr_addr] specifies the servers IP address as a string; DEFAULT = %s\n", cfg->svr_ip_addr);
                 printf("\t[-p portnum] specifies the port number; DEFAULT = %d\n", cfg->port_number);
                 printf("\t[-f fname] specifies the filename to send or recv; DEFAULT = %s\n", cfg->file_name);
+                printf("\t[-k grp[:parity]] client only, turns on FEC with grp data + parity dgrams per group; DEFAULT = off, parity = 1\n");
+                printf("\t[-l loss_pct] simulates losing loss_pct%% of the data dgrams sent, use with -k; DEFAULT = 0\n");
+                printf("\t[-o] uses UDP GSO/GRO segmentation offload where the OS has it; DEFAULT = off\n");
+                printf("\t[-u] does socket I/O through io_uring (Linux) instead of plain socket calls; DEFAULT = off\n");
+                printf("\t[-t] measures RTT with kernel send/receive timestamps (SO_TIMESTAMPING, udp without -u); DEFAULT = off\n");
+                printf("\t[-m] client only, finds the path MTU and sends dgrams as big as it allows (udp, no -k); DEFAULT = off\n");
+                printf("\t[-z] client only, sends fname straight from an mmap of it, with MSG_ZEROCOPY for dgrams of %d bytes\n",
+                    DP_ZC_MIN_BYTES);
+                printf("\t\tand up (udp, no -u), use with -m or -b to get dgrams that big; DEFAULT = off\n");
+                printf("\t[-v] server only, answers a CONNECT with a cookie and sets nothing up until the client echoes it,\n");
+                printf("\t\tso a CONNECT flood from forged addresses cannot fill the backlog; DEFAULT = off\n");
+                printf("\t[-d] client only, sends just the parts of fname the server's copy lacks, found by content defined\n");
+                printf("\t\tchunking on both ends, the server rebuilds it from its copy (no -k, one file); DEFAULT = off\n");
+                printf("\t[-e] reads or writes fname with O_DIRECT, %d x %d KB of read ahead or write behind,\n",
+                    DIO_BUFS, DIO_BUF_SZ / 1024);
+                printf("\t\tso a huge file does not flush the page cache (no -z -d, one file); DEFAULT = off\n");
+                printf("\t[-w workers] server only, runs workers threads on one port (SO_REUSEPORT) serving clients until killed,\n");
+                printf("\t\teach upload is saved as fname.<worker>-<session>; DEFAULT = 0, serve one client and exit\n");
+                printf("\t[-r KBps|auto] paces sends to KBps kilobytes/sec, or to the measured delivery rate; DEFAULT = off\n");
+                printf("\t[-x udp|unix|mem|shm] transport, unix uses a Unix datagram socket at ");
+                printf(PROG_UNIX_PATH ",\n", cfg->port_number);
+                printf("\t\tshm shares memory with a server on this host through ");
+                printf(PROG_SHM_PATH ",\n", cfg->port_number);
+                printf("\t\tmem runs the client and the server in this one process over in-memory rings; DEFAULT = udp\n");
+                printf("\t[-b bytes] client only, sends the file bytes at a time; DEFAULT = 500, or the transport's biggest dgram\n");
+                printf("\t[-n ms] client only, packs small sends into one dgram, holding them for up to ms; DEFAULT = off\n");
+                printf("\t[-g max_KB] sizes the socket buffers from the bandwidth-delay product, up to max_KB (0 = %d)\n",
+                    DP_SOCKBUF_MAX / 1024);
+                printf("\t\tand reports kernel receive drops (udp, unix); DEFAULT = off, the kernel's sizes\n");
+                printf("\t[-y us[:cpu]] spins up to us microseconds for each dgram before sleeping, on core cpu\n");
+                printf("\t\t(udp, unix, no -u), -w workers keep their own cores; DEFAULT = off\n");
+                printf("\t[-i secs] gives up on a peer that has said nothing for secs, sending it keepalives every\n");
+                printf("\t\tsecs/%d until then; DEFAULT = off, wait forever\n", DP_KEEPALIVE_PROBES);
+                printf("\t[-j addr[:port]] client only, also sends over a socket bound to this local address and/or port,\n");
+                printf("\t\tspreading dgrams (FEC groups with -k) over the paths by RTT and loss, up to %d times (udp, no -u -o -t -z -y);\n",
+                    PROG_MAX_PATHS);
+                printf("\t\tDEFAULT = one path\n");
+                printf("\t[-q ms[:json]] reports progress, rate, retransmits and time left to stderr every ms,\n");
+                printf("\t\tas one JSON object per line with :json; DEFAULT = off\n");
+                printf("\t[-A] client only, packs fname and the files (or directory trees) after the options into one\n");
+                printf("\t\tarchive sent on a single stream, the server unpacks it as it comes in; DEFAULT = off\n");
+                printf("\t[files...] client only, sends fname and these files together, each on its own stream\n");
                 printf("\t[-p] displays what you are looking at now - the help\n\n");
                 exit(0);
             case ':':
@@ -70,32 +233,449 @@ static int initParams(int argc, char *argv[], prog_config *cfg){
                 exit(-1);
         }
     }
+    if (optind < argc) {
+        cfg->more_files = &argv[optind];
+        cfg->more_cnt = argc - optind;
+    }
     return cfg->prog_mode;
 }
 
-int server_loop(dp_connp dpc, void *sBuff, void *rBuff, int sbuff_sz, int rbuff_sz){
-    int rcvSz;
+/*
+ *  Hands one message of a multi file upload to its file.  The first one
+ *  on a stream names the file, it is saved under the same directory as
+ *  fname.  rcvSz DP_STREAM_CLOSED closes the file.
+ */
+static void server_stream(svr_stream *st, uint32_t sid, char *fname, char *rBuff, int rcvSz){
+    char path[FNAME_SZ];
+    char *name, *dir;
+    int i, slot = -1;
 
-    FILE *f = fopen(full_file_path, "wb+");
-    if(f == NULL){
-        printf("ERROR:  Cannot open file %s\n", full_file_path);
-        exit(-1);
+    for (i = 0; i < PROG_MAX_STREAMS; i++) {
+        if ((st[i].f != NULL) && (st[i].id == sid))
+            break;
+        if ((st[i].f == NULL) && (slot < 0))
+            slot = i;
+    }
+    if (i < PROG_MAX_STREAMS) {
+        if (rcvSz == DP_STREAM_CLOSED) {
+            printf("Stream %u: %ld bytes\n", sid, st[i].bytes);
+            fclose(st[i].f);
+            st[i].f = NULL;
+            return;
+        }
+        fwrite(rBuff, 1, rcvSz, st[i].f);
+        st[i].bytes += rcvSz;
+        return;
+    }
+    if ((rcvSz <= 0) || (slot < 0)) {
+        printf("ERROR: Dropping data for stream %u\n", sid);
+        return;
+    }
+
+    //a new stream, keep just the base name of what the client sent
+    rBuff[rcvSz - 1] = '\0';
+    name = strrchr(rBuff, '/') ? strrchr(rBuff, '/') + 1 : rBuff;
+    dir = strrchr(fname, '/');
+    snprintf(path, sizeof(path), "%.*s/%s", dir ? (int)(dir - fname) : 1, 
+        dir ? fname : ".", name);
+    if ((st[slot].f = fopen(path, "wb+")) == NULL) {
+        printf("ERROR:  Cannot open file %s\n", path);
+        return;
+    }
+    st[slot].id = sid;
+    st[slot].bytes = 0;
+    printf("Stream %u: receiving %s\n", sid, path);
+}
+
+/*
+ *  Opens a file unpacked from an archive, name is relative to fname's
+ *  directory and may have directories of its own, they are made as needed.
+ *  Names that would land outside of it are refused.
+ */
+static FILE *server_pack_open(char *fname, char *name){
+    char path[FNAME_SZ];
+    char *dir, *p;
+    FILE *f;
+    int base;
+
+    if ((name[0] == '/') || (strcmp(name, "..") == 0) || (strncmp(name, "../", 3) == 0) ||
+        strstr(name, "/../") || ((strlen(name) >= 3) && (strcmp(name + strlen(name) - 3, "/..") == 0))) {
+        printf("ERROR:  Refusing to unpack %s\n", name);
+        return NULL;
+    }
+    dir = strrchr(fname, '/');
+    base = snprintf(path, sizeof(path), "%.*s/", dir ? (int)(dir - fname) : 1, dir ? fname : ".");
+    if (snprintf(path + base, sizeof(path) - base, "%s", name) >= sizeof(path) - base) {
+        printf("ERROR:  Name too long to unpack %s\n", name);
+        return NULL;
+    }
+    for (p = strchr(path + base, '/'); p != NULL; p = strchr(p + 1, '/')) {
+        *p = '\0';
+        mkdir(path, 0755);
+        *p = '/';
+    }
+    if ((f = fopen(path, "wb")) == NULL)
+        printf("ERROR:  Cannot open file %s\n", path);
+    return f;
+}
+
+/*
+ *  Unpacks the next piece of a packed upload (see du-ftp.h), entries can
+ *  start and end anywhere in it.  rcvSz DP_STREAM_CLOSED ends the archive.
+ */
+static void server_pack(svr_pack *pk, char *fname, char *rBuff, int rcvSz){
+    int n;
+
+    if (rcvSz == DP_STREAM_CLOSED) {
+        if (pk->f != NULL)
+            fclose(pk->f);
+        if (pk->done && (pk->files < pk->entries))
+            printf("Pack: unpacked %ld files, %llu bytes, dropped %ld\n", pk->files,
+                (unsigned long long)pk->bytes, pk->entries - pk->files);
+        else if (pk->done)
+            printf("Pack: unpacked %ld files, %llu bytes\n", pk->files, (unsigned long long)pk->bytes);
+        else
+            printf("ERROR:  Packed upload ended early, after %ld files\n", pk->entries);
+        memset(pk, 0, sizeof(*pk));
+        return;
+    }
+
+    while ((rcvSz > 0) && !pk->broken) {
+        if (pk->inData) {
+            n = (pk->left < rcvSz) ? pk->left : rcvSz;
+            if ((pk->f != NULL) && (fwrite(rBuff, 1, n, pk->f) != n)) {
+                printf("ERROR:  Cannot write %s\n", pk->name);
+                fclose(pk->f);
+                pk->f = NULL;
+            }
+            pk->left -= n;
+        } else if (pk->have < sizeof(pack_entry)) {
+            n = sizeof(pack_entry) - pk->have;
+            n = (n < rcvSz) ? n : rcvSz;
+            memcpy((char *)&pk->hdr + pk->have, rBuff, n);
+            pk->have += n;
+        } else {
+            n = sizeof(pack_entry) + pk->hdr.name_len - pk->have;
+            n = (n < rcvSz) ? n : rcvSz;
+            memcpy(pk->name + pk->have - sizeof(pack_entry), rBuff, n);
+            pk->have += n;
+        }
+        rBuff += n;
+        rcvSz -= n;
+        pk->pos += n;
+
+        //a header just came in whole
+        if (!pk->inData && (pk->have == sizeof(pack_entry)) && (n > 0)) {
+            if ((pk->hdr.magic != PACK_MAGIC) || (pk->hdr.name_len >= sizeof(pk->name)) ||
+                pk->done) {
+                printf("ERROR:  Bad packed upload at offset %llu\n", 
+                    (unsigned long long)(pk->pos - sizeof(pack_entry)));
+                pk->broken = true;
+            } else if (pk->hdr.name_len == 0) {
+                pk->done = true;
+                pk->have = 0;
+                if (pk->hdr.size != pk->entries)
+                    printf("ERROR:  Packed upload has %llu files, got %ld\n",
+                        (unsigned long long)pk->hdr.size, pk->entries);
+            }
+            continue;
+        }
+        //and its name
+        if (!pk->inData && (pk->have > sizeof(pack_entry)) &&
+            (pk->have == sizeof(pack_entry) + pk->hdr.name_len)) {
+            pk->name[pk->hdr.name_len] = '\0';
+            if (pk->hdr.offset != pk->pos) {
+                printf("ERROR:  %s should be at offset %llu, not %llu\n", pk->name,
+                    (unsigned long long)pk->pos, (unsigned long long)pk->hdr.offset);
+                pk->broken = true;
+                continue;
+            }
+            pk->f = server_pack_open(fname, pk->name);
+            pk->left = pk->hdr.size;
+            pk->inData = true;
+        }
+        if (pk->inData && (pk->left == 0)) {
+            //only what landed in a file counts as unpacked
+            if ((pk->f != NULL) && (fclose(pk->f) == 0)) {
+                pk->files++;
+                pk->bytes += pk->hdr.size;
+            } else if (pk->f != NULL)
+                printf("ERROR:  Cannot write %s\n", pk->name);
+            pk->f = NULL;
+            pk->inData = false;
+            pk->have = 0;
+            pk->entries++;
+        }
+    }
+}
+
+//drops a sync that did not get to DONE, the old copy stays as it was
+static void server_sync_end(svr_sync *sy){
+    if (sy->out != NULL) {
+        fclose(sy->out);
+        unlink(sy->tmp);
+    }
+    if (sy->old != NULL)
+        munmap(sy->old, sy->oldSz);
+    free(sy->chunkOff);
+    free(sy->chunkLen);
+    memset(sy, 0, sizeof(*sy));
+}
+
+/*
+ *  Chunks the old copy of fname (if there is one) and sends the client the
+ *  digests, msgSz bytes of them at a time.
+ */
+static int server_sync_sums(dp_connp dpc, svr_sync *sy, char *fname, int msgSz){
+    struct stat st;
+    sync_msg *msg;
+    cdc_sum *sums;
+    char *buff;
+    long off;
+    int fd, len, n = 0, max = 0, rc = DP_NO_ERROR;
+
+    if ((fd = open(fname, O_RDONLY)) >= 0) {
+        if ((fstat(fd, &st) == 0) && (st.st_size > 0)) {
+            sy->old = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (sy->old == MAP_FAILED)
+                sy->old = NULL;
+            else {
+                sy->oldSz = st.st_size;
+                madvise(sy->old, sy->oldSz, MADV_SEQUENTIAL);
+            }
+        }
+        close(fd);
     }
+
+    if ((buff = malloc(msgSz)) == NULL)
+        return DP_ERROR_GENERAL;
+    msg = (sync_msg *)buff;
+    sums = (cdc_sum *)(buff + sizeof(sync_msg));
+    for (off = 0; (off < sy->oldSz) && (rc >= 0); off += len) {
+        len = cdc_cut((uint8_t *)sy->old + off, sy->oldSz - off);
+        if (sy->chunks == max) {
+            max = max ? max * 2 : 1024;
+            sy->chunkOff = realloc(sy->chunkOff, max * sizeof(long));
+            sy->chunkLen = realloc(sy->chunkLen, max * sizeof(int));
+            if ((sy->chunkOff == NULL) || (sy->chunkLen == NULL)) {
+                rc = DP_ERROR_GENERAL;
+                break;
+            }
+        }
+        sy->chunkOff[sy->chunks] = off;
+        sy->chunkLen[sy->chunks++] = len;
+        cdc_digest((uint8_t *)sy->old + off, len, &sums[n++]);
+        if (sizeof(sync_msg) + (n + 1) * sizeof(cdc_sum) > msgSz) {
+            msg->op = SYNC_OP_SUMS;
+            msg->count = n;
+            rc = dpsendstream(dpc, PROG_SYNC_STREAM, buff, sizeof(sync_msg) + n * sizeof(cdc_sum));
+            n = 0;
+        }
+    }
+    if ((n > 0) && (rc >= 0)) {
+        msg->op = SYNC_OP_SUMS;
+        msg->count = n;
+        rc = dpsendstream(dpc, PROG_SYNC_STREAM, buff, sizeof(sync_msg) + n * sizeof(cdc_sum));
+    }
+    if (rc >= 0) {
+        msg->op = SYNC_OP_SUMS_END;
+        msg->count = 0;
+        rc = dpsendstream(dpc, PROG_SYNC_STREAM, buff, sizeof(sync_msg));
+    }
+    free(buff);
+    return (rc < 0) ? rc : DP_NO_ERROR;
+}
+
+/*
+ *  Hands one message of a delta sync (see du-ftp.h) to the server side of
+ *  it.  A bad message drops the sync, the client finds out when its own
+ *  sends fail.
+ */
+static void server_sync(dp_connp dpc, svr_sync *sy, char *fname, char *rBuff, int rcvSz){
+    sync_msg msg;
+    sync_run run;
+    long off, bytes;
+    int i, err;
+
+    if (rcvSz < (int)sizeof(sync_msg))
+        return;
+    memcpy(&msg, rBuff, sizeof(msg));
+    rBuff += sizeof(msg);
+    rcvSz -= sizeof(msg);
+
+    if (msg.op == SYNC_OP_HELLO) {
+        server_sync_end(sy);
+        sy->active = true;
+        snprintf(sy->tmp, sizeof(sy->tmp), "%s.sync", fname);
+        //nowhere to rebuild it, closing the stream fails the client's wait
+        //for the chunks instead of letting it sync into nothing
+        if ((sy->out = fopen(sy->tmp, "wb")) == NULL) {
+            printf("ERROR:  Cannot open file %s\n", sy->tmp);
+            server_sync_end(sy);
+            dpclosestream(dpc, PROG_SYNC_STREAM);
+            return;
+        }
+        if (msg.count > dpmaxpayload(dpc))
+            msg.count = dpmaxpayload(dpc);
+        if ((msg.count < sizeof(sync_msg) + sizeof(cdc_sum)) ||
+            (server_sync_sums(dpc, sy, fname, msg.count) != DP_NO_ERROR)) {
+            printf("ERROR:  Cannot send the chunks of %s\n", fname);
+            server_sync_end(sy);
+        }
+        return;
+    }
+    if (!sy->active || (sy->out == NULL))
+        return;
+
+    switch (msg.op) {
+        case SYNC_OP_COPY:
+            for (i = 0; (i < msg.count) && ((i + 1) * (int)sizeof(run) <= rcvSz); i++) {
+                memcpy(&run, rBuff + i * sizeof(run), sizeof(run));
+                if ((run.count == 0) || (run.first >= sy->chunks) || 
+                    (run.count > sy->chunks - run.first)) {
+                    printf("ERROR:  Sync asked for chunks %u+%u of %d\n", 
+                        run.first, run.count, sy->chunks);
+                    server_sync_end(sy);
+                    return;
+                }
+                //chunks next to each other are next to each other on disk too
+                off = sy->chunkOff[run.first];
+                bytes = sy->chunkOff[run.first + run.count - 1] + 
+                        sy->chunkLen[run.first + run.count - 1] - off;
+                if (fwrite(sy->old + off, 1, bytes, sy->out) != bytes) {
+                    printf("ERROR:  Cannot write %s\n", sy->tmp);
+                    server_sync_end(sy);
+                    return;
+                }
+                sy->copied += bytes;
+            }
+            break;
+        case SYNC_OP_DATA:
+            if (msg.count > rcvSz)
+                msg.count = rcvSz;
+            if (fwrite(rBuff, 1, msg.count, sy->out) != msg.count) {
+                printf("ERROR:  Cannot write %s\n", sy->tmp);
+                server_sync_end(sy);
+                return;
+            }
+            sy->literal += msg.count;
+            break;
+        case SYNC_OP_DONE:
+            //a short copy must never take the old one's place
+            err = ferror(sy->out);
+            if ((fclose(sy->out) != 0) || err || (rename(sy->tmp, fname) != 0)) {
+                printf("ERROR:  Cannot put the synced file in place of %s\n", fname);
+                unlink(sy->tmp);
+            } else
+                printf("Sync: rebuilt %s, %ld bytes from the old copy and %ld sent\n", 
+                    fname, sy->copied, sy->literal);
+            sy->out = NULL;
+            server_sync_end(sy);
+            break;
+        default:
+            printf("ERROR:  Unknown sync message %u\n", msg.op);
+            server_sync_end(sy);
+            break;
+    }
+}
+
+int server_loop(dp_connp dpc, char *fname, void *sBuff, void *rBuff, int sbuff_sz, int rbuff_sz){
+    int i, rcvSz;
+    uint32_t sid;
+    char *bigBuff = NULL;
+    svr_stream streams[PROG_MAX_STREAMS] = {0};
+    svr_sync sync = {0};
+    svr_pack pack = {0};
+    _Bool other = false;                //something besides a plain upload came in
+    FILE *f = NULL;
+    dio_file *df = NULL;                //f with -e
+    _Bool failed = false;               //writing f failed, the rest has nowhere to go
+
+    //transports with big dgrams (shm) need a bigger receive buffer, so
+    //does a client doing path MTU discovery, it may go up to jumbo frames
+    int need = (dpmaxpayload(dpc) > DP_PMTU_MAX_PAYLOAD) ? 
+                    dpmaxpayload(dpc) : DP_PMTU_MAX_PAYLOAD;
+    if (rbuff_sz < need) {
+        rbuff_sz = need;
+        if ((rBuff = bigBuff = malloc(rbuff_sz)) == NULL) {
+            printf("ERROR:  Cannot allocate a %d byte receive buffer\n", rbuff_sz);
+            exit(-1);
+        }
+    }
+
     if (dpc->isConnected == false){
         perror("Expecting the protocol to be in connect state, but its not");
         exit(-1);
     }
+    meter = meter_start(fname, 0, meter_ms, meter_json);
     //Loop until a disconnect is received, or error hapens
     while(1) {
 
         //receive request from client
-        rcvSz = dprecv(dpc, rBuff, rbuff_sz);
+        sid = DP_STREAM_DEFAULT;
+        rcvSz = failed ? DP_ERROR_GENERAL : dprecvstream(dpc, &sid, rBuff, rbuff_sz);
+        if (rcvSz > 0)
+            meter_add(meter, rcvSz, dpc->stats.dgramsOut, dpc->stats.retransmits);
+        if ((rcvSz >= 0) || (rcvSz == DP_STREAM_CLOSED)) {
+            other |= (sid != DP_STREAM_DEFAULT);
+            if (sid == PROG_SYNC_STREAM)
+                server_sync(dpc, &sync, fname, rBuff, rcvSz);
+            else if (sid == PROG_PACK_STREAM)
+                server_pack(&pack, fname, rBuff, rcvSz);
+            else if (sid != DP_STREAM_DEFAULT)
+                server_stream(streams, sid, fname, rBuff, rcvSz);
+            if ((sid != DP_STREAM_DEFAULT) || (rcvSz < 0))
+                continue;
+        } else {
+            for (i = 0; i < PROG_MAX_STREAMS; i++)
+                if (streams[i].f != NULL)
+                    fclose(streams[i].f);
+            server_sync_end(&sync);
+            if (pack.f != NULL)
+                fclose(pack.f);
+            //an upload of nothing still leaves an empty fname behind
+            if ((f == NULL) && (df == NULL) && !other)
+                f = fopen(fname, "wb+");
+            if (f != NULL)
+                fclose(f);
+            if ((df != NULL) && (dio_close(df) != 0))
+                perror("Writing the file failed");
+            meter_stop(meter);
+            meter = NULL;
+        }
         if (rcvSz == DP_CONNECTION_CLOSED){
-            fclose(f);
+            free(bigBuff);
             printf("Client closed connection\n");
             return DP_CONNECTION_CLOSED;
         }
-        fwrite(rBuff, 1, rcvSz, f);
+        if (rcvSz < 0){
+            free(bigBuff);
+            if (failed)
+                printf("ERROR: Cannot write %s, dropping the session\n", fname);
+            else if (rcvSz == DP_ERROR_TIMEOUT)
+                printf("ERROR: Client went quiet, dropping the session\n");
+            else
+                printf("ERROR: Receive failed (%d), dropping the session\n", rcvSz);
+            return rcvSz;
+        }
+        //opened on the first data, a delta sync still needs the old copy
+        if (direct_io) {
+            if ((df == NULL) && ((df = dio_open(fname, true)) == NULL)) {
+                printf("ERROR:  Cannot open file %s\n", fname);
+                exit(-1);
+            }
+            //dio_close() reports why, a write error latches and fails every one after
+            if (dio_write(df, rBuff, rcvSz) < 0) {
+                failed = true;
+                continue;
+            }
+        } else {
+            if ((f == NULL) && ((f = fopen(fname, "wb+")) == NULL)) {
+                printf("ERROR:  Cannot open file %s\n", fname);
+                exit(-1);
+            }
+            fwrite(rBuff, 1, rcvSz, f);
+        }
         rcvSz = rcvSz > 50 ? 50 : rcvSz;    //Just print the first 50 characters max
 
         printf("========================> \n%.*s\n========================> \n", 
@@ -106,36 +686,649 @@ int server_loop(dp_connp dpc, void *sBuff, void *rBuff, int sbuff_sz, int rbuff_
 
 
 
-void start_client(dp_connp dpc){
-    static char sBuff[500];
+/*
+ *  Sends one chunk, in pieces if the connection's payload came down under
+ *  it (path MTU discovery).  With follow set the chunks track the payload
+ *  up as well, see read_sz().
+ */
+static void send_chunk(dp_connp dpc, uint32_t sid, char *buff, int bytes){
+    int off, sz, rc;
 
-    if(!dpc->isConnected) {
-        printf("Client not connected\n");
+    for (off = 0; off < bytes; off += sz) {
+        sz = bytes - off;
+        if (sz > dpmaxpayload(dpc))
+            sz = dpmaxpayload(dpc);
+        rc = dpsendstream(dpc, sid, buff + off, sz);
+        if (rc == DP_BUFF_UNDERSIZED) {
+            sz = 0;                     //shrank while we sent, go again
+            continue;
+        }
+        if (rc < 0) {
+            printf("ERROR:  Send failed (%d)\n", rc);
+            exit(-1);
+        }
+        meter_add(meter, sz, dpc->stats.dgramsOut, dpc->stats.retransmits);
+    }
+}
+
+static int read_sz(dp_connp dpc, int buff_sz, int follow){
+    if (follow && (dpmaxpayload(dpc) < buff_sz))
+        return dpmaxpayload(dpc);
+    return buff_sz;
+}
+
+//sends every file on its own stream, one chunk of each in turn
+static void send_streams(dp_connp dpc, char *buff, int buff_sz, int follow, 
+                         char **files, int nfiles){
+    FILE *f[PROG_MAX_STREAMS];
+    char path[FNAME_SZ];
+    int i, bytes, open;
+
+    if (nfiles > PROG_MAX_STREAMS) {
+        printf("ERROR:  At most %d files go in one upload\n", PROG_MAX_STREAMS);
+        exit(-1);
+    }
+    for (i = 0; i < nfiles; i++) {
+        snprintf(path, sizeof(path), "./outfile/%s", files[i]);
+        if ((f[i] = fopen(path, "rb")) == NULL) {
+            printf("ERROR:  Cannot open file %s\n", path);
+            exit(-1);
+        }
+        send_chunk(dpc, i + 1, files[i], strlen(files[i]) + 1);
+    }
+    for (open = nfiles; open > 0; ) {
+        for (i = 0; i < nfiles; i++) {
+            if (f[i] == NULL)
+                continue;
+            if ((bytes = fread(buff, 1, read_sz(dpc, buff_sz, follow), f[i])) > 0) {
+                send_chunk(dpc, i + 1, buff, bytes);
+                continue;
+            }
+            fclose(f[i]);
+            f[i] = NULL;
+            open--;
+            dpclosestream(dpc, i + 1);
+        }
+    }
+}
+
+//sends fname straight out of its mapping, no read() copy
+static void send_mapped(dp_connp dpc, int buff_sz, int follow){
+    struct stat st;
+    char *map;
+    long off;
+    int fd, sz;
+
+    if (((fd = open(full_file_path, O_RDONLY)) < 0) || (fstat(fd, &st) < 0)) {
+        printf("ERROR:  Cannot open file %s\n", full_file_path);
+        exit(-1);
+    }
+    if (st.st_size > 0) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            printf("ERROR:  Cannot map file %s\n", full_file_path);
+            exit(-1);
+        }
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+        for (off = 0; off < st.st_size; off += sz) {
+            sz = read_sz(dpc, buff_sz, follow);
+            if (sz > st.st_size - off)
+                sz = st.st_size - off;
+            send_chunk(dpc, DP_STREAM_DEFAULT, map + off, sz);
+        }
+        munmap(map, st.st_size);
+    }
+    close(fd);
+}
+
+//sends what the archive has so far
+static void pack_flush(dp_connp dpc, cli_pack *pk){
+    if (pk->len > 0)
+        send_chunk(dpc, PROG_PACK_STREAM, pk->buff, pk->len);
+    pk->len = 0;
+}
+
+static void pack_put(dp_connp dpc, cli_pack *pk, const void *data, int len){
+    int n;
+
+    for (; len > 0; len -= n, data = (char *)data + n) {
+        if (pk->len == pk->buff_sz)
+            pack_flush(dpc, pk);
+        n = (len < pk->buff_sz - pk->len) ? len : pk->buff_sz - pk->len;
+        memcpy(pk->buff + pk->len, data, n);
+        pk->len += n;
+        pk->pos += n;
+    }
+}
+
+/*
+ *  Adds ./outfile/name to the archive, everything under it if it is a
+ *  directory.  The data is read straight into the archive buffer.
+ */
+static void pack_file(dp_connp dpc, cli_pack *pk, char *name){
+    char path[FNAME_SZ], child[FNAME_SZ];
+    pack_entry hdr;
+    struct dirent *de;
+    struct stat st;
+    uint64_t left;
+    DIR *dir;
+    FILE *f;
+    int n;
+
+    snprintf(path, sizeof(path), "./outfile/%s", name);
+    if (stat(path, &st) != 0) {
+        printf("ERROR:  Cannot open file %s\n", path);
+        exit(-1);
+    }
+    if (S_ISDIR(st.st_mode)) {
+        if ((dir = opendir(path)) == NULL) {
+            printf("ERROR:  Cannot open directory %s\n", path);
+            exit(-1);
+        }
+        while ((de = readdir(dir)) != NULL) {
+            if ((strcmp(de->d_name, ".") == 0) || (strcmp(de->d_name, "..") == 0))
+                continue;
+            if (snprintf(child, sizeof(child), "%s/%s", name, de->d_name) >= sizeof(child)) {
+                printf("ERROR:  Name too long to pack %s/%s\n", name, de->d_name);
+                exit(-1);
+            }
+            pack_file(dpc, pk, child);
+        }
+        closedir(dir);
         return;
     }
+    if (!S_ISREG(st.st_mode) || ((f = fopen(path, "rb")) == NULL))
+        return;
+
+    hdr.magic = PACK_MAGIC;
+    hdr.name_len = strlen(name);
+    hdr.size = st.st_size;
+    hdr.offset = pk->pos + sizeof(hdr) + hdr.name_len;
+    pack_put(dpc, pk, &hdr, sizeof(hdr));
+    pack_put(dpc, pk, name, hdr.name_len);
+    for (left = hdr.size; left > 0; left -= n) {
+        if (pk->len == pk->buff_sz)
+            pack_flush(dpc, pk);
+        n = (left < pk->buff_sz - pk->len) ? left : pk->buff_sz - pk->len;
+        //the header already said how big, a file that shrank gets zeros
+        if (fread(pk->buff + pk->len, 1, n, f) != n) {
+            printf("Warning: %s changed while it was packed\n", path);
+            memset(pk->buff + pk->len, 0, n);
+        }
+        pk->len += n;
+        pk->pos += n;
+    }
+    fclose(f);
+    pk->files++;
+}
+
+//packs every file (or directory tree) into one archive on its own stream
+static void send_pack(dp_connp dpc, char *buff, int buff_sz, char **files, int nfiles){
+    cli_pack pk = {0};
+    pack_entry end = {0};
+    int i;
+
+    pk.buff = buff;
+    pk.buff_sz = buff_sz;
+    for (i = 0; i < nfiles; i++)
+        pack_file(dpc, &pk, files[i]);
+    end.magic = PACK_MAGIC;
+    end.size = pk.files;
+    end.offset = pk.pos + sizeof(end);
+    pack_put(dpc, &pk, &end, sizeof(end));
+    pack_flush(dpc, &pk);
+    dpclosestream(dpc, PROG_PACK_STREAM);
+    printf("Pack: sent %ld files in a %llu byte archive\n", pk.files, (unsigned long long)pk.pos);
+}
 
+//sends fname out of du-dio's read ahead, none of it stays in the page cache
+static void send_direct(dp_connp dpc, char *buff, int buff_sz, int follow){
+    dio_file *d;
+    long bytes;
 
-    FILE *f = fopen(full_file_path, "rb");
-    if(f == NULL){
+    if ((d = dio_open(full_file_path, false)) == NULL) {
         printf("ERROR:  Cannot open file %s\n", full_file_path);
         exit(-1);
     }
+    while ((bytes = dio_read(d, buff, read_sz(dpc, buff_sz, follow))) > 0)
+        send_chunk(dpc, DP_STREAM_DEFAULT, buff, bytes);
+    if ((dio_close(d) != 0) || (bytes < 0)) {
+        perror("Reading the file failed");
+        exit(-1);
+    }
+}
+
+/*
+ *  Gets the digests of the server's chunks for send_delta() and files them
+ *  in an open addressed table by their first word, slots hold index + 1.
+ *  Returns the number of chunks, the table has *mask + 1 slots.
+ */
+static int delta_sums(dp_connp dpc, cdc_sum **sums, uint32_t **table, uint32_t *mask){
+    char *buff;
+    sync_msg msg;
+    uint32_t sid, slot;
+    int i, rc, n = 0, max = 0;
+    int buff_sz = dpmaxpayload(dpc);
+
+    if ((buff = malloc(buff_sz)) == NULL)
+        return DP_ERROR_GENERAL;
+    msg.op = SYNC_OP_HELLO;
+    msg.count = buff_sz;
+    if ((rc = dpsendstream(dpc, PROG_SYNC_STREAM, &msg, sizeof(msg))) < 0) {
+        free(buff);
+        return rc;
+    }
+    *sums = NULL;
+    while (1) {
+        rc = dprecvstream(dpc, &sid, buff, buff_sz);
+        if (rc < 0) {
+            free(buff);
+            return rc;
+        }
+        if ((sid != PROG_SYNC_STREAM) || (rc < (int)sizeof(msg)))
+            continue;
+        memcpy(&msg, buff, sizeof(msg));
+        if (msg.op == SYNC_OP_SUMS_END)
+            break;
+        //count first, a big one would wrap the length it is checked against
+        if ((msg.op != SYNC_OP_SUMS) ||
+            (msg.count > (rc - sizeof(msg)) / sizeof(cdc_sum)) ||
+            (rc != sizeof(msg) + msg.count * sizeof(cdc_sum)))
+            continue;
+        if (n + msg.count > max) {
+            max = (n + msg.count) * 2;
+            if ((*sums = realloc(*sums, max * sizeof(cdc_sum))) == NULL) {
+                free(buff);
+                return DP_ERROR_GENERAL;
+            }
+        }
+        memcpy(*sums + n, buff + sizeof(msg), msg.count * sizeof(cdc_sum));
+        n += msg.count;
+    }
+    free(buff);
+
+    for (*mask = 1023; *mask < 2 * n; *mask = (*mask << 1) | 1)
+        ;
+    if ((*table = calloc(*mask + 1, sizeof(uint32_t))) == NULL)
+        return DP_ERROR_GENERAL;
+    for (i = 0; i < n; i++) {
+        for (slot = (*sums)[i].h[0] & *mask; (*table)[slot] != 0; slot = (slot + 1) & *mask)
+            ;
+        (*table)[slot] = i + 1;
+    }
+    return n;
+}
+
+//sends what is in buff (a COPY or DATA message being built) and empties it
+static void delta_flush(dp_connp dpc, char *buff, int *len){
+    sync_msg *msg = (sync_msg *)buff;
+
+    if (*len <= sizeof(sync_msg))
+        return;
+    msg->count = (msg->op == SYNC_OP_COPY) ? 
+                    (*len - sizeof(sync_msg)) / sizeof(sync_run) : *len - sizeof(sync_msg);
+    send_chunk(dpc, PROG_SYNC_STREAM, buff, *len);
+    *len = sizeof(sync_msg);
+}
+
+/*
+ *  Delta sync of fname (see du-ftp.h), the client side.  Chunks the file
+ *  the same way the server chunked its copy, chunks it has get copied on
+ *  the server, in runs, and only the rest is sent.
+ */
+static void send_delta(dp_connp dpc, char *buff, int buff_sz){
+    struct stat st;
+    sync_msg *msg = (sync_msg *)buff;
+    sync_run *run;
+    cdc_sum *sums, sum;
+    uint32_t *table, mask, slot, idx;
+    char *map = NULL;
+    long off, sent = 0;
+    int fd, n, len, piece, matched = 0, chunks = 0;
+    int out = sizeof(sync_msg);
+
+    if (buff_sz > dpmaxpayload(dpc))
+        buff_sz = dpmaxpayload(dpc);
+    if (buff_sz < sizeof(sync_msg) + sizeof(sync_run)) {
+        printf("ERROR:  Delta sync needs bigger sends than %d bytes\n", buff_sz);
+        exit(-1);
+    }
+    if (((fd = open(full_file_path, O_RDONLY)) < 0) || (fstat(fd, &st) < 0)) {
+        printf("ERROR:  Cannot open file %s\n", full_file_path);
+        exit(-1);
+    }
+    if (st.st_size > 0) {
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            printf("ERROR:  Cannot map file %s\n", full_file_path);
+            exit(-1);
+        }
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+    }
+    if ((n = delta_sums(dpc, &sums, &table, &mask)) < 0) {
+        printf("ERROR:  Cannot get the server's chunks (%d)\n", n);
+        exit(-1);
+    }
+
+    msg->op = 0;
+    for (off = 0; off < st.st_size; off += len) {
+        len = cdc_cut((uint8_t *)map + off, st.st_size - off);
+        cdc_digest((uint8_t *)map + off, len, &sum);
+        chunks++;
+        for (slot = sum.h[0] & mask; (idx = table[slot]) != 0; slot = (slot + 1) & mask)
+            if ((sums[idx - 1].h[0] == sum.h[0]) && (sums[idx - 1].h[1] == sum.h[1]) &&
+                (sums[idx - 1].len == sum.len))
+                break;
+
+        if (idx != 0) {
+            //the server has it, carry on the last run if it picks up from there
+            matched++;
+            if (msg->op != SYNC_OP_COPY)
+                delta_flush(dpc, buff, &out);
+            msg->op = SYNC_OP_COPY;
+            run = (sync_run *)(buff + out) - 1;
+            if ((out > sizeof(sync_msg)) && (run->first + run->count == idx - 1)) {
+                run->count++;
+                continue;
+            }
+            if (out + sizeof(sync_run) > buff_sz)
+                delta_flush(dpc, buff, &out);
+            run = (sync_run *)(buff + out);
+            run->first = idx - 1;
+            run->count = 1;
+            out += sizeof(sync_run);
+            continue;
+        }
+
+        if (msg->op != SYNC_OP_DATA)
+            delta_flush(dpc, buff, &out);
+        msg->op = SYNC_OP_DATA;
+        for (piece = 0; piece < len; ) {
+            if (out == buff_sz)
+                delta_flush(dpc, buff, &out);
+            n = (len - piece < buff_sz - out) ? len - piece : buff_sz - out;
+            memcpy(buff + out, map + off + piece, n);
+            out += n;
+            piece += n;
+        }
+        sent += len;
+    }
+    delta_flush(dpc, buff, &out);
+    msg->op = SYNC_OP_DONE;
+    msg->count = 0;
+    send_chunk(dpc, PROG_SYNC_STREAM, buff, sizeof(sync_msg));
+    printf("Delta: %d of %d chunks matched the server's copy, sent %ld of %ld bytes\n",
+        matched, chunks, sent, (long)st.st_size);
+
+    free(sums);
+    free(table);
+    if (map != NULL)
+        munmap(map, st.st_size);
+    close(fd);
+}
+
+//archive bytes pack_file() will turn name into, directories and all
+static uint64_t pack_size(char *name){
+    char path[FNAME_SZ], child[FNAME_SZ];
+    struct dirent *de;
+    struct stat st;
+    uint64_t total = 0;
+    DIR *dir;
+
+    snprintf(path, sizeof(path), "./outfile/%s", name);
+    if (stat(path, &st) != 0)
+        return 0;
+    if (S_ISREG(st.st_mode))
+        return sizeof(pack_entry) + strlen(name) + st.st_size;
+    if (!S_ISDIR(st.st_mode) || ((dir = opendir(path)) == NULL))
+        return 0;
+    while ((de = readdir(dir)) != NULL) {
+        if ((strcmp(de->d_name, ".") == 0) || (strcmp(de->d_name, "..") == 0))
+            continue;
+        if (snprintf(child, sizeof(child), "%s/%s", name, de->d_name) < sizeof(child))
+            total += pack_size(child);
+    }
+    closedir(dir);
+    return total;
+}
+
+//bytes the upload will send, for the progress report, 0 if there is no telling
+static uint64_t upload_size(int delta, int pack, char **files, int nfiles){
+    char path[FNAME_SZ];
+    struct stat st;
+    uint64_t total = 0;
+    int i;
+
+    if (delta)
+        return 0;
+    if (pack) {
+        //the archive's headers and names count, and its trailer
+        for (i = 0; i < nfiles; i++)
+            total += pack_size(files[i]);
+        return total + sizeof(pack_entry);
+    }
+    if (nfiles == 0)
+        return (stat(full_file_path, &st) == 0) ? st.st_size : 0;
+    for (i = 0; i < nfiles; i++) {
+        snprintf(path, sizeof(path), "./outfile/%s", files[i]);
+        if (stat(path, &st) == 0)
+            total += st.st_size;
+        total += strlen(files[i]) + 1;
+    }
+    return total;
+}
+
+void start_client(dp_connp dpc, int chunk_sz, int mapped, int delta, int pack, char **files, int nfiles){
+    static char sBuff[500];
+    char *buff = sBuff;
+    int buff_sz = sizeof(sBuff);
+    int follow = 0;
+
+    if(!dpc->isConnected) {
+        printf("Client not connected\n");
+        return;
+    }
+
+
     if (dpc->isConnected == false){
         perror("Expecting the protocol to be in connect state, but its not");
         exit(-1);
     }
 
+    //use the biggest dgrams the transport takes when they beat ours, with
+    //path MTU discovery that is whatever the probes find along the way
+    if ((chunk_sz == 0) && dpc->pmtud) {
+        chunk_sz = DP_PMTU_MAX_PAYLOAD;
+        follow = 1;
+    } else if ((chunk_sz == 0) && (dpmaxpayload(dpc) > dpmaxdgram()))
+        chunk_sz = dpmaxpayload(dpc);
+    else if (chunk_sz > dpmaxpayload(dpc) && !dpc->pmtud)
+        chunk_sz = dpmaxpayload(dpc);
+    if (chunk_sz > sizeof(sBuff)) {
+        buff_sz = chunk_sz;
+        if ((buff = malloc(buff_sz)) == NULL) {
+            printf("ERROR:  Cannot allocate a %d byte send buffer\n", buff_sz);
+            exit(-1);
+        }
+    } else if (chunk_sz > 0)
+        buff_sz = chunk_sz;
+
     int bytes = 0;
 
-    while ((bytes = fread(sBuff, 1, sizeof(sBuff), f )) > 0)
-        dpsend(dpc, sBuff, bytes);
+    meter = meter_start(full_file_path, upload_size(delta, pack, files, nfiles), meter_ms, meter_json);
+    if (delta) {
+        send_delta(dpc, buff, buff_sz);
+    } else if (pack) {
+        send_pack(dpc, buff, buff_sz, files, nfiles);
+    } else if (nfiles > 0) {
+        send_streams(dpc, buff, buff_sz, follow, files, nfiles);
+    } else if (mapped) {
+        send_mapped(dpc, buff_sz, follow);
+    } else if (direct_io) {
+        send_direct(dpc, buff, buff_sz, follow);
+    } else {
+        FILE *f = fopen(full_file_path, "rb");
+        if(f == NULL){
+            printf("ERROR:  Cannot open file %s\n", full_file_path);
+            exit(-1);
+        }
+        while ((bytes = fread(buff, 1, read_sz(dpc, buff_sz, follow), f )) > 0)
+            send_chunk(dpc, DP_STREAM_DEFAULT, buff, bytes);
+        fclose(f);
+    }
 
-    fclose(f);
+    if (buff != sBuff)
+        free(buff);
     dpdisconnect(dpc);
+    meter_stop(meter);
+    meter = NULL;
 }
 
 void start_server(dp_connp dpc){
-    server_loop(dpc, sbuffer, rbuffer, sizeof(sbuffer), sizeof(rbuffer));
+    server_loop(dpc, full_file_path, sbuffer, rbuffer, sizeof(sbuffer), sizeof(rbuffer));
+}
+
+//server half of a -x mem run, the client half runs on the main thread
+static void *pair_server(void *arg){
+    dp_connp dpc = arg;
+    char fname[FNAME_SZ];
+
+    snprintf(fname, sizeof(fname), "./infile/%s", strrchr(full_file_path, '/') + 1);
+    if (dplisten(dpc) < 0) {
+        perror("Error establishing connection");
+        return NULL;
+    }
+    server_loop(dpc, fname, sbuffer, rbuffer, sizeof(sbuffer), sizeof(rbuffer));
+    return NULL;
+}
+
+static void setup_client(dp_connp dpc, prog_config *cfg){
+    char addr[32], *colon;
+    int i, port;
+
+    if (dpc == NULL) {
+        printf("ERROR: Cannot create the client connection\n");
+        exit(-1);
+    }
+    if (cfg->fec_grp > 1 && dpsetfec(dpc, cfg->fec_grp, cfg->fec_parity) != DP_NO_ERROR) {
+        printf("ERROR: Bad FEC settings %d:%d\n", cfg->fec_grp, cfg->fec_parity);
+        exit(-1);
+    }
+    if (cfg->delta && ((cfg->fec_grp > 1) || (cfg->more_cnt > 0))) {
+        printf("ERROR: Delta sync (-d) takes one file and cannot be used with FEC (-k)\n");
+        exit(-1);
+    }
+    if (cfg->pack && (cfg->zerocopy || cfg->delta || cfg->direct)) {
+        printf("ERROR: Packed uploads (-A) cannot be used with -z, -d or -e\n");
+        exit(-1);
+    }
+    if (cfg->direct && (cfg->zerocopy || cfg->delta || (cfg->more_cnt > 0))) {
+        printf("ERROR: Direct I/O (-e) takes one file and cannot be used with -z or -d\n");
+        exit(-1);
+    }
+    dpc->lossPct = cfg->loss_pct;
+    dpsetoffload(dpc, cfg->offload);
+    if (cfg->kern_ts && (dpsettimestamps(dpc, true) != DP_NO_ERROR))
+        printf("Warning: kernel timestamps (-t) are not available here\n");
+    if (cfg->pmtud && (dpsetpmtud(dpc, true) != DP_NO_ERROR))
+        printf("Warning: path MTU discovery (-m) is not available here\n");
+    if ((cfg->sockbuf_kb >= 0) && (dpsetsockbuf(dpc, 0, cfg->sockbuf_kb * 1024) != DP_NO_ERROR))
+        printf("Warning: socket buffer sizing (-g) is not available here\n");
+    if ((cfg->busy_us > 0) && (dpsetbusypoll(dpc, cfg->busy_us, cfg->busy_cpu) != DP_NO_ERROR))
+        printf("Warning: busy polling (-y) is not available here\n");
+    if (cfg->zerocopy && (dpsetzerocopy(dpc, DP_ZC_MIN_BYTES) != DP_NO_ERROR))
+        printf("Warning: zerocopy sends (-z) are not available here, the file is still mapped\n");
+    if (cfg->idle_s > 0)
+        dpsetkeepalive(dpc, 0, cfg->idle_s * 1000);
+    if (cfg->pace_rate != DP_PACE_OFF)
+        dpsetpacing(dpc, cfg->pace_rate, 0);
+    if ((cfg->coalesce_ms > 0) && (dpsetcoalesce(dpc, cfg->coalesce_ms) != DP_NO_ERROR)) {
+        printf("ERROR: Coalescing (-n) cannot be used with FEC (-k)\n");
+        exit(-1);
+    }
+    //paths go last, they need a plain UDP socket
+    for (i = 0; i < cfg->path_cnt; i++) {
+        strcpy(addr, cfg->paths[i]);
+        port = 0;
+        if ((colon = strchr(addr, ':')) != NULL) {
+            port = atoi(colon + 1);
+            *colon = '\0';
+        }
+        if (dpaddpath(dpc, addr, port) != DP_NO_ERROR)
+            printf("Warning: cannot add the path %s (-j)\n", cfg->paths[i]);
+    }
+}
+
+static void *server_worker(void *arg){
+    svr_worker *w = arg;
+    char fname[FNAME_SZ];
+    char *sBuff = malloc(BUFF_SZ);
+    char *rBuff = malloc(BUFF_SZ);
+    int session = 0;
+    dp_connp lst, dpc;
+
+#ifdef __linux__
+    //one worker per core, the kernel already spreads peers across them
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(w->id % sysconf(_SC_NPROCESSORS_ONLN), &cpus);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+        printf("Warning: could not pin worker %d to a core\n", w->id);
+#endif
+
+    lst = dpServerInitEx(w->cfg->port_number, 
+                DP_INIT_REUSEPORT | (w->cfg->uring ? DP_INIT_URING : 0));
+    if ((lst == NULL) || (sBuff == NULL) || (rBuff == NULL)) {
+        printf("ERROR: Worker %d could not start\n", w->id);
+        if (lst != NULL)
+            dpclose(lst);
+        free(sBuff);
+        free(rBuff);
+        return NULL;
+    }
+    dpsetoffload(lst, w->cfg->offload);
+    if (w->cfg->kern_ts)
+        dpsettimestamps(lst, true);
+    if (w->cfg->sockbuf_kb >= 0)
+        dpsetsockbuf(lst, 0, w->cfg->sockbuf_kb * 1024);
+    if (w->cfg->busy_us > 0)
+        dpsetbusypoll(lst, w->cfg->busy_us, -1);
+    if (w->cfg->cookies)
+        dpsetcookies(lst, true);
+    if (w->cfg->idle_s > 0)
+        dpsetkeepalive(lst, 0, w->cfg->idle_s * 1000);
+
+    while(1) {
+        dpc = dpaccept(lst);
+        if (dpc == NULL)
+            continue;
+        snprintf(fname, sizeof(fname), "./infile/%s.%d-%d", 
+            w->cfg->file_name, w->id, session++);
+        if (server_loop(dpc, fname, sBuff, rBuff, BUFF_SZ, BUFF_SZ) != DP_CONNECTION_CLOSED)
+            dpclose(dpc);
+    }
+    return NULL;
+}
+
+void start_workers(prog_config *cfg){
+    svr_worker *w = calloc(cfg->workers, sizeof(svr_worker));
+    int i;
+
+    if (w == NULL) {
+        perror("Cannot allocate server workers");
+        exit(-1);
+    }
+    for (i = 0; i < cfg->workers; i++) {
+        w[i].id = i;
+        w[i].cfg = cfg;
+        if (pthread_create(&w[i].tid, NULL, server_worker, &w[i]) != 0) {
+            perror("Cannot start server worker");
+            exit(-1);
+        }
+    }
+    for (i = 0; i < cfg->workers; i++)
+        pthread_join(w[i].tid, NULL);
+    free(w);
 }
 
 
@@ -143,37 +1336,114 @@ int main(int argc, char *argv[])
 {
     prog_config cfg;
     int cmd;
-    dp_connp dpc;
+    dp_connp dpc, svr;
+    pthread_t svrTid;
+    char path[FNAME_SZ];
+    int flags;
     int rc;
+    char **files = NULL;
+    int nfiles = 0;
 
 
     //Process the parameters and init the header - look at the helpers
     //in the cs472-pproto.c file
     cmd = initParams(argc, argv, &cfg);
+    direct_io = cfg.direct;
+    meter_ms = cfg.progress_ms;
+    meter_json = cfg.progress_json;
 
     printf("MODE %d\n", cfg.prog_mode);
     printf("PORT %d\n", cfg.port_number);
     printf("FILE NAME: %s\n", cfg.file_name);
 
+    //more files after the options, send them all (fname first) on streams,
+    //or in one archive
+    if ((cfg.more_cnt > 0) || cfg.pack) {
+        nfiles = cfg.more_cnt + 1;
+        if ((files = malloc(nfiles * sizeof(char *))) == NULL)
+            exit(-1);
+        files[0] = cfg.file_name;
+        memcpy(&files[1], cfg.more_files, cfg.more_cnt * sizeof(char *));
+    }
+
+    flags = cfg.uring ? DP_INIT_URING : 0;
+    snprintf(path, sizeof(path), 
+        (cfg.xport == PROG_XP_SHM) ? PROG_SHM_PATH : PROG_UNIX_PATH, cfg.port_number);
+
+    //both ends live here, send ./outfile/fname to ./infile/fname
+    if (cfg.xport == PROG_XP_MEM) {
+        snprintf(full_file_path, sizeof(full_file_path), "./outfile/%s", cfg.file_name);
+        if (dpPairInit(&svr, &dpc) != DP_NO_ERROR)
+            exit(-1);
+        setup_client(dpc, &cfg);
+        if (pthread_create(&svrTid, NULL, pair_server, svr) != 0) {
+            perror("Cannot start the server thread");
+            exit(-1);
+        }
+        if (dpconnect(dpc) < 0) {
+            perror("Error establishing connection");
+            exit(-1);
+        }
+        start_client(dpc, cfg.chunk_sz, cfg.zerocopy, cfg.delta, cfg.pack, files, nfiles);
+        pthread_join(svrTid, NULL);
+        exit(0);
+    }
+
     switch(cmd){
         case PROG_MD_CLI:
             //by default client will look for files in the ./outfile directory
             snprintf(full_file_path, sizeof(full_file_path), "./outfile/%s", cfg.file_name);
-            dpc = dpClientInit(cfg.svr_ip_addr,cfg.port_number);
+            if (cfg.xport == PROG_XP_UNIX)
+                dpc = dpClientInitUnix(path, flags);
+            else if (cfg.xport == PROG_XP_SHM)
+                dpc = dpClientInitShm(path);
+            else
+                dpc = dpClientInitEx(cfg.svr_ip_addr,cfg.port_number, flags);
+            setup_client(dpc, &cfg);
             rc = dpconnect(dpc);
             if (rc < 0) {
                 perror("Error establishing connection");
                 exit(-1);
             }
 
-            start_client(dpc);
+            start_client(dpc, cfg.chunk_sz, cfg.zerocopy, cfg.delta, cfg.pack, files, nfiles);
             exit(0);
             break;
 
         case PROG_MD_SVR:
+            if ((cfg.workers > 0) && (cfg.xport != PROG_XP_UDP)) {
+                printf("ERROR: Sharded servers (-w) need the udp transport\n");
+                exit(-1);
+            }
+            if (cfg.workers > 0) {
+                start_workers(&cfg);
+                break;
+            }
             //by default server will look for files in the ./infile directory
             snprintf(full_file_path, sizeof(full_file_path), "./infile/%s", cfg.file_name);
-            dpc = dpServerInit(cfg.port_number);
+            if (cfg.xport == PROG_XP_UNIX)
+                dpc = dpServerInitUnix(path, flags);
+            else if (cfg.xport == PROG_XP_SHM)
+                dpc = dpServerInitShm(path);
+            else
+                dpc = dpServerInitEx(cfg.port_number, flags);
+            if (dpc == NULL) {
+                printf("ERROR: Cannot create the server connection\n");
+                exit(-1);
+            }
+            dpsetoffload(dpc, cfg.offload);
+            if (cfg.kern_ts && (dpsettimestamps(dpc, true) != DP_NO_ERROR))
+                printf("Warning: kernel timestamps (-t) are not available here\n");
+            if ((cfg.sockbuf_kb >= 0) && 
+                (dpsetsockbuf(dpc, 0, cfg.sockbuf_kb * 1024) != DP_NO_ERROR))
+                printf("Warning: socket buffer sizing (-g) is not available here\n");
+            if ((cfg.busy_us > 0) && 
+                (dpsetbusypoll(dpc, cfg.busy_us, cfg.busy_cpu) != DP_NO_ERROR))
+                printf("Warning: busy polling (-y) is not available here\n");
+            if (cfg.cookies)
+                dpsetcookies(dpc, true);
+            if (cfg.idle_s > 0)
+                dpsetkeepalive(dpc, 0, cfg.idle_s * 1000);
             rc = dplisten(dpc);
             if (rc < 0) {
                 perror("Error establishing connection");
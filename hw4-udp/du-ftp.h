@@ -1,15 +1,164 @@
 #pragma once
 
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+
 #define PROG_MD_CLI     0
 #define PROG_MD_SVR     1
 #define DEF_PORT_NO     2080
 #define FNAME_SZ        150
 #define PROG_DEF_FNAME  "test.c"
 #define PROG_DEF_SVR_ADDR   "127.0.0.1"
+#define PROG_UNIX_PATH  "/tmp/du-ftp.%d.sock"   //by port number
+#define PROG_SHM_PATH   "/dev/shm/du-ftp.%d"    //by port number
+#define PROG_MAX_PATHS  3               //-j, on top of the client's own socket
+
+//transports (-x)
+#define PROG_XP_UDP     0
+#define PROG_XP_UNIX    1
+#define PROG_XP_MEM     2           //client and server in one process
+#define PROG_XP_SHM     3
 
 typedef struct prog_config{
     int     prog_mode;
     int     port_number;
     char    svr_ip_addr[16];
     char    file_name[128];
+    int     fec_grp;            //FEC data dgrams per group, 0 = off
+    int     fec_parity;         //FEC parity dgrams per group
+    int     loss_pct;           //simulated outbound loss for testing
+    int     offload;            //UDP GSO/GRO (Linux)
+    int     uring;              //io_uring socket I/O (Linux)
+    int     kern_ts;            //kernel send/receive timestamps (Linux)
+    int     pmtud;              //path MTU discovery, client only
+    int     sockbuf_kb;         //BDP socket buffer sizing cap, 0 = default, -1 = off
+    int     busy_us;            //busy poll spin before sleeping, 0 = off
+    int     busy_cpu;           //core to pin the busy polling thread to, -1 = any
+    int     zerocopy;           //mmap the file and send with MSG_ZEROCOPY, client only
+    int     cookies;            //CONNECT cookies, server only
+    int     idle_s;             //drop a peer quiet this long, keepalives in between, 0 = off
+    char    paths[PROG_MAX_PATHS][32];  //extra local addr[:port]s, client only
+    int     path_cnt;
+    int     delta;              //send only the chunks the server's copy lacks, client only
+    int     direct;             //O_DIRECT file I/O through du-dio
+    int     progress_ms;        //progress report interval, 0 = off
+    int     progress_json;      //report as JSON lines
+    int     pack;               //pack the files into one archive stream, client only
+    int     xport;              //PROG_XP_*
+    int     workers;            //server threads sharing the port, 0 = one shot
+    long    pace_rate;          //bytes/sec, 0 = off, DP_PACE_AUTO
+    int     chunk_sz;           //client dpsend() size, 0 = as big as allowed
+    int     coalesce_ms;        //small send coalescing, 0 = off
+    char    **more_files;       //named after the options, sent on streams
+    int     more_cnt;
 } prog_config;
+
+/*
+ * Multi file uploads.  Each file goes on its own du-proto stream (ids from
+ * 1 up), the first message on a stream is the file name with its NUL and
+ * the stream is closed after the last chunk.  The client sends a chunk of
+ * every file in turn so they all arrive together.  The default stream is
+ * still the single file upload.
+ */
+#define PROG_MAX_STREAMS    64
+
+typedef struct svr_stream{
+    uint32_t    id;
+    FILE        *f;             //NULL for a free slot
+    long        bytes;
+} svr_stream;
+
+/*
+ * Delta sync (-d).  Everything goes on PROG_SYNC_STREAM as messages that
+ * start with a sync_msg.  The client asks with HELLO, saying how big a
+ * message it takes, and the server answers with the digests of its copy's
+ * chunks (SUMS, then an empty SUMS_END).  The client chunks its own file
+ * the same way and sends, in file order, runs of the server's chunks to
+ * COPY and the bytes of the chunks it has no match for as DATA.  The
+ * server builds the new file next to the old one and swaps it in on DONE.
+ */
+#define PROG_SYNC_STREAM    0x10000
+#define SYNC_OP_HELLO       1           //count = biggest message the client takes
+#define SYNC_OP_SUMS        2           //count cdc_sums follow
+#define SYNC_OP_SUMS_END    3
+#define SYNC_OP_COPY        4           //count sync_runs follow
+#define SYNC_OP_DATA        5           //count bytes follow
+#define SYNC_OP_DONE        6
+
+typedef struct sync_msg{
+    uint32_t    op;
+    uint32_t    count;
+} sync_msg;
+
+typedef struct sync_run{
+    uint32_t    first;                  //server chunk index
+    uint32_t    count;
+} sync_run;
+
+//the server side of a sync, chunks index into its mapped old copy
+typedef struct svr_sync{
+    _Bool       active;
+    char        *old;                   //mapping of the old copy, NULL if none
+    long        oldSz;
+    long        *chunkOff;
+    int         *chunkLen;
+    int         chunks;
+    FILE        *out;
+    char        tmp[FNAME_SZ + 8];
+    long        copied;
+    long        literal;
+} svr_sync;
+
+/*
+ * Packed uploads (-A).  Small files cost a name message, a chunk and a FIN
+ * each as streams, packed they share full dgrams instead.  The client
+ * writes an archive on the fly to PROG_PACK_STREAM: per file a pack_entry,
+ * the name (no NUL) and the data, then a trailer entry with no name whose
+ * size is the file count.  The messages are cut wherever the dgram fills
+ * up, the server unpacks the bytes as they come.  Each entry's offset is
+ * where its data starts in the archive, the server checks it against what
+ * it has seen to catch a stream that lost its place.
+ */
+#define PROG_PACK_STREAM    0x10001
+#define PACK_MAGIC          0x6475706b  //"dupk"
+
+typedef struct pack_entry{
+    uint32_t    magic;
+    uint32_t    name_len;               //0 on the trailer
+    uint64_t    size;                   //data bytes, the trailer's is the file count
+    uint64_t    offset;                 //archive offset of the data
+} pack_entry;
+
+//the client's archive being written, buff goes out each time it fills
+typedef struct cli_pack{
+    char        *buff;
+    int         buff_sz;
+    int         len;
+    uint64_t    pos;                    //archive bytes so far
+    long        files;
+} cli_pack;
+
+//the server's unpacking, name is in hand once have covers it
+typedef struct svr_pack{
+    pack_entry  hdr;
+    int         have;                   //bytes of hdr and then the name so far
+    char        name[FNAME_SZ];
+    _Bool       inData;
+    _Bool       broken;                 //lost its place, the rest is dropped
+    _Bool       done;                   //trailer seen
+    FILE        *f;                     //NULL when the entry cannot be written
+    uint64_t    left;                   //data bytes of the entry still to come
+    uint64_t    pos;                    //archive bytes seen
+    long        entries;                //files in the archive so far
+    long        files;                  //of those, the ones written out
+    uint64_t    bytes;
+} svr_pack;
+
+//one per server thread when running sharded (-w), each has its own
+//socket on the shared port and serves the peers the kernel hashes to it
+typedef struct svr_worker{
+    int             id;
+    pthread_t       tid;
+    prog_config     *cfg;
+} svr_worker;
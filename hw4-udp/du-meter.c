@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <errno.h>
+
+#include "du-meter.h"
+
+static void *meter_thread(void *arg);
+
+static uint64_t meter_nowns(){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//bytes in the biggest unit that keeps it over 1, into a static buffer
+static const char *meter_size(double bytes, int slot){
+    static __thread char buff[3][16];
+    static const char *units[] = {"B", "KB", "MB", "GB", "TB"};
+    int u = 0;
+
+    while ((bytes >= 1024) && (u < 4)) {
+        bytes /= 1024;
+        u++;
+    }
+    snprintf(buff[slot], sizeof(buff[slot]), "%.1f %s", bytes, units[u]);
+    return buff[slot];
+}
+
+/*
+ *  Starts reporting on a transfer of total bytes (0 if not known) every
+ *  intervalMs.  Returns NULL if the reporter cannot start, the transfer
+ *  just goes on without it.
+ */
+prog_meter *meter_start(const char *label, uint64_t total, int intervalMs, int json){
+    prog_meter *m;
+    int i, j;
+
+    if ((intervalMs <= 0) || ((m = calloc(1, sizeof(prog_meter))) == NULL))
+        return NULL;
+    //the label goes into JSON as is, keep it to characters that need no escape
+    for (i = j = 0; label[i] && (j < sizeof(m->label) - 1); i++)
+        if ((label[i] >= ' ') && (label[i] != '"') && (label[i] != '\\'))
+            m->label[j++] = label[i];
+    m->total = total;
+    m->intervalMs = intervalMs;
+    m->json = json;
+    m->startNs = m->lastNs = meter_nowns();
+    pthread_mutex_init(&m->lock, NULL);
+    pthread_cond_init(&m->cond, NULL);
+    if (pthread_create(&m->tid, NULL, meter_thread, m) != 0) {
+        free(m);
+        return NULL;
+    }
+    return m;
+}
+
+static void meter_report(prog_meter *m, _Bool done){
+    uint64_t now = meter_nowns();
+    uint64_t bytes = __atomic_load_n(&m->bytes, __ATOMIC_RELAXED);
+    uint64_t dgrams = __atomic_load_n(&m->dgrams, __ATOMIC_RELAXED);
+    uint64_t retx = __atomic_load_n(&m->retransmits, __ATOMIC_RELAXED);
+    double secs = (now - m->startNs) / 1e9;
+    double gap = (now - m->lastNs) / 1e9;
+    double rate = (gap > 0) ? (bytes - m->lastBytes) / gap : 0;
+    double avg = (secs > 0) ? bytes / secs : 0;
+    double retxPct = dgrams ? 100.0 * retx / dgrams : 0;
+    double eta = -1;
+
+    //the time left goes by the average, the last interval alone is too jumpy
+    if ((m->total > 0) && (avg > 0))
+        eta = (m->total > bytes) ? (m->total - bytes) / avg : 0;
+    m->lastNs = now;
+    m->lastBytes = bytes;
+
+    if (m->json) {
+        fprintf(stderr, "{\"file\":\"%s\",\"elapsed_s\":%.3f,\"bytes\":%llu,\"total\":%llu,"
+            "\"rate_Bps\":%.0f,\"avg_Bps\":%.0f,\"dgrams\":%llu,\"retransmits\":%llu,"
+            "\"retransmit_pct\":%.3f,", m->label, secs, (unsigned long long)bytes,
+            (unsigned long long)m->total, rate, avg, (unsigned long long)dgrams,
+            (unsigned long long)retx, retxPct);
+        if (eta >= 0)
+            fprintf(stderr, "\"eta_s\":%.1f,\"done\":%s}\n", eta, done ? "true" : "false");
+        else
+            fprintf(stderr, "\"eta_s\":null,\"done\":%s}\n", done ? "true" : "false");
+        return;
+    }
+    fprintf(stderr, "[%s] %s", m->label, meter_size(bytes, 0));
+    if (m->total > 0)
+        fprintf(stderr, " of %s (%d%%)", meter_size(m->total, 1), (int)(100.0 * bytes / m->total));
+    fprintf(stderr, ", %s/s now, %s/s avg, %.2f%% retransmits",
+        meter_size(done ? avg : rate, 1), meter_size(avg, 2), retxPct);
+    if (done)
+        fprintf(stderr, ", done in %.1fs\n", secs);
+    else if (eta >= 0)
+        fprintf(stderr, ", ETA %.0fs\n", eta);
+    else
+        fprintf(stderr, "\n");
+}
+
+static void *meter_thread(void *arg){
+    prog_meter *m = arg;
+    struct timespec due;
+    int rc = 0;
+
+    pthread_mutex_lock(&m->lock);
+    clock_gettime(CLOCK_REALTIME, &due);
+    while (!m->stop) {
+        due.tv_nsec += (long)m->intervalMs * 1000000;
+        due.tv_sec += due.tv_nsec / 1000000000;
+        due.tv_nsec %= 1000000000;
+        do {
+            rc = pthread_cond_timedwait(&m->cond, &m->lock, &due);
+        } while (!m->stop && (rc != ETIMEDOUT));
+        if (!m->stop)
+            meter_report(m, false);
+    }
+    pthread_mutex_unlock(&m->lock);
+    return NULL;
+}
+
+//stops the reporter, after one last report of the whole transfer
+void meter_stop(prog_meter *m){
+    if (m == NULL)
+        return;
+    pthread_mutex_lock(&m->lock);
+    m->stop = true;
+    pthread_cond_signal(&m->cond);
+    pthread_mutex_unlock(&m->lock);
+    pthread_join(m->tid, NULL);
+
+    meter_report(m, true);
+    pthread_mutex_destroy(&m->lock);
+    pthread_cond_destroy(&m->cond);
+    free(m);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdint.h>
+
+/*
+ * Live transfer progress for du-ftp (-q).  The transfer thread only adds
+ * to a few counters with relaxed atomics (meter_add()) and never waits on
+ * the meter.  A reporter thread of its own samples them every intervalMs
+ * and prints the bytes done, the rate over the last interval and since
+ * the start, the share of dgrams sent again and, when the size is known,
+ * the time left.  With json each report is one JSON object per line for
+ * monitoring to pick up.  Reports go to stderr, stdout has the PDU dumps.
+ */
+typedef struct prog_meter{
+    uint64_t        bytes;              //atomic, payload bytes moved
+    uint64_t        dgrams;             //atomic, the connection's dgrams out
+    uint64_t        retransmits;        //atomic, of those, sent again
+    uint64_t        total;              //bytes expected, 0 = not known
+    char            label[64];
+    int             intervalMs;
+    _Bool           json;
+    _Bool           stop;               //under lock
+    uint64_t        startNs;
+    uint64_t        lastNs;             //the reporter's previous sample
+    uint64_t        lastBytes;
+    pthread_t       tid;
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+} prog_meter;
+
+prog_meter *meter_start(const char *label, uint64_t total, int intervalMs, int json);
+void meter_stop(prog_meter *m);
+
+//dgrams and retransmits are the connection's running totals, not deltas
+static inline void meter_add(prog_meter *m, uint64_t bytes, uint64_t dgrams, uint64_t retransmits){
+    if (m == NULL)
+        return;
+    __atomic_fetch_add(&m->bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_store_n(&m->dgrams, dgrams, __ATOMIC_RELAXED);
+    __atomic_store_n(&m->retransmits, retransmits, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,150 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "du-proto.h"
+#include "du-pool.h"
+
+#define DP_LINE_ROUND(sz)   (((sz) + DP_CACHE_LINE - 1) & ~(size_t)(DP_CACHE_LINE - 1))
+
+typedef struct dp_pool {
+    size_t              objSz;          //rounded up to whole cache lines
+    int                 slabCnt;        //objects carved from each slab
+    pthread_mutex_t     lock;           //guards the shared free list
+    void                *free;
+} dp_pool;
+
+typedef struct dp_pool_cache {
+    void                *free;
+    int                 freeCnt;
+} dp_pool_cache;
+
+static dp_pool _pools[DP_POOL_CNT] = {
+    [DP_POOL_CONN]    = { DP_LINE_ROUND(sizeof(dp_connection)), 64,  PTHREAD_MUTEX_INITIALIZER, NULL },
+    [DP_POOL_FEC_GRP] = { DP_LINE_ROUND(sizeof(dp_fec_grp)),    32,  PTHREAD_MUTEX_INITIALIZER, NULL },
+    [DP_POOL_DGRAM]   = { DP_LINE_ROUND(DP_MAX_DGRAM_SZ),       256, PTHREAD_MUTEX_INITIALIZER, NULL },
+    [DP_POOL_GRO]     = { DP_LINE_ROUND(DP_GRO_BUFF_SZ),        4,   PTHREAD_MUTEX_INITIALIZER, NULL },
+};
+
+//per thread free lists, handed back to the shared lists when a thread exits
+static __thread dp_pool_cache _cache[DP_POOL_CNT];
+static __thread int _cacheInit = 0;
+static pthread_key_t  _cacheKey;
+static pthread_once_t _cacheOnce = PTHREAD_ONCE_INIT;
+
+//free list links live in the first bytes of each free object
+#define DP_NEXT(obj)        (*(void **)(obj))
+
+static void dppool_thread_exit(void *arg){
+    dp_pool_cache *cache = arg;
+    int i;
+
+    for (i = 0; i < DP_POOL_CNT; i++) {
+        void *last = cache[i].free;
+        if (last == NULL)
+            continue;
+        while (DP_NEXT(last) != NULL)
+            last = DP_NEXT(last);
+
+        pthread_mutex_lock(&_pools[i].lock);
+        DP_NEXT(last) = _pools[i].free;
+        _pools[i].free = cache[i].free;
+        pthread_mutex_unlock(&_pools[i].lock);
+        cache[i].free = NULL;
+        cache[i].freeCnt = 0;
+    }
+}
+
+static void dppool_key_init(){
+    pthread_key_create(&_cacheKey, dppool_thread_exit);
+}
+
+static void dppool_cache_init(){
+    pthread_once(&_cacheOnce, dppool_key_init);
+    pthread_setspecific(_cacheKey, _cache);
+    _cacheInit = 1;
+}
+
+/*
+ *  Moves up to DP_POOL_BATCH objects from the shared list to this thread,
+ *  carving a new slab first if the shared list is empty.
+ */
+static int dppool_refill(dp_pool *p, dp_pool_cache *c){
+    char *slab;
+    void *obj;
+    int i;
+
+    pthread_mutex_lock(&p->lock);
+    if (p->free == NULL) {
+        if (posix_memalign((void **)&slab, DP_CACHE_LINE, p->objSz * p->slabCnt) != 0) {
+            pthread_mutex_unlock(&p->lock);
+            return -1;
+        }
+        for (i = p->slabCnt - 1; i >= 0; i--) {
+            DP_NEXT(slab + i * p->objSz) = p->free;
+            p->free = slab + i * p->objSz;
+        }
+    }
+    for (i = 0; (i < DP_POOL_BATCH) && (p->free != NULL); i++) {
+        obj = p->free;
+        p->free = DP_NEXT(obj);
+        DP_NEXT(obj) = c->free;
+        c->free = obj;
+        c->freeCnt++;
+    }
+    pthread_mutex_unlock(&p->lock);
+    return 0;
+}
+
+/*
+ *  Returns an uninitialized, cache line aligned object from the pool, or
+ *  NULL if memory ran out.
+ */
+void *dppool_alloc(int pool){
+    dp_pool_cache *c = &_cache[pool];
+    void *obj;
+
+    if (!_cacheInit)
+        dppool_cache_init();
+    if ((c->free == NULL) && (dppool_refill(&_pools[pool], c) < 0))
+        return NULL;
+
+    obj = c->free;
+    c->free = DP_NEXT(obj);
+    c->freeCnt--;
+    return obj;
+}
+
+/*
+ *  Returns an object to this thread's free list.  A thread that frees far
+ *  more than it allocates (say, a worker closing sessions another thread
+ *  opened) hands a batch back to the shared list.
+ */
+void dppool_free(int pool, void *obj){
+    dp_pool_cache *c = &_cache[pool];
+    dp_pool *p = &_pools[pool];
+    void *batch, *last;
+    int i;
+
+    if (obj == NULL)
+        return;
+    if (!_cacheInit)
+        dppool_cache_init();
+
+    DP_NEXT(obj) = c->free;
+    c->free = obj;
+    c->freeCnt++;
+    if (c->freeCnt <= 2 * DP_POOL_BATCH)
+        return;
+
+    batch = last = c->free;
+    for (i = 1; i < DP_POOL_BATCH; i++)
+        last = DP_NEXT(last);
+    c->free = DP_NEXT(last);
+    c->freeCnt -= DP_POOL_BATCH;
+
+    pthread_mutex_lock(&p->lock);
+    DP_NEXT(last) = p->free;
+    p->free = batch;
+    pthread_mutex_unlock(&p->lock);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stddef.h>
+
+/*
+ * Pooled allocation for du-proto.  Every pool hands out fixed size objects
+ * rounded up to a whole number of cache lines and carved out of cache line
+ * aligned slabs.  Each thread keeps its own free list per pool, so the
+ * alloc/free pair on the hot path never takes a lock; threads only go to
+ * the shared list (under a mutex) to move DP_POOL_BATCH objects at a time.
+ * Slabs are never handed back to the OS.
+ */
+#define DP_CACHE_LINE       64
+#define DP_POOL_BATCH       32
+
+//The pools, sizes are filled in by du-pool.c
+#define DP_POOL_CONN        0           //dp_connection
+#define DP_POOL_FEC_GRP     1           //dp_fec_grp
+#define DP_POOL_DGRAM       2           //one DP_MAX_DGRAM_SZ dgram
+#define DP_POOL_GRO         3           //one DP_GRO_BUFF_SZ receive
+#define DP_POOL_CNT         4
+
+void *dppool_alloc(int pool);
+void  dppool_free(int pool, void *obj);
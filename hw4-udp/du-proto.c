@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h> 
 #include <stdlib.h>
 #include <string.h>
@@ -5,15 +6,41 @@
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <poll.h>
+#include <errno.h>
 #include <time.h>
+#include <stddef.h>
+#include <sched.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+#endif
 
 #include "du-proto.h"
+#include "du-pool.h"
+#include "du-uring.h"
 
-static char _dpBuffer[DP_MAX_DGRAM_SZ];
+//one scratch dgram per thread so sharded server workers dont collide
+static __thread char _dpBuffer[DP_MAX_DGRAM_SZ];
+static __thread const dp_clock *_dpClock;
+static __thread dp_wheel _dpWheel;          //keepalive and idle timers, see dpsetkeepalive()
 static int  _debugMode = 1;
 
+//UDP and Unix datagram sockets, du-xport.c has the others
+static const dp_xport _dpSockXport = {
+    "socket", dpsocksend, dpsockrecv, dpsockpoll, dpsockclose
+};
+
+//link MTUs path MTU discovery tries, in order, see dpprobe()
+static const int _dpPmtuSteps[DP_PMTU_STEPS] = { 1280, 1500, DP_PMTU_MAX };
+
 static dp_connp dpinit(){
-    dp_connp dpsession = malloc(sizeof(dp_connection));
+    dp_connp dpsession = dppool_alloc(DP_POOL_CONN);
+    if (dpsession == NULL)
+        return NULL;
     bzero(dpsession, sizeof(dp_connection));
     dpsession->outSockAddr.isAddrInit = false;
     dpsession->inSockAddr.isAddrInit = false;
@@ -22,19 +49,96 @@ static dp_connp dpinit(){
     dpsession->seqNum = 0;
     dpsession->isConnected = false;
     dpsession->dbgMode = true;
+    dpsession->fecWaitMs = DP_FEC_WAIT_MS;
+    dpsession->udp_sock = -1;
+    dpsession->xport = &_dpSockXport;
+    dpsession->maxPayload = DP_MAX_BUFF_SZ;
+    dpsession->busyCpu = -1;
     return dpsession;
 }
 
 void dpclose(dp_connp dpsession) {
-    free(dpsession);
+    int i;
+
+    if (_debugMode == 1)
+        print_dp_stats(dpsession);
+    dptimer_cancel(&dpsession->keepTimer);
+    dptimer_cancel(&dpsession->idleTimer);
+    //whatever the kernel still holds, it is our PDUs now and not the app's
+    if (dpsession->zcPending > 0)
+        dpzcwait(dpsession);
+    for (i = 0; i < DP_ZC_RING; i++)
+        dppool_free(DP_POOL_DGRAM, dpsession->zcRing[i].hdr);
+    dpfecfree(dpsession->fecTx);
+    dpfecfree(dpsession->fecRx);
+    dppool_free(DP_POOL_GRO, dpsession->groBuff);
+    free(dpsession->backlog);
+    free(dpsession->bigBuff);
+    free(dpsession->coTx);
+    free(dpsession->coRx);
+    free(dpsession->early);
+    //sessions from dpaccept() share the listener's transport, and with it
+    //the kernel's send counter and socket buffers
+    if (dpsession->listener == NULL)
+        dpsession->xport->close(dpsession);
+    else {
+        dpsession->listener->txId = dpsession->txId;
+        dpsession->listener->zcNext = dpsession->zcNext;
+        dpsession->listener->sndBuf = dpsession->sndBuf;
+        dpsession->listener->rcvBuf = dpsession->rcvBuf;
+    }
+    dppool_free(DP_POOL_CONN, dpsession);
 }
 
 int  dpmaxdgram(){
     return DP_MAX_BUFF_SZ;
 }
 
+/*
+ *  The most one dpsend() can carry on this connection.  That is
+ *  dpmaxdgram() unless the transport allows bigger dgrams (see
+ *  dpsetpayload()), FEC groups always use dpmaxdgram() sized dgrams.
+ */
+int  dpmaxpayload(dp_connp dp){
+    return (dp->fecK > 1) ? DP_MAX_BUFF_SZ : dp->maxPayload;
+}
+
+/*
+ *  Lets dpsend() use dgrams of up to sz payload bytes on a transport that
+ *  can carry them.  Both sides have to agree, du-proto does not negotiate
+ *  it.  Dgrams bigger than dpmaxdgram() are built in a per connection
+ *  buffer instead of the shared scratch one.
+ */
+int dpsetpayload(dp_connp dp, int sz){
+    if (sz <= 0)
+        return DP_ERROR_GENERAL;
+
+    //the coalescing buffers are sized for the old limit
+    if ((dp->coLen > 0) || (dp->coRxOff < dp->coRxLen))
+        return DP_ERROR_GENERAL;
+    free(dp->coTx);
+    free(dp->coRx);
+    dp->coTx = dp->coRx = NULL;
+
+    if ((sz > DP_MAX_BUFF_SZ) && (sz > dp->maxPayload)) {
+        free(dp->bigBuff);
+        dp->bigBuff = malloc(sz + sizeof(dp_pdu));
+        if (dp->bigBuff == NULL) {
+            perror("dpsetpayload: cannot allocate dgram buffer");
+            dp->maxPayload = DP_MAX_BUFF_SZ;
+            return DP_ERROR_GENERAL;
+        }
+    }
+    dp->maxPayload = sz;
+    return DP_NO_ERROR;
+}
+
 
 dp_connp dpServerInit(int port) {
+    return dpServerInitEx(port, 0);
+}
+
+dp_connp dpServerInitEx(int port, int flags) {
     struct sockaddr_in *servaddr;
     int *sock;
     int rc;
@@ -46,7 +150,7 @@ dp_connp dpServerInit(int port) {
     }
 
     sock = &(dpc->udp_sock);
-    servaddr = &(dpc->inSockAddr.addr);
+    servaddr = &(dpc->inSockAddr.addr.in);
         
 
     // Creating socket file descriptor 
@@ -61,11 +165,13 @@ dp_connp dpServerInit(int port) {
     servaddr->sin_port = htons(port); 
 
     // Set socket options so that we dont have to wait for ports held by OS
-    // if (setsockopt(*sock, SOL_SOCKET, SO_REUSEPORT, &(int){1}, sizeof(int)) < 0){
-    //     perror("setsockopt(SO_REUSEADDR) failed");
-    //     close(*sock);
-    //     return NULL;
-    // }
+    // SO_REUSEPORT lets sharded workers each bind their own socket to port
+    if ((flags & DP_INIT_REUSEPORT) &&
+        (setsockopt(*sock, SOL_SOCKET, SO_REUSEPORT, &(int){1}, sizeof(int)) < 0)){
+        perror("setsockopt(SO_REUSEPORT) failed");
+        close(*sock);
+        return NULL;
+    }
     if (setsockopt(*sock, SOL_SOCKET, SO_REUSEADDR, &(int){1}, sizeof(int)) < 0){
         perror("setsockopt(SO_REUSEADDR) failed");
         close(*sock);
@@ -81,11 +187,18 @@ dp_connp dpServerInit(int port) {
 
     dpc->inSockAddr.isAddrInit = true;
     dpc->outSockAddr.len = sizeof(struct sockaddr_in);
+
+    if (flags & DP_INIT_URING)
+        dpseturing(dpc);
     return dpc;
 }
 
 
 dp_connp dpClientInit(char *addr, int port) {
+    return dpClientInitEx(addr, port, 0);
+}
+
+dp_connp dpClientInitEx(char *addr, int port, int flags) {
     struct sockaddr_in *servaddr;
     int *sock;
 
@@ -96,7 +209,7 @@ dp_connp dpClientInit(char *addr, int port) {
     }
 
     sock = &(dpc->udp_sock);
-    servaddr = &(dpc->outSockAddr.addr);
+    servaddr = &(dpc->outSockAddr.addr.in);
 
     // Creating socket file descriptor 
     if ( (*sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0 ) { 
@@ -114,21 +227,211 @@ dp_connp dpClientInit(char *addr, int port) {
     // The inbound address is the same as the outbound address
     memcpy(&dpc->inSockAddr, &dpc->outSockAddr, sizeof(dpc->outSockAddr));
 
+    if (flags & DP_INIT_URING)
+        dpseturing(dpc);
+    return dpc;
+}
+
+dp_connp dpServerInitUnix(char *path, int flags) {
+    struct sockaddr_un *servaddr;
+    int *sock;
+
+    dp_connp dpc = dpinit();
+    if (dpc == NULL) {
+        perror("drexel protocol create failure"); 
+        return NULL;
+    }
+
+    sock = &(dpc->udp_sock);
+    servaddr = &(dpc->inSockAddr.addr.un);
+
+    if ( (*sock = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0 ) { 
+        perror("socket creation failed"); 
+        return NULL;
+    } 
+
+    servaddr->sun_family = AF_UNIX;
+    strncpy(servaddr->sun_path, path, sizeof(servaddr->sun_path) - 1);
+    dpc->inSockAddr.len = sizeof(struct sockaddr_un);
+
+    //a socket file left behind by an earlier server would fail the bind
+    unlink(servaddr->sun_path);
+    if (bind(*sock, &(dpc->inSockAddr.addr.sa), dpc->inSockAddr.len) < 0) { 
+        perror("bind failed"); 
+        close (*sock);
+        return NULL;
+    } 
+
+    dpc->inSockAddr.isAddrInit = true;
+    dpc->outSockAddr.len = sizeof(struct sockaddr_un);
+
+    if (flags & DP_INIT_URING)
+        dpseturing(dpc);
+    return dpc;
+}
+
+dp_connp dpClientInitUnix(char *path, int flags) {
+    struct sockaddr_un *servaddr;
+    struct sockaddr_un me = {0};
+    socklen_t meLen = sizeof(me.sun_family);
+    int *sock;
+
+    dp_connp dpc = dpinit();
+    if (dpc == NULL) {
+        perror("drexel protocol create failure"); 
+        return NULL;
+    }
+
+    sock = &(dpc->udp_sock);
+    servaddr = &(dpc->outSockAddr.addr.un);
+
+    if ( (*sock = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0 ) { 
+        perror("socket creation failed"); 
+        return NULL;
+    } 
+
+    servaddr->sun_family = AF_UNIX;
+    strncpy(servaddr->sun_path, path, sizeof(servaddr->sun_path) - 1);
+    dpc->outSockAddr.len = sizeof(struct sockaddr_un); 
+    dpc->outSockAddr.isAddrInit = true;
+
+    //unlike UDP an unbound Unix socket cant get replies, Linux picks an
+    //abstract name for us, elsewhere we make one up next to the server's
+    me.sun_family = AF_UNIX;
+#ifndef __linux__
+    snprintf(me.sun_path, sizeof(me.sun_path), "%s.%d", path, (int)getpid());
+    unlink(me.sun_path);
+    meLen = sizeof(me);
+#endif
+    if (bind(*sock, (struct sockaddr *)&me, meLen) < 0) {
+        perror("bind failed");
+        close (*sock);
+        return NULL;
+    }
+
+    memcpy(&dpc->inSockAddr, &dpc->outSockAddr, sizeof(dpc->outSockAddr));
+
+    if (flags & DP_INIT_URING)
+        dpseturing(dpc);
+    return dpc;
+}
+
+/*
+ *  A connection on a transport that is not a socket, ctx is whatever the
+ *  transport needs to find its state again (dp->xportCtx).  The peer has no
+ *  address, so the connection is ready to dplisten() on straight away.
+ */
+dp_connp dpInitXport(const dp_xport *xport, void *ctx) {
+    dp_connp dpc = dpinit();
+    if (dpc == NULL) {
+        perror("drexel protocol create failure"); 
+        return NULL;
+    }
+
+    dpc->xport = xport;
+    dpc->xportCtx = ctx;
+    dpc->inSockAddr.len = 0;
+    dpc->outSockAddr.len = 0;
+    dpc->inSockAddr.isAddrInit = true;
     return dpc;
 }
 
+/*
+ *  Moves the connection's socket I/O onto io_uring.  If the kernel (or the
+ *  OS) cant do it the connection just stays on plain socket calls.
+ */
+static void dpseturing(dp_connp dp){
+    if (dp->xport != &_dpSockXport)
+        return;
+    dp->uring = dpuring_open(dp->udp_sock);
+    if (dp->uring == NULL) {
+        perror("dpseturing: io_uring not available, using plain sockets");
+        return;
+    }
+    //ring receive buffers hold one dgram, so no coalesced GRO receives
+#ifdef UDP_GRO
+    if (dp->groOn)
+        setsockopt(dp->udp_sock, SOL_UDP, UDP_GRO, &(int){0}, sizeof(int));
+#endif
+    dp->groOn = false;
+}
+
 
 int dprecv(dp_connp dp, void *buff, int buff_sz){
+    return dprecvstream(dp, NULL, buff, buff_sz);
+}
+
+/*
+ *  dprecv() that also says which stream the message came in on (if
+ *  streamId is not NULL).  Returns DP_STREAM_CLOSED, with *streamId set,
+ *  when the peer ended a stream with dpclosestream().
+ */
+int dprecvstream(dp_connp dp, uint32_t *streamId, void *buff, int buff_sz){
 
     dp_pdu *inPdu;
-    int rcvLen = dprecvdgram(dp, _dpBuffer, sizeof(_dpBuffer));
+    uint32_t sid;
+
+    if (streamId == NULL)
+        streamId = &sid;
+
+    //0-RTT data from the CONNECT goes first, see dpconnectdata()
+    if (dp->earlyLen > 0) {
+        int len = dp->earlyLen;
+        if (len > buff_sz)
+            return DP_BUFF_UNDERSIZED;
+        *streamId = DP_STREAM_DEFAULT;
+        memcpy(buff, dp->early, len);
+        dp->earlyLen = 0;
+        return len;
+    }
+
+    if (dp->fecK > 1) {
+        //push out anything still queued before we block on the peer
+        int rc = dpflush(dp);
+        if (rc < 0)
+            return rc;
+        return dpfecrecv(dp, streamId, buff, buff_sz);
+    }
 
-    if(rcvLen == DP_CONNECTION_CLOSED)
-        return DP_CONNECTION_CLOSED;
+    //messages left over from a coalesced dgram go first
+    if (dp->coRxOff < dp->coRxLen) {
+        *streamId = dp->coRxStream;
+        return dpcosplit(dp, buff, buff_sz);
+    }
+    if (dp->coLen > 0) {
+        int rc = dpflush(dp);
+        if (rc < 0)
+            return rc;
+    }
 
-    inPdu = (dp_pdu *)_dpBuffer;
+    //a path MTU probe can grow bigBuff, pick the buffer again after one
+    char *dgram;
+    int rcvLen;
+    do {
+        dgram = (dp->bigBuff != NULL) ? dp->bigBuff : _dpBuffer;
+        rcvLen = dprecvdgram(dp, dgram, DP_DGRAM_SZ(dp));
+    } while (rcvLen == DP_PROBED);
+
+    if (rcvLen < 0)
+        return rcvLen;
+
+    inPdu = (dp_pdu *)dgram;
+    *streamId = inPdu->stream_id;
+    if (inPdu->mtype & DP_MT_FIN)
+        return DP_STREAM_CLOSED;
+    if ((rcvLen > sizeof(dp_pdu)) && (inPdu->mtype & DP_MT_COALESCE)) {
+        if ((dp->coRx == NULL) && ((dp->coRx = malloc(DP_DGRAM_SZ(dp))) == NULL))
+            return DP_ERROR_GENERAL;
+        memcpy(dp->coRx, dgram + sizeof(dp_pdu), inPdu->dgram_sz);
+        dp->coRxLen = inPdu->dgram_sz;
+        dp->coRxOff = 0;
+        dp->coRxStream = inPdu->stream_id;
+        return dpcosplit(dp, buff, buff_sz);
+    }
+    if (inPdu->dgram_sz > buff_sz)
+        return DP_BUFF_UNDERSIZED;
     if(rcvLen > sizeof(dp_pdu))
-        memcpy(buff, (_dpBuffer+sizeof(dp_pdu)), inPdu->dgram_sz);
+        memcpy(buff, (dgram+sizeof(dp_pdu)), inPdu->dgram_sz);
 
     return inPdu->dgram_sz;
 }
@@ -138,10 +441,16 @@ static int dprecvdgram(dp_connp dp, void *buff, int buff_sz){
     int bytesIn = 0;
     int errCode = DP_NO_ERROR;
 
-    if(buff_sz > DP_MAX_DGRAM_SZ)
+    if(buff_sz > DP_DGRAM_SZ(dp))
         return DP_BUFF_OVERSIZED;
 
-    bytesIn = dprecvraw(dp, buff, buff_sz);
+    do {
+        bytesIn = dprecvraw(dp, buff, buff_sz);
+    } while (bytesIn == 0);
+
+    //the transport failed or the peer is gone, there is no dgram to answer
+    if (bytesIn < 0)
+        return (bytesIn == DP_ERROR_TIMEOUT) ? bytesIn : DP_ERROR_GENERAL;
 
     //check for some sort of error and just return it
     if (bytesIn < sizeof(dp_pdu))
@@ -149,6 +458,11 @@ static int dprecvdgram(dp_connp dp, void *buff, int buff_sz){
 
     dp_pdu inPdu;
     memcpy(&inPdu, buff, sizeof(dp_pdu));
+
+    //path MTU probes take no seq number and may not fit, the header will
+    if ((errCode == DP_NO_ERROR) && (inPdu.mtype == DP_MT_PROBE))
+        return dpprobed(dp, &inPdu);
+
     if (inPdu.dgram_sz > buff_sz)
         errCode = DP_BUFF_UNDERSIZED;
 
@@ -156,6 +470,15 @@ static int dprecvdgram(dp_connp dp, void *buff, int buff_sz){
     // memcpy(buff, (_dpBuffer+sizeof(dp_pdu)), inPdu.dgram_sz);
     
     
+    //The sender stamps the low 32 bits of the seq number we expect next
+    if ((errCode == DP_NO_ERROR) &&
+        (dp_seq_extend(dp->seqNum, inPdu.seqnum) != dp->seqNum)){
+        printf("Warning: expected seq %llu but got %s seq %llu\n",
+            (unsigned long long)dp->seqNum,
+            dp_seq_before(inPdu.seqnum, DP_SEQ_WIRE(dp->seqNum)) ? "an old" : "a future",
+            (unsigned long long)dp_seq_extend(dp->seqNum, inPdu.seqnum));
+    }
+
     //UDPATE SEQ NUMBER AND PREPARE ACK
     if (errCode == DP_NO_ERROR){
         if(inPdu.dgram_sz == 0)
@@ -169,10 +492,10 @@ static int dprecvdgram(dp_connp dp, void *buff, int buff_sz){
         dp->seqNum++;
     }
 
-    dp_pdu outPdu;
+    dp_pdu outPdu = {0};
     outPdu.proto_ver = DP_PROTO_VER_1;
     outPdu.dgram_sz = 0;
-    outPdu.seqnum = dp->seqNum;
+    outPdu.seqnum = DP_SEQ_WIRE(dp->seqNum);
     outPdu.err_num = errCode;
 
     int actSndSz = 0;
@@ -187,6 +510,8 @@ static int dprecvdgram(dp_connp dp, void *buff, int buff_sz){
 
     switch(inPdu.mtype){
         case DP_MT_SND:
+        case DP_MT_SND | DP_MT_COALESCE:
+        case DP_MT_SND | DP_MT_FIN:
             outPdu.mtype = DP_MT_SNDACK;
             actSndSz = dpsendraw(dp, &outPdu, sizeof(dp_pdu));
             if (actSndSz != sizeof(dp_pdu))
@@ -210,23 +535,50 @@ static int dprecvdgram(dp_connp dp, void *buff, int buff_sz){
 }
 
 
+/*
+ *  Returns the bytes received, or 0 if the dgram was not from our peer
+ *  (once connected we only talk to one peer, see dpstray()) or was a
+ *  KEEPALIVE.  DP_ERROR_TIMEOUT if the peer went quiet for idleMs.
+ */
 static int dprecvraw(dp_connp dp, void *buff, int buff_sz){
     int bytes = 0;
+    dp_addr from = {0};
+    socklen_t fromLen = sizeof(from);
 
     if(!dp->inSockAddr.isAddrInit) {
         perror("dprecv: dp connection not setup properly - cli struct not init");
         return -1;
     }
 
-    bytes = recvfrom(dp->udp_sock, (char *)buff, buff_sz,  
-                MSG_WAITALL, ( struct sockaddr *) &(dp->outSockAddr.addr), 
-                &(dp->outSockAddr.len)); 
+    //timers on this thread have to fire while we wait
+    if (((_dpWheel.armed > 0) || dp->idleOut) && ((bytes = dpwaitraw(dp, -1)) < 0))
+        return bytes;
+
+    dp->rxKernNs = 0;
+    bytes = dp->xport->recv(dp, buff, buff_sz, &from, &fromLen);
 
     if (bytes < 0) {
-        perror("dprecv: received error from recvfrom()");
+        perror("dprecv: received error from transport");
         return -1;
     }
+    //with several paths the peer may use any of them, answers go back
+    //the way the dgram came
+    int path = dppathfind(dp, &from, fromLen);
+    if (path >= 0) {
+        dp->pathRx = path;
+        dp->path[path].dgrams++;
+    } else if (dp->isConnected && 
+        !dpsameaddr(&from, fromLen, &dp->outSockAddr.addr, dp->outSockAddr.len)) {
+        dpstray(dp, buff, bytes, &from, fromLen);
+        return 0;
+    }
+    memcpy(&dp->outSockAddr.addr, &from, sizeof(from));
+    dp->outSockAddr.len = fromLen;
     dp->outSockAddr.isAddrInit = true;
+    dp->stats.dgramsIn++;
+    dp->stats.bytesIn += bytes;
+    if (dp->bufMin > 0)
+        dprxrate(dp, bytes);
 
     //some helper code if you want to do debugging
     if (bytes > sizeof(dp_pdu)){
@@ -237,27 +589,83 @@ static int dprecvraw(dp_connp dp, void *buff, int buff_sz){
         }
     }
 
+    //path probes time their own path, they stay out of the RTT estimate
     dp_pdu *inPdu = buff;
+    if ((bytes >= (int)sizeof(dp_pdu)) && !(inPdu->mtype & DP_MT_PATH))
+        dpechoed(dp, inPdu);
     print_in_pdu(inPdu);
 
+    if (dp->keepMs || dp->idleMs)
+        dp->lastRxNs = dpnowns();
+    //keepalives are answered here, whatever the caller was waiting for
+    if ((bytes >= (int)sizeof(dp_pdu)) && (inPdu->mtype & DP_MT_KEEPALIVE)) {
+        if (inPdu->mtype == DP_MT_KEEPALIVE)
+            dpkeepsend(dp, DP_MT_KEEPALIVE | DP_MT_ACK);
+        return 0;
+    }
+    if ((bytes >= (int)sizeof(dp_pdu)) && (inPdu->mtype & DP_MT_PATH)) {
+        dppathed(dp, inPdu, &from, fromLen);
+        return 0;
+    }
+
     //return the number of bytes received 
     return bytes;
 }
 
 int dpsend(dp_connp dp, void *sbuff, int sbuff_sz){
+    return dpsendstream(dp, DP_STREAM_DEFAULT, sbuff, sbuff_sz);
+}
+
+/*
+ *  dpsend() on stream streamId.  Streams need no setup, the first message
+ *  on an id opens it on both sides.
+ */
+int dpsendstream(dp_connp dp, uint32_t streamId, void *sbuff, int sbuff_sz){
 
+    //probing for a bigger path MTU happens between messages
+    if (dp->pmtud && (dp->fecK <= 1) && (dp->coLen == 0) &&
+        (dp->pmtuStep < DP_PMTU_STEPS) && (dpnowns() >= dp->pmtuNextNs))
+        dpprobe(dp);
+    if (DP_MP_CLIENT(dp) && (dpnowns() >= dp->pathProbeNs))
+        dppathprobe(dp);
 
     //For now, we will not be able to send larger than the biggest datagram
-    if(sbuff_sz > dpmaxdgram()) {
+    if(sbuff_sz > dpmaxpayload(dp)) {
         return DP_BUFF_UNDERSIZED;
     }
 
-    int sndSz = dpsenddgram(dp, sbuff, sbuff_sz);
+    if (dp->fecK > 1)
+        return dpfecsend(dp, DP_MT_SND, streamId, sbuff, sbuff_sz);
+    if (dp->coalesceMs > 0)
+        return dpcosend(dp, streamId, sbuff, sbuff_sz);
 
+    int sndSz = dpsenddgram(dp, DP_MT_SND, streamId, sbuff, sbuff_sz);
+
+    //the link under us shrank, come down and let the app split it up
+    if ((sndSz < 0) && dp->pmtuTooBig && dp->pmtud) {
+        dppmtudrop(dp);
+        if (sbuff_sz > dpmaxpayload(dp))
+            return DP_BUFF_UNDERSIZED;
+        sndSz = dpsenddgram(dp, DP_MT_SND, streamId, sbuff, sbuff_sz);
+    }
     return sndSz;
 }
 
-static int dpsenddgram(dp_connp dp, void *sbuff, int sbuff_sz){
+/*
+ *  Ends stream streamId, after everything already sent on it.  The id may
+ *  be used again afterwards, the peer just sees a new stream.
+ */
+int dpclosestream(dp_connp dp, uint32_t streamId){
+    int rc;
+
+    if (dp->fecK > 1)
+        rc = dpfecsend(dp, DP_MT_SND | DP_MT_FIN, streamId, NULL, 0);
+    else if ((rc = dpflush(dp)) == DP_NO_ERROR)
+        rc = dpsenddgram(dp, DP_MT_SND | DP_MT_FIN, streamId, NULL, 0);
+    return (rc < 0) ? rc : DP_NO_ERROR;
+}
+
+static int dpsenddgram(dp_connp dp, int mtype, uint32_t streamId, void *sbuff, int sbuff_sz){
     int bytesOut = 0;
 
     if(!dp->outSockAddr.isAddrInit) {
@@ -265,25 +673,49 @@ static int dpsenddgram(dp_connp dp, void *sbuff, int sbuff_sz){
         return DP_ERROR_GENERAL;
     }
 
-    if(sbuff_sz > DP_MAX_BUFF_SZ)
+    if(sbuff_sz > dp->maxPayload)
         return DP_ERROR_GENERAL;
 
     //Build the PDU and out buffer
-    dp_pdu *outPdu = (dp_pdu *)_dpBuffer;
+    char *dgram = (dp->bigBuff != NULL) ? dp->bigBuff : _dpBuffer;
+    dp_pdu *outPdu = (dp_pdu *)dgram;
     int    sndSz = sbuff_sz;
     outPdu->proto_ver = DP_PROTO_VER_1;
-    outPdu->mtype = DP_MT_SND;
+    outPdu->mtype = mtype;
     outPdu->dgram_sz = sndSz;
-    outPdu->seqnum = dp->seqNum;
-
-    memcpy((_dpBuffer + sizeof(dp_pdu)), sbuff, sndSz);
+    outPdu->seqnum = DP_SEQ_WIRE(dp->seqNum);
+    outPdu->err_num = 0;
+    outPdu->grp_idx = 0;
+    outPdu->grp_k = 0;
+    outPdu->grp_m = 0;
+    outPdu->stream_id = streamId;
 
     int totalSendSz = outPdu->dgram_sz + sizeof(dp_pdu);
-    bytesOut = dpsendraw(dp, _dpBuffer, totalSendSz);
+    uint64_t sentNs = dpnowns();
+    if (DP_MP_CLIENT(dp))
+        dp->pathTx = dppathpick(dp, NULL);
+    _Bool zc = (dp->zcMin > 0) && (sndSz >= dp->zcMin);
+
+    if (zc)
+        bytesOut = dpsendrawzc(dp, outPdu, sbuff, sndSz);
+    //no room for another zerocopy send, this one gets copied
+    if (!zc || ((bytesOut < 0) && (errno == ENOBUFS))) {
+        memcpy((dgram + sizeof(dp_pdu)), sbuff, sndSz);
+        bytesOut = dpsendraw(dp, dgram, totalSendSz);
+    }
+    //a path the host will not send on is down, try the next best one
+    while ((bytesOut < 0) && DP_MP_CLIENT(dp) && (dp->path[dp->pathTx].loss < 1.0)) {
+        dp->path[dp->pathTx].loss = 1.0;
+        dp->pathTx = dppathpick(dp, NULL);
+        bytesOut = dpsendraw(dp, dgram, totalSendSz);
+    }
 
     if(bytesOut != totalSendSz){
         printf("Warning send %d, but expected %d!\n", bytesOut, totalSendSz);
     }
+    //nothing went out, so there is no ACK to wait for
+    if (bytesOut < 0)
+        return DP_ERROR_GENERAL;
 
     //update seq number after send
     if(outPdu->dgram_sz == 0)
@@ -293,11 +725,25 @@ static int dpsenddgram(dp_connp dp, void *sbuff, int sbuff_sz){
 
     //need to get an ack
     dp_pdu inPdu = {0};
-    int bytesIn = dprecvraw(dp, &inPdu, sizeof(dp_pdu));
+    int bytesIn;
+    do {
+        bytesIn = dprecvraw(dp, &inPdu, sizeof(dp_pdu));
+    } while (bytesIn == 0);
+    //a dead link or a gone peer, the caller has to know
+    if (bytesIn < 0)
+        return bytesIn;
     if ((bytesIn < sizeof(dp_pdu)) && (inPdu.mtype != DP_MT_SNDACK)){
         printf("Expected SND/ACK but got a different mtype %d\n", inPdu.mtype);
     }
-
+    if (dp_seq_extend(dp->seqNum, inPdu.seqnum) != dp->seqNum){
+        printf("Warning: SND/ACK acked seq %u, expected %u (epoch %u)\n",
+            inPdu.seqnum, DP_SEQ_WIRE(dp->seqNum), DP_SEQ_EPOCH(dp->seqNum));
+    } else
+        dpsample(dp, sentNs, totalSendSz);
+
+    //the caller gets sbuff back, so the kernel must be done with it
+    if (dp->zcPending > 0)
+        dpzcwait(dp);
     return bytesOut - sizeof(dp_pdu);
 }
 
@@ -312,154 +758,2639 @@ static int dpsendraw(dp_connp dp, void *sbuff, int sbuff_sz){
     }
 
     dp_pdu *outPdu = sbuff;
-    bytesOut = sendto(dp->udp_sock, (const char *)sbuff, sbuff_sz, 
-        0, (const struct sockaddr *) &(dp->outSockAddr.addr), 
-            dp->outSockAddr.len); 
 
+    if (dp->pacer.rateBps != 0)
+        dppace(dp, sbuff_sz);
+    dpstamp(dp, outPdu);
+
+    //Simulated loss for testing recovery, only data carrying dgrams are
+    //dropped since nothing recovers lost control messages
+    if ((dp->lossPct > 0) && 
+        ((outPdu->mtype == DP_MT_SND) || (outPdu->mtype == DP_MT_PARITY)) &&
+        dprand(dp->lossPct)) {
+        if (_debugMode == 1)
+            printf("PDU DROPPED (simulated loss) ===> seq %u\n\n", outPdu->seqnum);
+        return sbuff_sz;
+    }
+
+    bytesOut = dp->xport->send(dp, &(struct iovec){sbuff, sbuff_sz}, 1);
+    dp->pmtuTooBig = (bytesOut < 0) && (errno == EMSGSIZE);
+
+    if (bytesOut > 0) {
+        dp->stats.dgramsOut++;
+        dp->stats.bytesOut += bytesOut;
+    }
     
     print_out_pdu(outPdu);
 
     return bytesOut;
 }
 
+/*
+ *  Sends the count dgrams in dgrams[].  With GSO on, each run of equal
+ *  sized dgrams (plus one shorter one to end the run) goes out in a
+ *  single sendmsg(), with io_uring or an
+ *  in-process transport the run goes out as one transport send, otherwise
+ *  one sendto() each.
+ */
+static int dpsendbatch(dp_connp dp, char **dgrams, int count){
+    struct iovec iov[DP_GSO_MAX_SEGS];
+    int i, j, run, len, segSz, runSz, maxRun;
+
+    if (DP_MP_CLIENT(dp))
+        return dppathbatch(dp, dgrams, count);
+    for (i = 0; i < count; i += run) {
+        segSz = sizeof(dp_pdu) + ((dp_pdu *)dgrams[i])->dgram_sz;
+
+        //when pacing, a GSO run must not be bigger than the pacer's burst
+        maxRun = DP_GSO_MAX_SEGS;
+        if ((dp->pacer.rateBps != 0) && (dp->pacer.burst / segSz < maxRun))
+            maxRun = (dp->pacer.burst / segSz > 1) ? dp->pacer.burst / segSz : 1;
+
+        for (run = 0, runSz = 0; (i + run < count) && (run < maxRun); ) {
+            iov[run].iov_base = dgrams[i + run];
+            len = sizeof(dp_pdu) + ((dp_pdu *)iov[run].iov_base)->dgram_sz;
+            if (len > segSz)
+                break;
+            iov[run].iov_len = len;
+            runSz += len;
+            run++;
+            if (len < segSz)
+                break;
+        }
 
-int dplisten(dp_connp dp) {
-    int sndSz, rcvSz;
-
-    if(!dp->inSockAddr.isAddrInit) {
-        perror("dplisten:dp connection not setup properly - cli struct not init");
-        return DP_ERROR_GENERAL;
-    }
-
-    dp_pdu pdu = {0};
+        //the loss simulation needs to see every dgram
+        if (dp->gsoOn && (run > 1) && (dp->lossPct == 0) &&
+            (dpsendrawgso(dp, iov, run, segSz) == runSz))
+            continue;
+        if (((dp->uring != NULL) || (dp->xport != &_dpSockXport)) &&
+            (run > 1) && (dp->lossPct == 0) && (dpsendrawbatch(dp, iov, run) == runSz))
+            continue;
 
-    printf("Waiting for a connection...\n");
-    rcvSz = dprecvraw(dp, &pdu, sizeof(pdu));
-    if (rcvSz != sizeof(pdu)) {
-        perror("dplisten:The wrong number of bytes were received");
-        return DP_ERROR_GENERAL;
+        for (j = 0; j < run; j++) {
+            if (dpsendraw(dp, iov[j].iov_base, iov[j].iov_len) != iov[j].iov_len)
+                return DP_ERROR_PROTOCOL;
+        }
     }
+    return DP_NO_ERROR;
+}
 
-    pdu.mtype = DP_MT_CNTACK;
-    dp->seqNum = pdu.seqnum + 1;
-    pdu.seqnum = dp->seqNum;
-    
-    sndSz = dpsendraw(dp, &pdu, sizeof(pdu));
-    
-    if (sndSz != sizeof(pdu)) {
-        perror("dplisten:The wrong number of bytes were sent");
+/*
+ *  One sendmsg() carrying iovcnt dgrams that the kernel cuts back apart
+ *  every seg_sz bytes, all but the last dgram must be exactly seg_sz.
+ *  Turns GSO off for the connection and returns an error if the kernel or
+ *  the device cannot do it.
+ */
+static int dpsendrawgso(dp_connp dp, struct iovec *iov, int iovcnt, int seg_sz){
+#ifdef UDP_SEGMENT
+    struct msghdr msg = {0};
+    char ctrl[CMSG_SPACE(sizeof(uint16_t))] = {0};
+    struct cmsghdr *cm;
+    int i, bytesOut, total = 0;
+
+    for (i = 0; i < iovcnt; i++)
+        total += iov[i].iov_len;
+
+    //dpsendbatch() keeps the run within one bucket burst
+    if (dp->pacer.rateBps != 0)
+        dppace(dp, total);
+    for (i = 0; i < iovcnt; i++)
+        dpstamp(dp, (dp_pdu *)iov[i].iov_base);
+
+    msg.msg_name = &(dp->outSockAddr.addr.sa);
+    msg.msg_namelen = dp->outSockAddr.len;
+    msg.msg_iov = iov;
+    msg.msg_iovlen = iovcnt;
+    msg.msg_control = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+
+    cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_UDP;
+    cm->cmsg_type = UDP_SEGMENT;
+    cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    *((uint16_t *)CMSG_DATA(cm)) = seg_sz;
+
+    bytesOut = sendmsg(dp->udp_sock, &msg, 0);
+    if (bytesOut != total) {
+        perror("dpsendrawgso: UDP GSO send failed, falling back to sendto()");
+        dp->gsoOn = false;
         return DP_ERROR_GENERAL;
     }
-    dp->isConnected = true; 
-    //For non data transmissions, ACK of just control data increase seq # by one
-    printf("Connection established OK!\n");
 
-    return true;
+    dp->txId++;
+    dp->stats.gsoSends++;
+    dp->stats.dgramsOut += iovcnt;
+    dp->stats.bytesOut += bytesOut;
+    for (i = 0; i < iovcnt; i++)
+        print_out_pdu((dp_pdu *)iov[i].iov_base);
+    return bytesOut;
+#else
+    dp->gsoOn = false;
+    return DP_ERROR_GENERAL;
+#endif
 }
 
-int dpconnect(dp_connp dp) {
+/*
+ *  Hands a run of dgrams to the transport as a single send.
+ */
+static int dpsendrawbatch(dp_connp dp, struct iovec *iov, int iovcnt){
+    int i, bytesOut, total = 0;
 
-    int sndSz, rcvSz;
+    for (i = 0; i < iovcnt; i++)
+        total += iov[i].iov_len;
 
-    if(!dp->outSockAddr.isAddrInit) {
-        perror("dpconnect:dp connection not setup properly - svr struct not init");
+    if (dp->pacer.rateBps != 0)
+        dppace(dp, total);
+    for (i = 0; i < iovcnt; i++)
+        dpstamp(dp, (dp_pdu *)iov[i].iov_base);
+
+    bytesOut = dp->xport->send(dp, iov, iovcnt);
+    if (bytesOut != total) {
+        perror("dpsendrawbatch: batch send failed");
         return DP_ERROR_GENERAL;
     }
 
-    dp_pdu pdu = {0};
-    pdu.mtype = DP_MT_CONNECT;
-    pdu.seqnum = dp->seqNum;
-    pdu.dgram_sz = 0;
+    dp->stats.batchSends++;
+    dp->stats.dgramsOut += iovcnt;
+    dp->stats.bytesOut += bytesOut;
+    for (i = 0; i < iovcnt; i++)
+        print_out_pdu((dp_pdu *)iov[i].iov_base);
+    return bytesOut;
+}
 
-    sndSz = dpsendraw(dp, &pdu, sizeof(pdu));
-    if (sndSz != sizeof(dp_pdu)) {
-        perror("dpconnect:Wrong about of connection data sent");
-        return -1;
+/*
+ *  recvfrom() stand in when GRO is on.  Each receive may carry several
+ *  dgrams of groSeg bytes from one peer, they are handed out one per call.
+ */
+static int dprecvgro(dp_connp dp, void *buff, int buff_sz){
+#ifdef UDP_GRO
+    int seg;
+
+    if (dp->groOff >= dp->groLen) {
+        struct iovec iov = {0};
+        struct msghdr msg = {0};
+        char ctrl[CMSG_SPACE(sizeof(int)) + CMSG_SPACE(3 * sizeof(struct timespec)) +
+                  CMSG_SPACE(sizeof(uint32_t))] = {0};
+        struct cmsghdr *cm;
+        int bytes;
+
+        iov.iov_base = dp->groBuff;
+        iov.iov_len = DP_GRO_BUFF_SZ;
+        msg.msg_name = &(dp->groFrom);
+        msg.msg_namelen = sizeof(dp->groFrom);
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = ctrl;
+        msg.msg_controllen = sizeof(ctrl);
+
+        bytes = recvmsg(dp->udp_sock, &msg, 0);
+        if (bytes < 0)
+            return bytes;
+        dp->groFromLen = msg.msg_namelen;
+
+        dp->groSeg = bytes;
+        for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+            if ((cm->cmsg_level == SOL_UDP) && (cm->cmsg_type == UDP_GRO))
+                memcpy(&dp->groSeg, CMSG_DATA(cm), sizeof(int));
+#ifdef SO_TIMESTAMPING
+            if ((cm->cmsg_level == SOL_SOCKET) && (cm->cmsg_type == SO_TIMESTAMPING)) {
+                struct timespec ts;
+                memcpy(&ts, CMSG_DATA(cm), sizeof(ts));
+                dp->groKernNs = ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+            }
+#endif
+#ifdef SO_RXQ_OVFL
+            if ((cm->cmsg_level == SOL_SOCKET) && (cm->cmsg_type == SO_RXQ_OVFL)) {
+                uint32_t drops;
+                memcpy(&drops, CMSG_DATA(cm), sizeof(drops));
+                dp->stats.rxqDrops = drops;
+            }
+#endif
+        }
+        if ((dp->groSeg <= 0) || (dp->groSeg > bytes))
+            dp->groSeg = bytes;
+        if (dp->groSeg < bytes)
+            dp->stats.groRecvs++;
+        dp->groLen = bytes;
+        dp->groOff = 0;
     }
-    
-    rcvSz = dprecvraw(dp, &pdu, sizeof(pdu));
-    if (rcvSz != sizeof(dp_pdu)) {
-        perror("dpconnect:Wrong about of connection data received");
-        return -1;
+
+    //every dgram split out of one receive got there at the same time
+    dp->rxKernNs = dp->groKernNs;
+    seg = dp->groLen - dp->groOff;
+    if (seg > dp->groSeg)
+        seg = dp->groSeg;
+    memcpy(buff, dp->groBuff + dp->groOff, (seg < buff_sz) ? seg : buff_sz);
+    dp->groOff += seg;
+    return (seg < buff_sz) ? seg : buff_sz;
+#else
+    dp->groFromLen = sizeof(dp->groFrom);
+    return recvfrom(dp->udp_sock, (char *)buff, buff_sz, 0,
+                &(dp->groFrom.sa), &(dp->groFromLen));
+#endif
+}
+
+/*
+ *  The socket transport, shared by UDP and Unix datagram connections.
+ *  io_uring and GRO (UDP only) sit underneath it when turned on.
+ */
+static int dpsocksend(dp_connp dp, struct iovec *iov, int cnt){
+    int i, bytes, waitUs, total = 0;
+    _Bool isUnix = (dp->outSockAddr.addr.sa.sa_family == AF_UNIX);
+
+    //a full Unix peer blocks the sender rather than dropping, so Unix
+    //sends stay off the ring and use MSG_DONTWAIT (see below)
+    if ((dp->uring != NULL) && !isUnix)
+        return dpuring_send(dp->uring, &(dp->outSockAddr.addr.sa), 
+                    dp->outSockAddr.len, iov, cnt);
+
+    //the path picked for this send, see dpaddpath()
+    int sock = dp->udp_sock;
+    if (DP_MP_CLIENT(dp)) {
+        sock = dp->path[dp->pathTx].sock;
+        dp->path[dp->pathTx].dgrams += cnt;
     }
-    if (pdu.mtype != DP_MT_CNTACK) {
-        perror("dpconnect:Expected CNTACT Message but didnt get it");
-        return -1;
+
+    for (i = 0; i < cnt; i++) {
+        for (waitUs = 0; ; waitUs += DP_PEER_RETRY_US) {
+            bytes = sendto(sock, iov[i].iov_base, iov[i].iov_len, 
+                        isUnix ? MSG_DONTWAIT : 0,
+                        &(dp->outSockAddr.addr.sa), dp->outSockAddr.len);
+            if ((bytes >= 0) || (errno != EAGAIN) || (waitUs >= DP_PEER_WAIT_US))
+                break;
+            usleep(DP_PEER_RETRY_US);
+        }
+        //Unix peers only queue max_dgram_qlen dgrams, if both sides block
+        //on each other nobody reads, so past that we drop like UDP would
+        if ((bytes < 0) && (errno == EAGAIN)) {
+            dp->stats.sendDrops++;
+            bytes = iov[i].iov_len;
+        }
+        if (bytes < 0)
+            return -1;
+        dp->txId++;
+        total += bytes;
     }
+    return total;
+}
 
-    //For non data transmissions, ACK of just control data increase seq # by one
-    dp->seqNum++;
-    dp->isConnected = true;
-    printf("Connection established OK!\n");
+static int dpsockrecv(dp_connp dp, void *buff, int buff_sz, dp_addr *from, socklen_t *fromLen){
+    int bytes;
+
+    if (dp->uring != NULL)
+        return dpuring_recv(dp->uring, buff, buff_sz, &(from->sa), fromLen);
+    //a poll that just picked a ready path is not asked again, or it would
+    //move on to the next one and could starve that path
+    if (DP_MP_CLIENT(dp)) {
+        if (!dp->pathReady && (dppathpoll(dp, -1) <= 0))
+            return -1;
+        dp->pathReady = false;
+        return recvfrom(dp->path[dp->pathRx].sock, (char *)buff, buff_sz,
+                    0, &(from->sa), fromLen);
+    }
 
-    return true;
+    //a blocking receive is a wait too, unless we just polled
+    if ((dp->busyPollUs > 0) && !dp->busyReady && (dp->groOff >= dp->groLen))
+        dpspin(dp, dp->busyPollUs);
+    dp->busyReady = false;
+
+    if (dp->groOn) {
+        bytes = dprecvgro(dp, buff, buff_sz);
+        memcpy(from, &dp->groFrom, sizeof(*from));
+        *fromLen = dp->groFromLen;
+        return bytes;
+    }
+    if (dp->kernTs || dp->rxqOvfl)
+        return dprecvcmsg(dp, buff, buff_sz, from, fromLen);
+    return recvfrom(dp->udp_sock, (char *)buff, buff_sz,  
+                MSG_WAITALL, &(from->sa), fromLen); 
 }
 
-int dpdisconnect(dp_connp dp) {
+static int dpsockpoll(dp_connp dp, int timeout_ms){
+    struct pollfd pfd = {0};
+    int rc;
 
-    int sndSz, rcvSz;
+    if (dp->uring != NULL)
+        return dpuring_wait(dp->uring, timeout_ms);
+    if (DP_MP_CLIENT(dp))
+        return (dp->pathReady = (dppathpoll(dp, timeout_ms) > 0));
 
-    dp_pdu pdu = {0};
-    pdu.proto_ver = DP_PROTO_VER_1;
-    pdu.mtype = DP_MT_CLOSE;
-    pdu.seqnum = dp->seqNum;
-    pdu.dgram_sz = 0;
+    if ((dp->busyPollUs > 0) && (timeout_ms != 0)) {
+        int spinUs = dp->busyPollUs;
 
-    sndSz = dpsendraw(dp, &pdu, sizeof(pdu));
-    if (sndSz != sizeof(dp_pdu)) {
-        perror("dpdisconnect:Wrong about of connection data sent");
-        return DP_ERROR_GENERAL;
-    }
-    
-    rcvSz = dprecvraw(dp, &pdu, sizeof(pdu));
-    if (rcvSz != sizeof(dp_pdu)) {
-        perror("dpdisconnect:Wrong about of connection data received");
-        return DP_ERROR_GENERAL;
-    }
-    if (pdu.mtype != DP_MT_CLOSEACK) {
-        perror("dpdisconnect:Expected CNTACT Message but didnt get it"); 
-        return DP_ERROR_GENERAL;
+        if ((timeout_ms > 0) && (spinUs > timeout_ms * 1000))
+            spinUs = timeout_ms * 1000;
+        if (dpspin(dp, spinUs))
+            return (dp->busyReady = true);
+        if (timeout_ms > 0)
+            timeout_ms -= spinUs / 1000;
     }
-    //For non data transmissions, ACK of just control data increase seq # by one
-    dpclose(dp);
-
-    return DP_CONNECTION_CLOSED;
-}
 
-void * dp_prepare_send(dp_pdu *pdu_ptr, void *buff, int buff_sz) {
-    if (buff_sz < sizeof(dp_pdu)) {
-        perror("Expected CNTACT Message but didnt get it");
-        return NULL;
+    pfd.fd = dp->udp_sock;
+    pfd.events = POLLIN;
+    while (1) {
+        rc = poll(&pfd, 1, timeout_ms);
+        if ((rc < 0) && (errno == EINTR))
+            continue;
+        //queued send timestamps and zerocopy completions wake us up too,
+        //they are not dgrams
+        if ((rc > 0) && !(pfd.revents & POLLIN) && (dp->kernTs || (dp->zcMin > 0))) {
+            dperrqueue(dp);
+            continue;
+        }
+        break;
     }
-    bzero(buff, buff_sz);
-    memcpy(buff, pdu_ptr, sizeof(dp_pdu));
 
-    return buff + sizeof(dp_pdu);
+    if (rc < 0)
+        return -1;
+    dp->busyReady = (rc > 0);
+    return rc > 0 ? 1 : 0;
 }
 
+static void dpsockclose(dp_connp dp){
+    dp_addr me = {0};
+    socklen_t meLen = sizeof(me);
+    int i;
 
-//// MISC HELPERS
-void print_out_pdu(dp_pdu *pdu) {
-    if (_debugMode != 1)
+    dpuring_close(dp->uring);
+    for (i = 1; DP_MP_CLIENT(dp) && (i < dp->pathCnt); i++)
+        close(dp->path[i].sock);
+    if (dp->udp_sock < 0)
         return;
-    printf("PDU DETAILS ===>  [OUT]\n");
-    print_pdu_details(pdu);
+    //Unix sockets bound to a path leave the file behind
+    if ((getsockname(dp->udp_sock, &me.sa, &meLen) == 0) &&
+        (me.sa.sa_family == AF_UNIX) && (me.un.sun_path[0] != '\0'))
+        unlink(me.un.sun_path);
+    close(dp->udp_sock);
 }
-void print_in_pdu(dp_pdu *pdu) {
-    if (_debugMode != 1)
-        return;
-    printf("===> PDU DETAILS  [IN]\n");
-    print_pdu_details(pdu);
+
+/*
+ *  Same peer?  Transports without addresses (in-process ones) only ever
+ *  have the one peer.
+ */
+static int dpsameaddr(dp_addr *a, socklen_t aLen, dp_addr *b, socklen_t bLen){
+    if (a->sa.sa_family != b->sa.sa_family)
+        return false;
+    switch (a->sa.sa_family) {
+        case AF_INET:
+            return (a->in.sin_addr.s_addr == b->in.sin_addr.s_addr) &&
+                   (a->in.sin_port == b->in.sin_port);
+        case AF_UNIX:
+            return (aLen == bLen) && 
+                   (memcmp(a->un.sun_path, b->un.sun_path, 
+                        aLen - offsetof(struct sockaddr_un, sun_path)) == 0);
+        default:
+            return true;
+    }
+}
+
+/*
+ *  Turns UDP segmentation offload on or off for a connection (Linux only,
+ *  a no-op elsewhere).  GSO only kicks in for multi dgram sends such as
+ *  FEC groups, GRO applies to everything this side receives.
+ */
+int dpsetoffload(dp_connp dp, int on){
+    dp->gsoOn = false;
+    dp->groOn = false;
+    dp->groOff = dp->groLen = 0;
+    if (!on || (dp->inSockAddr.addr.sa.sa_family != AF_INET))
+        return DP_NO_ERROR;
+
+#if defined(UDP_SEGMENT) && defined(UDP_GRO)
+    dp->gsoOn = true;
+    if (dp->uring != NULL)
+        return DP_NO_ERROR;             //GSO only, see dpseturing()
+    if (dp->groBuff == NULL)
+        dp->groBuff = dppool_alloc(DP_POOL_GRO);
+    if (dp->groBuff == NULL) {
+        perror("dpsetoffload: cannot allocate GRO buffer");
+        return DP_ERROR_GENERAL;
+    }
+    if (setsockopt(dp->udp_sock, SOL_UDP, UDP_GRO, &(int){1}, sizeof(int)) < 0) {
+        perror("setsockopt(UDP_GRO) failed");
+        return DP_ERROR_GENERAL;
+    }
+    dp->groOn = true;
+#endif
+    return DP_NO_ERROR;
+}
+
+
+int dplisten(dp_connp dp) {
+    int sndSz, rcvSz;
+    char dgram[DP_MAX_DGRAM_SZ];
+
+    if(!dp->inSockAddr.isAddrInit) {
+        perror("dplisten:dp connection not setup properly - cli struct not init");
+        return DP_ERROR_GENERAL;
+    }
+
+    dp_pdu pdu = {0};
+
+    if (_debugMode == 1)
+        printf("Waiting for a connection...\n");
+    while (1) {
+        //a CONNECT parked while the listener was busy goes first
+        if ((dp->listener != NULL) && (dp->listener->backlogCnt > 0)) {
+            dp_backlog *bl = &dp->listener->backlog[0];
+            memcpy(&pdu, &bl->pdu, sizeof(pdu));
+            memcpy(&dp->outSockAddr.addr, &bl->addr, sizeof(bl->addr));
+            dp->outSockAddr.len = bl->len;
+            dp->outSockAddr.isAddrInit = true;
+            dp->listener->backlogCnt--;
+            memmove(bl, bl + 1, dp->listener->backlogCnt * sizeof(dp_backlog));
+            dp->tsRecent = pdu.ts_val;
+            //the backlog keeps no 0-RTT data, the client sends it again
+            pdu.dgram_sz = 0;
+            break;
+        }
+
+        rcvSz = dprecvraw(dp, dgram, sizeof(dgram));
+        if (rcvSz < 0) {
+            perror("dplisten:The wrong number of bytes were received");
+            return DP_ERROR_GENERAL;
+        }
+        if (rcvSz < (int)sizeof(pdu))
+            continue;
+        memcpy(&pdu, dgram, sizeof(pdu));
+        //anything else is left over from an earlier session on this socket
+        if ((pdu.mtype != DP_MT_CONNECT) || (pdu.dgram_sz < 0) ||
+            (pdu.dgram_sz > DP_MAX_BUFF_SZ) || (rcvSz != sizeof(pdu) + pdu.dgram_sz))
+            continue;
+        if (!dp->cookies || dpcookieok(dp, &pdu, &dp->outSockAddr.addr, dp->outSockAddr.len))
+            break;
+        dpcookiesend(dp, &pdu, &dp->outSockAddr.addr, dp->outSockAddr.len);
+    }
+
+    //0-RTT data is the first dprecv()'s, the CNTACK's seq number takes it in
+    dp->earlyLen = 0;
+    if ((pdu.dgram_sz > 0) && (dp->early == NULL) &&
+        ((dp->early = malloc(DP_MAX_BUFF_SZ)) == NULL))
+        pdu.dgram_sz = 0;
+    if (pdu.dgram_sz > 0) {
+        memcpy(dp->early, dgram + sizeof(pdu), pdu.dgram_sz);
+        dp->earlyLen = pdu.dgram_sz;
+        dp->stats.earlyBytes += pdu.dgram_sz;
+    }
+
+    pdu.mtype = DP_MT_CNTACK;
+    dp->seqNum = (uint64_t)pdu.seqnum + 1 + pdu.dgram_sz;
+    pdu.seqnum = DP_SEQ_WIRE(dp->seqNum);
+    pdu.dgram_sz = 0;
+
+    //The client picks the FEC settings, echo back what we agreed to
+    if (dpsetfec(dp, pdu.grp_k, pdu.grp_m) != DP_NO_ERROR)
+        dpsetfec(dp, 0, 0);
+    pdu.grp_k = dp->fecK;
+    pdu.grp_m = dp->fecM;
+    //what a client needs to add paths to this session, see dpaddpath()
+    dp->pathToken = dptoken();
+    DP_PDU_SET64(&pdu, dp->pathToken);
+    
+    sndSz = dpsendraw(dp, &pdu, sizeof(pdu));
+    
+    if (sndSz != sizeof(pdu)) {
+        perror("dplisten:The wrong number of bytes were sent");
+        return DP_ERROR_GENERAL;
+    }
+    dp->isConnected = true; 
+    dpkeepstart(dp);
+    //For non data transmissions, ACK of just control data increase seq # by one
+    if (_debugMode == 1)
+        printf("Connection established OK!\n");
+
+    return true;
+}
+
+/*
+ *  Waits for the next client on a listening server connection and returns
+ *  a new connection for that session.  The session shares the listener's
+ *  socket, so dpclose()ing it (or the peer closing it) leaves the listener
+ *  ready for the next dpaccept().
+ */
+dp_connp dpaccept(dp_connp listener) {
+    dp_connp dpc = dpinit();
+    if (dpc == NULL) {
+        perror("drexel protocol create failure"); 
+        return NULL;
+    }
+
+    dpc->udp_sock = listener->udp_sock;
+    dpc->xport = listener->xport;
+    dpc->xportCtx = listener->xportCtx;
+    dpc->listener = listener;
+    memcpy(&dpc->inSockAddr, &listener->inSockAddr, sizeof(listener->inSockAddr));
+    dpc->lossPct = listener->lossPct;
+    dpc->uring = listener->uring;
+    dpc->kernTs = listener->kernTs;
+    dpc->txId = listener->txId;
+    dpc->bufMin = listener->bufMin;
+    dpc->bufMax = listener->bufMax;
+    dpc->sndBuf = listener->sndBuf;
+    dpc->rcvBuf = listener->rcvBuf;
+    dpc->rxqOvfl = listener->rxqOvfl;
+    dpc->busyPollUs = listener->busyPollUs;
+    dpc->busyCpu = listener->busyCpu;
+    dpc->zcMin = listener->zcMin;
+    dpc->zcNext = listener->zcNext;
+    dpc->cookies = listener->cookies;
+    memcpy(dpc->cookieKey, listener->cookieKey, sizeof(dpc->cookieKey));
+    dpc->keepMs = listener->keepMs;
+    dpc->idleMs = listener->idleMs;
+    if (listener->groOn || listener->gsoOn)
+        dpsetoffload(dpc, true);
+
+    if (dplisten(dpc) < 0) {
+        dpclose(dpc);
+        return NULL;
+    }
+    return dpc;
+}
+
+/*
+ *  A connected session got a dgram from someone other than its peer.  On a
+ *  shared (sharded) socket that is usually a new client, so its CONNECT is
+ *  parked on the listener for the next dpaccept(), everything else is
+ *  dropped.
+ */
+static void dpstray(dp_connp dp, void *buff, int bytes, dp_addr *from, socklen_t len){
+    dp_connp lst = dp->listener;
+    dp_pdu *pdu = buff;
+    int i;
+
+    dp->stats.strays++;
+    //a client adding a path to this session
+    if ((bytes >= (int)sizeof(dp_pdu)) && (pdu->mtype == DP_MT_PATH)) {
+        dppathed(dp, pdu, from, len);
+        return;
+    }
+    if ((lst == NULL) || (bytes < (int)sizeof(dp_pdu)) || (pdu->mtype != DP_MT_CONNECT))
+        return;
+
+    if (lst->backlog == NULL)
+        lst->backlog = calloc(DP_BACKLOG_SZ, sizeof(dp_backlog));
+    //only a peer that echoed our cookie gets a place
+    if (dp->cookies && !dpcookieok(dp, pdu, from, len)) {
+        dpcookiesend(dp, pdu, from, len);
+        return;
+    }
+    if ((lst->backlog == NULL) || (lst->backlogCnt == DP_BACKLOG_SZ))
+        return;
+
+    //clients resend CONNECT, only keep the first one
+    for (i = 0; i < lst->backlogCnt; i++) {
+        if (dpsameaddr(&lst->backlog[i].addr, lst->backlog[i].len, from, len))
+            return;
+    }
+    memcpy(&lst->backlog[i].pdu, pdu, sizeof(dp_pdu));
+    lst->backlog[i].pdu.dgram_sz = 0;
+    memcpy(&lst->backlog[i].addr, from, sizeof(*from));
+    lst->backlog[i].len = len;
+    lst->backlogCnt++;
+}
+
+/*
+ *  Has listening connection dp answer CONNECTs with a cookie first and
+ *  only take the ones that echo it, see DP_COOKIE_SECS.  Sessions from
+ *  dpaccept() share the listener's key.  Clients need nothing turned on.
+ */
+int dpsetcookies(dp_connp dp, int on){
+    if (on && !dp->cookies)
+        dprandkey(dp->cookieKey);
+    dp->cookies = on;
+    return DP_NO_ERROR;
+}
+
+//a fresh SipHash key
+static void dprandkey(uint64_t key[2]){
+    FILE *f;
+    size_t got = 0;
+
+    if ((f = fopen("/dev/urandom", "rb")) != NULL) {
+        got = fread(key, 2 * sizeof(uint64_t), 1, f);
+        fclose(f);
+    }
+    //no urandom, at least make it differ from run to run
+    if (got != 1) {
+        key[0] ^= dpnowns() ^ ((uint64_t)getpid() << 32);
+        key[1] ^= (uint64_t)(uintptr_t)key ^ time(NULL);
+    }
+}
+
+/*
+ *  SipHash-2-4 of data under key, a MAC fast enough to run on every
+ *  CONNECT.  Words are read in host order, the cookies it makes only have
+ *  to match the ones this host made.
+ */
+static uint64_t dpsiphash(const uint64_t key[2], const void *data, int len){
+    const uint8_t *in = data;
+    uint64_t v[4] = {
+        key[0] ^ 0x736f6d6570736575ULL, key[1] ^ 0x646f72616e646f6dULL,
+        key[0] ^ 0x6c7967656e657261ULL, key[1] ^ 0x7465646279746573ULL
+    };
+    uint64_t m;
+    int off, i;
+
+    for (off = 0; off + 8 <= len; off += 8) {
+        memcpy(&m, in + off, sizeof(m));
+        v[3] ^= m;
+        dpsipround(v, 2);
+        v[0] ^= m;
+    }
+    m = (uint64_t)len << 56;
+    for (i = 0; off + i < len; i++)
+        m |= (uint64_t)in[off + i] << (8 * i);
+    v[3] ^= m;
+    dpsipround(v, 2);
+    v[0] ^= m;
+    v[2] ^= 0xff;
+    dpsipround(v, 4);
+    return v[0] ^ v[1] ^ v[2] ^ v[3];
+}
+
+static void dpsipround(uint64_t v[4], int rounds){
+    while (rounds-- > 0) {
+        v[0] += v[1]; v[1] = DP_ROTL(v[1], 13); v[1] ^= v[0]; v[0] = DP_ROTL(v[0], 32);
+        v[2] += v[3]; v[3] = DP_ROTL(v[3], 16); v[3] ^= v[2];
+        v[0] += v[3]; v[3] = DP_ROTL(v[3], 21); v[3] ^= v[0];
+        v[2] += v[1]; v[1] = DP_ROTL(v[1], 17); v[1] ^= v[2]; v[2] = DP_ROTL(v[2], 32);
+    }
+}
+
+/*
+ *  The cookie for a CONNECT from peer from in the given DP_COOKIE_SECS
+ *  period, never 0 since that is what a CONNECT without one carries.
+ */
+static uint64_t dpcookie(dp_connp dp, dp_pdu *pdu, dp_addr *from, socklen_t len, uint64_t period){
+    char msg[16 + sizeof(dp_addr)] = {0};
+    uint64_t mac;
+
+    if (len > sizeof(dp_addr))
+        len = sizeof(dp_addr);
+    memcpy(msg, &period, sizeof(period));
+    memcpy(msg + 8, &pdu->seqnum, sizeof(pdu->seqnum));
+    msg[12] = pdu->grp_k;
+    msg[13] = pdu->grp_m;
+    memcpy(msg + 16, from, len);
+    mac = dpsiphash(dp->cookieKey, msg, 16 + len);
+    return mac ? mac : 1;
+}
+
+//true if the CONNECT carries a cookie we made for it and it is still good
+static int dpcookieok(dp_connp dp, dp_pdu *pdu, dp_addr *from, socklen_t len){
+    uint64_t have = DP_PDU_GET64(pdu);
+    uint64_t period = dpnowns() / 1000000000ULL / DP_COOKIE_SECS;
+
+    if (have == 0)
+        return false;
+    if ((have == dpcookie(dp, pdu, from, len, period)) ||
+        ((period > 0) && (have == dpcookie(dp, pdu, from, len, period - 1))))
+        return true;
+    dp->stats.cookiesBad++;
+    return false;
+}
+
+/*
+ *  Answers the CONNECT in pdu from peer from with a COOKIE.  That may not
+ *  be our peer, so the dgram goes straight to the transport with the
+ *  address swapped in, nothing about it is kept.
+ */
+static void dpcookiesend(dp_connp dp, dp_pdu *pdu, dp_addr *from, socklen_t len){
+    dp_pdu out = *pdu;
+    uint64_t cookie = dpcookie(dp, pdu, from, len, dpnowns() / 1000000000ULL / DP_COOKIE_SECS);
+
+    out.mtype = DP_MT_COOKIE;
+    out.dgram_sz = 0;
+    DP_PDU_SET64(&out, cookie);
+    out.ts_ecr = pdu->ts_val;
+    if (dpsendto(dp, &out, from, len) == sizeof(out))
+        dp->stats.cookiesSent++;
+}
+
+/*
+ *  Sends one bare PDU to to, which need not be our peer, straight to the
+ *  transport with the address swapped in.  Answers that must echo a
+ *  particular ts_val set ts_ecr themselves.
+ */
+static int dpsendto(dp_connp dp, dp_pdu *pdu, dp_addr *to, socklen_t len){
+    struct dp_sock peer = dp->outSockAddr;
+    int bytes;
+
+    pdu->ts_val = dpwallus();
+    memcpy(&dp->outSockAddr.addr, to, sizeof(*to));
+    dp->outSockAddr.len = len;
+    dp->outSockAddr.isAddrInit = true;
+    bytes = dp->xport->send(dp, &(struct iovec){pdu, sizeof(*pdu)}, 1);
+    if (bytes > 0) {
+        dp->stats.dgramsOut++;
+        dp->stats.bytesOut += bytes;
+    }
+    dp->outSockAddr = peer;
+    print_out_pdu(pdu);
+    return bytes;
+}
+
+/*
+ *  Sends a KEEPALIVE to a connected peer that has been quiet for keepMs
+ *  and gives it up after idleMs (0 = never) without a word, see
+ *  DP_KEEPALIVE_PROBES.  keepMs 0 picks idleMs / DP_KEEPALIVE_PROBES, both
+ *  0 turns it off.  Sessions from dpaccept() take the listener's settings.
+ */
+int dpsetkeepalive(dp_connp dp, int keepMs, int idleMs){
+    if ((keepMs < 0) || (idleMs < 0))
+        return DP_ERROR_GENERAL;
+    if ((keepMs == 0) && (idleMs > 0))
+        keepMs = (idleMs / DP_KEEPALIVE_PROBES > 0) ? idleMs / DP_KEEPALIVE_PROBES : 1;
+    dp->keepMs = keepMs;
+    dp->idleMs = idleMs;
+    dp->idleOut = false;
+    dptimer_cancel(&dp->keepTimer);
+    dptimer_cancel(&dp->idleTimer);
+    if (dp->isConnected)
+        dpkeepstart(dp);
+    return DP_NO_ERROR;
+}
+
+//arms the timers of a connection that just came up
+static void dpkeepstart(dp_connp dp){
+    uint64_t now;
+
+    if ((dp->keepMs == 0) && (dp->idleMs == 0))
+        return;
+    now = dp->lastRxNs = dpnowns();
+    dp->keepTimer.fire = dpkeepfire;
+    dp->keepTimer.arg = dp;
+    dp->idleTimer.fire = dpidlefire;
+    dp->idleTimer.arg = dp;
+    if (dp->keepMs > 0)
+        dptimer_arm(&_dpWheel, &dp->keepTimer, now, now + dp->keepMs * 1000000ULL);
+    if (dp->idleMs > 0)
+        dptimer_arm(&_dpWheel, &dp->idleTimer, now, now + dp->idleMs * 1000000ULL);
+}
+
+//probes a quiet peer, or waits out keepMs from the last time we heard it
+static void dpkeepfire(dp_timer *t, uint64_t nowNs){
+    dp_connp dp = t->arg;
+    uint64_t due = dp->lastRxNs + dp->keepMs * 1000000ULL;
+
+    if (due <= nowNs) {
+        dpkeepsend(dp, DP_MT_KEEPALIVE);
+        due = nowNs + dp->keepMs * 1000000ULL;
+    }
+    dptimer_arm(&_dpWheel, t, nowNs, due);
+}
+
+static void dpidlefire(dp_timer *t, uint64_t nowNs){
+    dp_connp dp = t->arg;
+    uint64_t due = dp->lastRxNs + dp->idleMs * 1000000ULL;
+
+    if (due > nowNs)
+        dptimer_arm(&_dpWheel, t, nowNs, due);
+    else
+        dp->idleOut = true;
+}
+
+//a KEEPALIVE or its ACK, neither takes a seq number
+static void dpkeepsend(dp_connp dp, int mtype){
+    dp_pdu pdu = {0};
+
+    pdu.proto_ver = DP_PROTO_VER_1;
+    pdu.mtype = mtype;
+    pdu.seqnum = DP_SEQ_WIRE(dp->seqNum);
+    if (dpsendraw(dp, &pdu, sizeof(pdu)) == sizeof(pdu) && (mtype == DP_MT_KEEPALIVE))
+        dp->stats.keepalives++;
+}
+
+/*
+ *  Adds a path to a client connection, a UDP socket bound to localAddr
+ *  (NULL or "" for any) and localPort (0 for any), see DP_MAX_PATHS.
+ *  It joins once the connection is up.  Plain UDP sockets over IPv4
+ *  only, so set the paths up after the other options, dpaddpath() turns
+ *  down a connection using io_uring, GSO/GRO, kernel timestamps,
+ *  zerocopy or busy polling.
+ */
+int dpaddpath(dp_connp dp, char *localAddr, int localPort){
+    struct sockaddr_in me = {0};
+    dp_path *p;
+    int sock;
+
+    if ((dp->xport != &_dpSockXport) || (dp->udp_sock < 0) || (dp->uring != NULL) ||
+        (dp->outSockAddr.addr.sa.sa_family != AF_INET) || dp->gsoOn || dp->groOn ||
+        dp->kernTs || (dp->zcMin > 0) || (dp->busyPollUs > 0) || DP_MP_SERVER(dp))
+        return DP_ERROR_GENERAL;
+    if (dp->pathCnt == 0) {
+        p = &dp->path[0];
+        p->sock = dp->udp_sock;
+        p->len = sizeof(p->addr);
+        getsockname(dp->udp_sock, &p->addr.sa, &p->len);
+        p->joined = true;
+        dp->pathCnt = 1;
+    }
+    if (dp->pathCnt == DP_MAX_PATHS)
+        return DP_ERROR_GENERAL;
+
+    me.sin_family = AF_INET;
+    me.sin_port = htons(localPort);
+    me.sin_addr.s_addr = INADDR_ANY;
+    if ((localAddr != NULL) && (*localAddr != '\0') &&
+        (inet_pton(AF_INET, localAddr, &me.sin_addr) != 1))
+        return DP_ERROR_GENERAL;
+    if ((sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+        perror("dpaddpath: socket creation failed");
+        return DP_ERROR_GENERAL;
+    }
+    if (bind(sock, (struct sockaddr *)&me, sizeof(me)) < 0) {
+        perror("dpaddpath: bind failed");
+        close(sock);
+        return DP_ERROR_GENERAL;
+    }
+
+    p = &dp->path[dp->pathCnt++];
+    memset(p, 0, sizeof(*p));
+    p->sock = sock;
+    p->len = sizeof(p->addr);
+    getsockname(sock, &p->addr.sa, &p->len);
+    if (dp->isConnected)
+        dppathprobe(dp);
+    return DP_NO_ERROR;
+}
+
+static pthread_once_t _dpTokenOnce = PTHREAD_ONCE_INIT;
+static uint64_t _dpTokenKey[2];
+static uint64_t _dpTokenCnt;
+
+static void dptokeninit(){
+    dprandkey(_dpTokenKey);
+}
+
+//a session token nobody can guess, never 0
+static uint64_t dptoken(){
+    uint64_t n, token;
+
+    pthread_once(&_dpTokenOnce, dptokeninit);
+    n = __sync_add_and_fetch(&_dpTokenCnt, 1);
+    token = dpsiphash(_dpTokenKey, &n, sizeof(n));
+    return token ? token : 1;
+}
+
+//the server's path for peer address addr, -1 if it is not one
+static int dppathfind(dp_connp dp, dp_addr *addr, socklen_t len){
+    int i;
+
+    for (i = 0; DP_MP_SERVER(dp) && (i < dp->pathCnt); i++) {
+        if (dpsameaddr(&dp->path[i].addr, dp->path[i].len, addr, len))
+            return i;
+    }
+    return -1;
+}
+
+/*
+ *  Sends a round of PATH probes, one on every path.  A probe from the
+ *  last round still out counts as lost.  Rounds are at least twice the
+ *  slowest path's RTT apart so a slow path does not look lossy.
+ */
+static void dppathprobe(dp_connp dp){
+    uint64_t gapUs = DP_PATH_PROBE_MS * 1000ULL;
+    int i, tx = dp->pathTx;
+    dp_pdu pdu;
+
+    //an older server that gave us no token only has the one path
+    if (dp->pathToken == 0)
+        return;
+    for (i = 0; i < dp->pathCnt; i++) {
+        dp_path *p = &dp->path[i];
+
+        if (p->probeTs != 0)
+            p->loss = p->loss * (1 - DP_PATH_LOSS_GAIN) + DP_PATH_LOSS_GAIN;
+        if (2ULL * p->srttUs > gapUs)
+            gapUs = 2ULL * p->srttUs;
+        memset(&pdu, 0, sizeof(pdu));
+        pdu.proto_ver = DP_PROTO_VER_1;
+        pdu.mtype = DP_MT_PATH;
+        pdu.seqnum = DP_SEQ_WIRE(dp->seqNum);
+        pdu.grp_idx = i;
+        DP_PDU_SET64(&pdu, dp->pathToken);
+        dp->pathTx = i;
+        p->probeTs = 0;
+        if (dpsendto(dp, &pdu, &dp->outSockAddr.addr, dp->outSockAddr.len) == sizeof(pdu)) {
+            p->probeTs = pdu.ts_val;
+            dp->stats.pathProbes++;
+        } else
+            p->loss = 1.0;
+    }
+    dp->pathTx = tx;
+    dp->pathProbeNs = dpnowns() + gapUs * 1000;
+}
+
+/*
+ *  A PATH from addr from.  The server answers it on the path it came in
+ *  on, adding that path if it is new and the PATH has our token.  The
+ *  client takes the answer as an RTT sample and the path as joined.
+ */
+static void dppathed(dp_connp dp, dp_pdu *pdu, dp_addr *from, socklen_t len){
+    dp_pdu ack = {0};
+    dp_path *p;
+    uint32_t rttUs;
+
+    if (pdu->mtype == (DP_MT_PATH | DP_MT_ACK)) {
+        if (!DP_MP_CLIENT(dp) || (pdu->grp_idx >= dp->pathCnt))
+            return;
+        //late answers were already counted as lost
+        p = &dp->path[pdu->grp_idx];
+        if ((p->probeTs == 0) || (pdu->ts_ecr != p->probeTs))
+            return;
+        rttUs = dpwallus() - pdu->ts_ecr;
+        if (rttUs == 0)
+            rttUs = 1;
+        p->srttUs = (p->srttUs == 0) ? rttUs : (7 * p->srttUs + rttUs) / 8;
+        p->loss *= 1 - DP_PATH_LOSS_GAIN;
+        p->probeTs = 0;
+        p->joined = true;
+        return;
+    }
+
+    if ((pdu->mtype != DP_MT_PATH) || (dp->pathToken == 0) ||
+        (DP_PDU_GET64(pdu) != dp->pathToken) || !dp->isConnected)
+        return;
+    //the address the client connected from is path 0
+    if (dp->pathCnt == 0) {
+        p = &dp->path[dp->pathCnt++];
+        memcpy(&p->addr, &dp->outSockAddr.addr, sizeof(p->addr));
+        p->len = dp->outSockAddr.len;
+        p->sock = -1;
+        p->joined = true;
+    }
+    if (dppathfind(dp, from, len) < 0) {
+        if (dp->pathCnt == DP_MAX_PATHS)
+            return;
+        p = &dp->path[dp->pathCnt++];
+        memcpy(&p->addr, from, sizeof(p->addr));
+        p->len = len;
+        p->sock = -1;
+        p->joined = true;
+    }
+
+    ack.proto_ver = DP_PROTO_VER_1;
+    ack.mtype = DP_MT_PATH | DP_MT_ACK;
+    ack.seqnum = DP_SEQ_WIRE(dp->seqNum);
+    ack.grp_idx = pdu->grp_idx;
+    ack.ts_ecr = pdu->ts_val;
+    dpsendto(dp, &ack, from, len);
+}
+
+/*
+ *  The path for the next dgram, the one with the lowest srtt / (1 - loss).
+ *  With load (dgrams already put on each path this round) that cost is
+ *  scaled by load + 1, which spreads a batch over the paths in proportion.
+ */
+static int dppathpick(dp_connp dp, int *load){
+    int i, up = 0, best = 0;
+    double cost, bestCost = 0;
+
+    for (i = 0; i < dp->pathCnt; i++)
+        up += dp->path[i].joined && (dp->path[i].loss <= DP_PATH_DEAD_LOSS);
+    for (i = 0; i < dp->pathCnt; i++) {
+        dp_path *p = &dp->path[i];
+
+        if (!p->joined || ((up > 0) && (p->loss > DP_PATH_DEAD_LOSS)))
+            continue;
+        cost = (p->srttUs ? p->srttUs : DP_PATH_DEF_RTT_US) / (1.0 - ((p->loss < 0.95) ? p->loss : 0.95));
+        if (load != NULL)
+            cost *= load[i] + 1;
+        if ((bestCost == 0) || (cost < bestCost)) {
+            best = i;
+            bestCost = cost;
+        }
+    }
+    return best;
+}
+
+/*
+ *  dpsendbatch() over several paths, one dgram at a time.  A path the
+ *  host will not send on is taken as down and the dgram tries the next.
+ */
+static int dppathbatch(dp_connp dp, char **dgrams, int count){
+    int load[DP_MAX_PATHS] = {0};
+    int i, len, rc;
+
+    for (i = 0; i < count; i++) {
+        len = sizeof(dp_pdu) + ((dp_pdu *)dgrams[i])->dgram_sz;
+        dp->pathTx = dppathpick(dp, load);
+        while (((rc = dpsendraw(dp, dgrams[i], len)) < 0) && (dp->path[dp->pathTx].loss < 1.0)) {
+            dp->path[dp->pathTx].loss = 1.0;
+            dp->pathTx = dppathpick(dp, load);
+        }
+        if (rc != len)
+            return DP_ERROR_PROTOCOL;
+        load[dp->pathTx]++;
+    }
+    return DP_NO_ERROR;
+}
+
+/*
+ *  dpsockpoll() over every path socket.  Returns 1 with pathRx set to one
+ *  that is ready, starting after the last one read so a busy path does
+ *  not starve the others, 0 on timeout.
+ */
+static int dppathpoll(dp_connp dp, int timeout_ms){
+    struct pollfd pfd[DP_MAX_PATHS];
+    int i, j, rc;
+
+    for (i = 0; i < dp->pathCnt; i++) {
+        pfd[i].fd = dp->path[i].sock;
+        pfd[i].events = POLLIN;
+        pfd[i].revents = 0;
+    }
+    while (((rc = poll(pfd, dp->pathCnt, timeout_ms)) < 0) && (errno == EINTR))
+        ;
+    if (rc <= 0)
+        return (rc < 0) ? -1 : 0;
+    for (i = 1; i <= dp->pathCnt; i++) {
+        j = (dp->pathRx + i) % dp->pathCnt;
+        if (pfd[j].revents != 0) {
+            dp->pathRx = j;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int dpconnect(dp_connp dp) {
+    return dpconnectdata(dp, NULL, 0);
+}
+
+/*
+ *  dpconnect() with buff (up to dpmaxdgram() bytes) riding on the CONNECT
+ *  as 0-RTT data, the server's first dprecv() gets it.  Returns once the
+ *  data is acknowledged, sent again after the CNTACK if the server did not
+ *  take it.
+ */
+int dpconnectdata(dp_connp dp, void *buff, int len) {
+
+    int sndSz, rcvSz, tries;
+    char *dgram = _dpBuffer;
+    _Bool resend = false;
+
+    if(!dp->outSockAddr.isAddrInit) {
+        perror("dpconnect:dp connection not setup properly - svr struct not init");
+        return DP_ERROR_GENERAL;
+    }
+    if ((len < 0) || (len > DP_MAX_BUFF_SZ))
+        return DP_BUFF_UNDERSIZED;
+
+    dp_pdu req = {0}, pdu;
+    req.mtype = DP_MT_CONNECT;
+    req.seqnum = DP_SEQ_WIRE(dp->seqNum);
+    req.dgram_sz = len;
+    req.grp_k = dp->fecK;
+    req.grp_m = dp->fecM;
+
+    //a server using cookies answers with one first, CONNECT again with it
+    for (tries = 0; ; tries++) {
+        memcpy(dgram, &req, sizeof(req));
+        if (len > 0)
+            memcpy(dgram + sizeof(req), buff, len);
+        sndSz = dpsendraw(dp, dgram, sizeof(req) + len);
+        if (sndSz != sizeof(dp_pdu) + len) {
+            perror("dpconnect:Wrong about of connection data sent");
+            return -1;
+        }
+    
+        rcvSz = dprecvraw(dp, &pdu, sizeof(pdu));
+        if (rcvSz != sizeof(dp_pdu)) {
+            perror("dpconnect:Wrong about of connection data received");
+            return -1;
+        }
+        if ((pdu.mtype != DP_MT_COOKIE) || (tries == DP_COOKIE_TRIES))
+            break;
+        req.err_num = pdu.err_num;
+        req.stream_id = pdu.stream_id;
+    }
+    if (pdu.mtype != DP_MT_CNTACK) {
+        perror("dpconnect:Expected CNTACT Message but didnt get it");
+        return -1;
+    }
+    if ((pdu.grp_k != dp->fecK) || (pdu.grp_m != dp->fecM)) {
+        printf("Warning: server did not accept FEC %d+%d, FEC is off\n",
+            dp->fecK, dp->fecM);
+        dpsetfec(dp, 0, 0);
+    }
+
+    //For non data transmissions, ACK of just control data increase seq # by one,
+    //the 0-RTT data got there if the CNTACK covers it too
+    if ((len > 0) && (dp_seq_extend(dp->seqNum, pdu.seqnum) == dp->seqNum + 1 + len))
+        dp->seqNum += 1 + len;
+    else {
+        dp->seqNum++;
+        resend = (len > 0);
+    }
+    dp->isConnected = true;
+    dpkeepstart(dp);
+    //the extra paths join with the server's token
+    if (DP_MP_CLIENT(dp)) {
+        dp->path[0].len = sizeof(dp->path[0].addr);
+        getsockname(dp->udp_sock, &dp->path[0].addr.sa, &dp->path[0].len);
+        dp->pathToken = DP_PDU_GET64(&pdu);
+        dppathprobe(dp);
+    }
+    if (resend) {
+        dp->stats.earlyResent++;
+        if (dpsend(dp, buff, len) < 0)
+            return -1;
+    }
+    if (_debugMode == 1)
+        printf("Connection established OK!\n");
+
+    return true;
+}
+
+int dpdisconnect(dp_connp dp) {
+
+    int sndSz, rcvSz;
+
+    //anything still sitting in a FEC group has to go before the CLOSE
+    if ((sndSz = dpflush(dp)) < 0)
+        return sndSz;
+
+    dp_pdu pdu = {0};
+    pdu.proto_ver = DP_PROTO_VER_1;
+    pdu.mtype = DP_MT_CLOSE;
+    pdu.seqnum = DP_SEQ_WIRE(dp->seqNum);
+    pdu.dgram_sz = 0;
+
+    sndSz = dpsendraw(dp, &pdu, sizeof(pdu));
+    if (sndSz != sizeof(dp_pdu)) {
+        perror("dpdisconnect:Wrong about of connection data sent");
+        return DP_ERROR_GENERAL;
+    }
+    
+    //in FEC mode the peer may still be re-ACKing group resends, skip those
+    do {
+        rcvSz = dprecvraw(dp, &pdu, sizeof(pdu));
+    } while ((rcvSz == 0) || ((rcvSz == sizeof(dp_pdu)) && (dp->fecK > 1) && 
+             (pdu.mtype == DP_MT_SNDACK)));
+    if (rcvSz != sizeof(dp_pdu)) {
+        perror("dpdisconnect:Wrong about of connection data received");
+        return DP_ERROR_GENERAL;
+    }
+    if (pdu.mtype != DP_MT_CLOSEACK) {
+        perror("dpdisconnect:Expected CNTACT Message but didnt get it"); 
+        return DP_ERROR_GENERAL;
+    }
+    //For non data transmissions, ACK of just control data increase seq # by one
+    dpclose(dp);
+
+    return DP_CONNECTION_CLOSED;
+}
+
+/*
+ *  Turns path MTU discovery on or off for a UDP connection, see
+ *  DP_PMTU_MAX.  The payload starts at dpmaxdgram() and goes up as probes
+ *  get through.  Not with FEC or the io_uring backend, whose receive
+ *  buffers are a fixed size.
+ */
+int dpsetpmtud(dp_connp dp, int on){
+#ifdef IP_PMTUDISC_PROBE
+    int mode = on ? IP_PMTUDISC_PROBE : IP_PMTUDISC_WANT;
+
+    if ((dp->udp_sock < 0) || (dp->inSockAddr.addr.sa.sa_family != AF_INET) ||
+        (dp->uring != NULL) || (dp->fecK > 1))
+        return on ? DP_ERROR_GENERAL : DP_NO_ERROR;
+    if (setsockopt(dp->udp_sock, IPPROTO_IP, IP_MTU_DISCOVER, &mode, sizeof(mode)) < 0) {
+        perror("setsockopt(IP_MTU_DISCOVER) failed");
+        return DP_ERROR_GENERAL;
+    }
+    dp->pmtud = on;
+    dp->pmtuStep = 0;
+    dp->pmtuLost = 0;
+    dp->pmtuNextNs = 0;
+    return DP_NO_ERROR;
+#else
+    return on ? DP_ERROR_GENERAL : DP_NO_ERROR;
+#endif
+}
+
+/*
+ *  Sends one padded probe of the next size in _dpPmtuSteps and waits for
+ *  the PROBE/ACK, which moves the payload up to what the peer can take.
+ *  A size that goes unanswered DP_PMTU_MAX_LOST times, or that our own
+ *  link will not send, is not tried again for DP_PMTU_RAISE_S.
+ */
+static int dpprobe(dp_connp dp){
+    int sz = _dpPmtuSteps[dp->pmtuStep] - DP_PMTU_HDR_SZ - (int)sizeof(dp_pdu);
+    int waitMs = 3 * (dp->srttUs / 1000);
+    uint32_t tsVal;
+    dp_pdu *pdu, in;
+    char *probe;
+    int rc;
+
+    //already there (the peer capped an earlier probe, or dpsetpayload())
+    if (sz <= dp->maxPayload) {
+        dp->pmtuStep++;
+        return DP_NO_ERROR;
+    }
+    if (waitMs < DP_PMTU_PROBE_MS)
+        waitMs = DP_PMTU_PROBE_MS;
+    if ((probe = calloc(1, sz + sizeof(dp_pdu))) == NULL)
+        return DP_ERROR_GENERAL;
+    pdu = (dp_pdu *)probe;
+    pdu->proto_ver = DP_PROTO_VER_1;
+    pdu->mtype = DP_MT_PROBE;
+    pdu->seqnum = DP_SEQ_WIRE(dp->seqNum);
+    pdu->dgram_sz = sz;
+
+    dp->stats.pmtuProbes++;
+    rc = dpsendraw(dp, probe, sz + sizeof(dp_pdu));
+    tsVal = pdu->ts_val;
+    free(probe);
+
+    //the PROBE/ACK echoes our ts_val, anything else is a stale answer
+    while ((rc >= 0) && ((rc = dpwaitraw(dp, waitMs)) > 0)) {
+        if (dprecvraw(dp, &in, sizeof(in)) < (int)sizeof(dp_pdu))
+            continue;
+        if ((in.mtype != (DP_MT_PROBE | DP_MT_ACK)) || (in.ts_ecr != tsVal))
+            continue;
+        if ((in.dgram_sz > dp->maxPayload) && (dpsetpayload(dp, in.dgram_sz) != DP_NO_ERROR))
+            return DP_ERROR_GENERAL;
+        //a peer that took less than we sent cannot take more later either
+        dp->pmtuStep = (in.dgram_sz < sz) ? DP_PMTU_STEPS : dp->pmtuStep + 1;
+        dp->pmtuLost = 0;
+        return DP_NO_ERROR;
+    }
+
+    dp->stats.pmtuLost++;
+    if (dp->pmtuTooBig || (++dp->pmtuLost >= DP_PMTU_MAX_LOST)) {
+        dp->pmtuLost = 0;
+        dp->pmtuNextNs = dpnowns() + DP_PMTU_RAISE_S * 1000000000ULL;
+    }
+    return DP_NO_ERROR;
+}
+
+/*
+ *  Answers a path MTU probe with the payload we can take, after growing
+ *  our dgram buffer to it.  Returns DP_PROBED, the caller has to pick up
+ *  bigBuff again.
+ */
+static int dpprobed(dp_connp dp, dp_pdu *pdu){
+    dp_pdu ack = {0};
+    int sz = pdu->dgram_sz;
+
+    if (sz > DP_PMTU_MAX_PAYLOAD)
+        sz = DP_PMTU_MAX_PAYLOAD;
+    if ((dp->uring != NULL) && (sz > DP_URING_MAX_DGRAM - (int)sizeof(dp_pdu)))
+        sz = DP_URING_MAX_DGRAM - sizeof(dp_pdu);
+    if ((sz > dp->maxPayload) && (dpsetpayload(dp, sz) != DP_NO_ERROR))
+        sz = dp->maxPayload;
+
+    ack.proto_ver = DP_PROTO_VER_1;
+    ack.mtype = DP_MT_PROBE | DP_MT_ACK;
+    ack.seqnum = DP_SEQ_WIRE(dp->seqNum);
+    ack.dgram_sz = sz;
+    if (dpsendraw(dp, &ack, sizeof(dp_pdu)) != sizeof(dp_pdu))
+        return DP_ERROR_PROTOCOL;
+    return DP_PROBED;
+}
+
+//our own host would not send a dgram this big, start over from the bottom
+static void dppmtudrop(dp_connp dp){
+    dp->pmtuTooBig = false;
+    dp->stats.pmtuDrops++;
+    dpsetpayload(dp, DP_MAX_BUFF_SZ);
+    dp->pmtuStep = 0;
+    dp->pmtuLost = 0;
+    dp->pmtuNextNs = 0;
+}
+
+/*
+ *  Sizes the socket buffers from the bandwidth-delay product from here on,
+ *  never below minBytes or above maxBytes (0 for DP_SOCKBUF_MIN and
+ *  DP_SOCKBUF_MAX), minBytes < 0 stops it.  Also asks the kernel for its
+ *  receive queue drop count (SO_RXQ_OVFL), which would otherwise only
+ *  show up as retransmits.  Sockets only, not the in-process rings.
+ */
+int dpsetsockbuf(dp_connp dp, int minBytes, int maxBytes){
+    int on = (minBytes >= 0);
+
+    if (dp->udp_sock < 0)
+        return on ? DP_ERROR_GENERAL : DP_NO_ERROR;
+    if (!on) {
+        dp->bufMin = dp->bufMax = 0;
+        return DP_NO_ERROR;
+    }
+    dp->bufMin = (minBytes > 0) ? minBytes : DP_SOCKBUF_MIN;
+    dp->bufMax = (maxBytes > 0) ? maxBytes : DP_SOCKBUF_MAX;
+    if (dp->bufMax < dp->bufMin)
+        dp->bufMax = dp->bufMin;
+#ifdef SO_RXQ_OVFL
+    //the io_uring receives carry no control messages to read it from
+    if (dp->uring == NULL)
+        dp->rxqOvfl = (setsockopt(dp->udp_sock, SOL_SOCKET, SO_RXQ_OVFL, 
+                                  &on, sizeof(on)) == 0);
+#endif
+    dpsizebufs(dp);
+    return DP_NO_ERROR;
+}
+
+/*
+ *  Grows the socket buffers towards DP_SOCKBUF_GAIN x the bandwidth-delay
+ *  product, see DP_SOCKBUF_MIN.  A buffer only moves once the target is
+ *  a quarter past what it has, so this stays off the per dgram path.
+ */
+static void dpsizebufs(dp_connp dp){
+    uint64_t rate = (dp->deliveryBps > dp->rxRateBps) ? dp->deliveryBps : dp->rxRateBps;
+    uint64_t rtt = dp->srttUs ? dp->srttUs : DP_SOCKBUF_RTT_US;
+    uint64_t burst = DP_DGRAM_SZ(dp);
+    uint64_t want;
+
+    //a whole FEC group goes out before we wait
+    if (dp->fecK > 1)
+        burst = (dp->fecK + dp->fecM) * DP_MAX_DGRAM_SZ;
+    want = DP_SOCKBUF_GAIN * ((rate * rtt / 1000000) + burst);
+    if (want < (uint64_t)dp->bufMin)
+        want = dp->bufMin;
+    if (want > (uint64_t)dp->bufMax)
+        want = dp->bufMax;
+
+#if defined(SO_SNDBUFFORCE) && defined(SO_RCVBUFFORCE)
+    if (want > (uint64_t)dp->sndBuf + dp->sndBuf / 4)
+        dp->sndBuf = dpsetbuf(dp, SO_SNDBUF, SO_SNDBUFFORCE, (int)want);
+    if (want > (uint64_t)dp->rcvBuf + dp->rcvBuf / 4)
+        dp->rcvBuf = dpsetbuf(dp, SO_RCVBUF, SO_RCVBUFFORCE, (int)want);
+#else
+    if (want > (uint64_t)dp->sndBuf + dp->sndBuf / 4)
+        dp->sndBuf = dpsetbuf(dp, SO_SNDBUF, -1, (int)want);
+    if (want > (uint64_t)dp->rcvBuf + dp->rcvBuf / 4)
+        dp->rcvBuf = dpsetbuf(dp, SO_RCVBUF, -1, (int)want);
+#endif
+}
+
+/*
+ *  Sets one socket buffer, the FORCE option first (forceOpt < 0 for none).
+ *  Without CAP_NET_ADMIN the kernel quietly caps the plain option at its
+ *  [wr]mem_max.  Returns the size asked for either way, so a capped
+ *  buffer is not asked again until the target grows, print_dp_stats()
+ *  shows what the kernel really gave.
+ */
+static int dpsetbuf(dp_connp dp, int opt, int forceOpt, int bytes){
+    dp->stats.bufResizes++;
+    if ((forceOpt >= 0) &&
+        (setsockopt(dp->udp_sock, SOL_SOCKET, forceOpt, &bytes, sizeof(bytes)) == 0))
+        return bytes;
+    if (setsockopt(dp->udp_sock, SOL_SOCKET, opt, &bytes, sizeof(bytes)) < 0)
+        perror("setsockopt(SO_SNDBUF/SO_RCVBUF) failed");
+    return bytes;
+}
+
+//the receiver's side of dpsample(), bytes/sec over DP_SOCKBUF_CHECK_MS
+static void dprxrate(dp_connp dp, int bytes){
+    uint64_t now = dpnowns();
+    uint64_t rate;
+
+    dp->rxRateBytes += bytes;
+    if (dp->rxRateNs == 0) {
+        dp->rxRateNs = now;
+        return;
+    }
+    if (now - dp->rxRateNs < DP_SOCKBUF_CHECK_MS * 1000000ULL)
+        return;
+
+    rate = dp->rxRateBytes * 1000000000ULL / (now - dp->rxRateNs);
+    dp->rxRateBps = (dp->rxRateBps == 0) ? rate : (7 * dp->rxRateBps + rate) / 8;
+    dp->rxRateNs = now;
+    dp->rxRateBytes = 0;
+    dpsizebufs(dp);
+}
+
+/*
+ *  Turns busy polling on for waits on a socket, spinning up to spinUs
+ *  (0 turns it off) before sleeping, see DP_BUSY_POLL_MAX_US.  A cpu >= 0
+ *  pins the calling thread to that core, it should be the one receiving.
+ *  Not with the io_uring backend, which waits in the ring instead.
+ */
+int dpsetbusypoll(dp_connp dp, int spinUs, int cpu){
+    if ((dp->udp_sock < 0) || (dp->uring != NULL) || (spinUs < 0) ||
+        (spinUs > DP_BUSY_POLL_MAX_US))
+        return spinUs ? DP_ERROR_GENERAL : DP_NO_ERROR;
+
+    if ((spinUs > 0) && (cpu >= 0)) {
+#ifdef __linux__
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0) {
+            perror("sched_setaffinity failed");
+            return DP_ERROR_GENERAL;
+        }
+#else
+        return DP_ERROR_GENERAL;
+#endif
+    }
+#ifdef SO_BUSY_POLL
+    //best effort, past net.core.busy_read it takes CAP_NET_ADMIN
+    setsockopt(dp->udp_sock, SOL_SOCKET, SO_BUSY_POLL, &spinUs, sizeof(spinUs));
+#endif
+    dp->busyPollUs = spinUs;
+    dp->busyCpu = (spinUs > 0) ? cpu : -1;
+    dp->busyReady = false;
+    return DP_NO_ERROR;
+}
+
+//spins up to spinUs for a dgram on the socket, 1 if one showed up
+static int dpspin(dp_connp dp, int spinUs){
+    struct pollfd pfd = {0};
+    uint64_t start = dpnowns();
+    uint64_t now = start;
+    int rc = 0;
+
+    pfd.fd = dp->udp_sock;
+    pfd.events = POLLIN;
+    while (now - start < (uint64_t)spinUs * 1000) {
+        rc = poll(&pfd, 1, 0);
+        if ((rc > 0) && (pfd.revents & POLLIN))
+            break;
+        //neither are queued send timestamps or zerocopy completions
+        if ((rc > 0) && (dp->kernTs || (dp->zcMin > 0)))
+            dperrqueue(dp);
+        rc = 0;
+        now = dpnowns();
+    }
+    dp->stats.busySpinNs += dpnowns() - start;
+    if (rc > 0)
+        dp->stats.busyHits++;
+    else
+        dp->stats.busySleeps++;
+    return rc > 0;
+}
+
+/*
+ *  Sends dpsend()s of minBytes and up with MSG_ZEROCOPY, 0 turns it off,
+ *  see DP_ZC_MIN_BYTES.  UDP over IPv4 only, not on the io_uring backend.
+ */
+int dpsetzerocopy(dp_connp dp, int minBytes){
+#if defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY)
+    int on = (minBytes > 0);
+
+    if ((dp->udp_sock < 0) || (dp->inSockAddr.addr.sa.sa_family != AF_INET) ||
+        (dp->uring != NULL) || (minBytes < 0))
+        return on ? DP_ERROR_GENERAL : DP_NO_ERROR;
+    if (!on && (dp->zcPending > 0))
+        dpzcwait(dp);
+    if (setsockopt(dp->udp_sock, SOL_SOCKET, SO_ZEROCOPY, &on, sizeof(on)) < 0) {
+        perror("setsockopt(SO_ZEROCOPY) failed");
+        return DP_ERROR_GENERAL;
+    }
+    dp->zcMin = minBytes;
+    return DP_NO_ERROR;
+#else
+    return minBytes ? DP_ERROR_GENERAL : DP_NO_ERROR;
+#endif
+}
+
+/*
+ *  dpsendraw() for one zerocopy dgram, pdu goes out from a pooled copy
+ *  that waits in zcRing for the kernel's completion and sbuff goes out as
+ *  is.  Fails with ENOBUFS when the ring (or the kernel's option memory)
+ *  is full, the caller then copies instead.
+ */
+static int dpsendrawzc(dp_connp dp, dp_pdu *pdu, void *sbuff, int sbuff_sz){
+#ifdef MSG_ZEROCOPY
+    dp_zcslot *slot = &dp->zcRing[dp->zcNext % DP_ZC_RING];
+    struct iovec iov[2];
+    struct msghdr msg = {0};
+    int total = sizeof(dp_pdu) + sbuff_sz;
+    char *hdr;
+    int bytesOut;
+
+    if ((slot->hdr != NULL) || ((hdr = dppool_alloc(DP_POOL_DGRAM)) == NULL)) {
+        errno = ENOBUFS;
+        return -1;
+    }
+    memcpy(hdr, pdu, sizeof(dp_pdu));
+
+    if (dp->pacer.rateBps != 0)
+        dppace(dp, total);
+    dpstamp(dp, (dp_pdu *)hdr);
+    print_out_pdu((dp_pdu *)hdr);
+
+    //simulated loss, see dpsendraw()
+    if ((dp->lossPct > 0) && (pdu->mtype == DP_MT_SND) && dprand(dp->lossPct)) {
+        if (_debugMode == 1)
+            printf("PDU DROPPED (simulated loss) ===> seq %u\n\n", pdu->seqnum);
+        dppool_free(DP_POOL_DGRAM, hdr);
+        return total;
+    }
+
+    iov[0].iov_base = hdr;
+    iov[0].iov_len = sizeof(dp_pdu);
+    iov[1].iov_base = sbuff;
+    iov[1].iov_len = sbuff_sz;
+    msg.msg_name = &(dp->outSockAddr.addr.sa);
+    msg.msg_namelen = dp->outSockAddr.len;
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+
+    bytesOut = sendmsg(dp->udp_sock, &msg, MSG_ZEROCOPY);
+    dp->pmtuTooBig = (bytesOut < 0) && (errno == EMSGSIZE);
+    if (bytesOut < 0) {
+        int err = errno;
+        dppool_free(DP_POOL_DGRAM, hdr);
+        errno = err;
+        return -1;
+    }
+
+    //the kernel only counts the sends it took
+    slot->id = dp->zcNext++;
+    slot->hdr = hdr;
+    dp->zcPending++;
+    dp->txId++;
+    dp->stats.zcSends++;
+    dp->stats.dgramsOut++;
+    dp->stats.bytesOut += bytesOut;
+    return bytesOut;
+#else
+    errno = ENOBUFS;
+    return -1;
+#endif
+}
+
+//the kernel is done with zerocopy sends lo to hi
+static void dpzcdone(dp_connp dp, uint32_t lo, uint32_t hi, _Bool copied){
+    uint32_t id;
+
+    for (id = lo; ; id++) {
+        dp_zcslot *slot = &dp->zcRing[id % DP_ZC_RING];
+
+        if ((slot->hdr != NULL) && (slot->id == id)) {
+            dppool_free(DP_POOL_DGRAM, slot->hdr);
+            slot->hdr = NULL;
+            dp->zcPending--;
+            if (copied)
+                dp->stats.zcCopied++;
+        }
+        if (id == hi)
+            break;
+    }
+}
+
+//waits up to DP_ZC_WAIT_MS for every zerocopy send to complete
+static void dpzcwait(dp_connp dp){
+    struct pollfd pfd = {0};
+    uint64_t start = dpnowns();
+
+    //POLLERR, a non empty error queue, is always reported
+    pfd.fd = dp->udp_sock;
+    dperrqueue(dp);
+    while ((dp->zcPending > 0) && (dpnowns() - start < DP_ZC_WAIT_MS * 1000000ULL)) {
+        poll(&pfd, 1, 1);
+        dperrqueue(dp);
+    }
+    if (dp->zcPending > 0)
+        dp->stats.zcTimeouts++;
+}
+
+/*
+ *  Turns small message coalescing on (delayMs > 0) or off.  dpsend()s are
+ *  then packed, each behind a 4 byte length, into one dgram that goes out
+ *  when the next message would not fit, when the oldest one has waited
+ *  delayMs by the time of the next dpsend(), or on dpflush(), dprecv() and
+ *  dpdisconnect().  An app that goes quiet must dpflush(), nothing runs in
+ *  the background.  Only the sender opts in, every receiver splits them
+ *  back up.  Not used together with FEC, which already groups sends.
+ */
+int dpsetcoalesce(dp_connp dp, int delayMs){
+    int rc;
+
+    if ((rc = dpflush(dp)) < 0)
+        return rc;
+    if (delayMs <= 0) {
+        dp->coalesceMs = 0;
+        return DP_NO_ERROR;
+    }
+    if (dp->fecK > 1)
+        return DP_ERROR_GENERAL;
+    dp->coalesceMs = delayMs;
+    return DP_NO_ERROR;
+}
+
+static int dpcosend(dp_connp dp, uint32_t streamId, void *sbuff, int sbuff_sz){
+    uint32_t len = sbuff_sz;
+    int rc;
+
+    if (sbuff_sz <= 0)
+        return 0;
+
+    //the next one would not fit, is for another stream, or the oldest has
+    //waited long enough
+    if ((dp->coLen > 0) && 
+        ((dp->coLen + sizeof(len) + sbuff_sz > dp->maxPayload) ||
+         (streamId != dp->coStream) ||
+         (dpnowns() - dp->coStartNs >= (uint64_t)dp->coalesceMs * 1000000))) {
+        if ((rc = dpcoflush(dp)) < 0)
+            return rc;
+    }
+    //too big to share a dgram with anything
+    if (sizeof(len) + sbuff_sz > dp->maxPayload)
+        return dpsenddgram(dp, DP_MT_SND, streamId, sbuff, sbuff_sz);
+
+    if ((dp->coTx == NULL) && ((dp->coTx = malloc(dp->maxPayload)) == NULL))
+        return DP_ERROR_GENERAL;
+    if (dp->coLen == 0) {
+        dp->coStartNs = dpnowns();
+        dp->coStream = streamId;
+    }
+    memcpy(dp->coTx + dp->coLen, &len, sizeof(len));
+    memcpy(dp->coTx + dp->coLen + sizeof(len), sbuff, sbuff_sz);
+    dp->coLen += sizeof(len) + sbuff_sz;
+    dp->coMsgs++;
+
+    if (dp->coLen + sizeof(len) >= dp->maxPayload) {
+        if ((rc = dpcoflush(dp)) < 0)
+            return rc;
+    }
+    return sbuff_sz;
+}
+
+static int dpcoflush(dp_connp dp){
+    int len = dp->coLen;
+    int rc;
+
+    dp->coLen = 0;
+    //a lone message goes out as a plain SND
+    if (dp->coMsgs == 1)
+        rc = dpsenddgram(dp, DP_MT_SND, dp->coStream, 
+                dp->coTx + sizeof(uint32_t), len - sizeof(uint32_t));
+    else {
+        rc = dpsenddgram(dp, DP_MT_SND | DP_MT_COALESCE, dp->coStream, dp->coTx, len);
+        dp->stats.coalescedMsgs += dp->coMsgs;
+        dp->stats.coalescedDgrams++;
+    }
+    dp->coMsgs = 0;
+    return (rc < 0) ? rc : DP_NO_ERROR;
+}
+
+//hands out the next message of the coalesced dgram in coRx
+static int dpcosplit(dp_connp dp, void *buff, int buff_sz){
+    uint32_t len;
+
+    if (dp->coRxOff + (int)sizeof(len) > dp->coRxLen) {
+        dp->coRxOff = dp->coRxLen;
+        return DP_ERROR_BAD_DGRAM;
+    }
+    memcpy(&len, dp->coRx + dp->coRxOff, sizeof(len));
+    dp->coRxOff += sizeof(len);
+    if (len > (uint32_t)(dp->coRxLen - dp->coRxOff)) {
+        dp->coRxOff = dp->coRxLen;
+        return DP_ERROR_BAD_DGRAM;
+    }
+    if (len > (uint32_t)buff_sz) {
+        dp->coRxOff += len;
+        return DP_BUFF_UNDERSIZED;
+    }
+    memcpy(buff, dp->coRx + dp->coRxOff, len);
+    dp->coRxOff += len;
+    return len;
+}
+
+/*
+ *  Turns FEC on (grpSz > 1) or off for a connection.  On the client this
+ *  has to happen before dpconnect(), the settings ride on the CONNECT and
+ *  the server adopts them in dplisten().  paritySz may be 0, in which
+ *  case sends are still grouped but every loss costs a NACK round trip.
+ */
+int dpsetfec(dp_connp dp, int grpSz, int paritySz){
+    if (grpSz <= 1) {
+        dpfecfree(dp->fecTx);
+        dpfecfree(dp->fecRx);
+        dp->fecTx = dp->fecRx = NULL;
+        dp->fecK = dp->fecM = 0;
+        return DP_NO_ERROR;
+    }
+    if ((grpSz > DP_FEC_MAX_K) || (paritySz < 0) ||
+        (paritySz > DP_FEC_MAX_M) || (paritySz > grpSz))
+        return DP_ERROR_GENERAL;
+
+    if ((dp->fecTx == NULL) && ((dp->fecTx = dppool_alloc(DP_POOL_FEC_GRP)) != NULL))
+        bzero(dp->fecTx, sizeof(dp_fec_grp));
+    if ((dp->fecRx == NULL) && ((dp->fecRx = dppool_alloc(DP_POOL_FEC_GRP)) != NULL))
+        bzero(dp->fecRx, sizeof(dp_fec_grp));
+    if ((dp->fecTx == NULL) || (dp->fecRx == NULL)) {
+        perror("dpsetfec: cannot allocate FEC groups");
+        return DP_ERROR_GENERAL;
+    }
+    dp->fecK = grpSz;
+    dp->fecM = paritySz;
+    return DP_NO_ERROR;
+}
+
+/*
+ *  Queues one data dgram into the current send group, the group goes out
+ *  once it holds fecK dgrams (or on dpflush()/dprecv()/dpdisconnect()).
+ *  Only a FIN may be empty.
+ */
+static int dpfecsend(dp_connp dp, int mtype, uint32_t streamId, void *sbuff, int sbuff_sz){
+    dp_fec_grp *g = dp->fecTx;
+    int rc;
+
+    if ((sbuff_sz <= 0) && !(mtype & DP_MT_FIN))
+        return 0;
+
+    //a full group that never got through is still queued, it goes first
+    if ((g->count == dp->fecK) && ((rc = dpflush(dp)) < 0))
+        return rc;
+    if (g->count == 0)
+        g->baseSeq = dp->seqNum;
+
+    dp_pdu *outPdu = (dp_pdu *)dpfecslot(g, g->count);
+    if (outPdu == NULL)
+        return DP_ERROR_GENERAL;
+    bzero(outPdu, sizeof(dp_pdu));
+    outPdu->proto_ver = DP_PROTO_VER_1;
+    outPdu->mtype = mtype;
+    outPdu->seqnum = DP_SEQ_WIRE(dp->seqNum);
+    outPdu->dgram_sz = sbuff_sz;
+    outPdu->grp_idx = g->count;
+    outPdu->stream_id = streamId;
+    memcpy(g->dgram[g->count] + sizeof(dp_pdu), sbuff, sbuff_sz);
+
+    g->count++;
+    dp->seqNum += sbuff_sz;
+
+    if (g->count == dp->fecK) {
+        if ((rc = dpflush(dp)) < 0)
+            return rc;
+    }
+    return sbuff_sz;
+}
+
+/*
+ *  Sends the queued FEC group plus its parity and waits for the group
+ *  SND/ACK.  A NACK from the receiver, or no answer at all, sends the
+ *  whole group again.  Does nothing if FEC is off or nothing is queued.
+ */
+int dpflush(dp_connp dp){
+    dp_fec_grp *g = dp->fecTx;
+    int i, rc, tries, total;
+
+    if (dp->coLen > 0)
+        return dpcoflush(dp);
+    if ((dp->fecK <= 1) || (g == NULL) || (g->count == 0))
+        return DP_NO_ERROR;
+
+    //with a short group some stripes would be empty, drop their parity
+    g->stripes = (dp->fecM < g->count) ? dp->fecM : g->count;
+    for (i = 0; i < g->count; i++) {
+        ((dp_pdu *)g->dgram[i])->grp_k = g->count;
+        ((dp_pdu *)g->dgram[i])->grp_m = g->stripes;
+    }
+    if (dpfecparity(dp, g) != DP_NO_ERROR)
+        return DP_ERROR_GENERAL;
+    total = g->count + g->stripes;
+
+    for (tries = 0; tries < DP_FEC_MAX_RETRY; tries++) {
+        uint64_t sentNs = dpnowns();
+        if ((rc = dpsendbatch(dp, g->dgram, total)) < 0)
+            return rc;
+        dp->stats.fecParityOut += g->stripes;
+        if (tries > 0)
+            dp->stats.retransmits += total;
+        //a resend may be down to a path that died, find out
+        if (DP_MP_CLIENT(dp) && (tries > 0) && (dpnowns() >= dp->pathProbeNs))
+            dppathprobe(dp);
+
+        //wait for the group ACK, a NACK or a timeout all end this round
+        while ((rc = dpwaitraw(dp, 2 * dp->fecWaitMs)) > 0) {
+            dp_pdu inPdu = {0};
+            if (dprecvraw(dp, &inPdu, sizeof(inPdu)) < (int)sizeof(dp_pdu))
+                continue;
+            if ((inPdu.mtype == DP_MT_SNDACK) &&
+                (dp_seq_extend(dp->seqNum, inPdu.seqnum) == dp->seqNum)) {
+                dpsample(dp, sentNs, dp->seqNum - g->baseSeq);
+                g->count = 0;
+                dp->stats.fecGroups++;
+                return DP_NO_ERROR;
+            }
+            if ((inPdu.mtype == DP_MT_NACK) &&
+                (dp_seq_extend(g->baseSeq, inPdu.seqnum) == g->baseSeq))
+                break;
+        }
+        if (rc < 0)
+            return rc;
+    }
+
+    printf("ERROR: FEC group at seq %llu was never acknowledged\n",
+        (unsigned long long)g->baseSeq);
+    return DP_ERROR_TIMEOUT;
+}
+
+/*
+ *  Builds the g->stripes parity dgrams for a send group right behind its
+ *  data dgrams, so the whole group sits back to back in memory.
+ */
+static int dpfecparity(dp_connp dp, dp_fec_grp *g){
+    int i, j, b;
+    int m = g->stripes;
+
+    for (j = 0; j < m; j++) {
+        dp_pdu *par = (dp_pdu *)dpfecslot(g, g->count + j);
+        if (par == NULL)
+            return DP_ERROR_GENERAL;
+        char *pp = (char *)par + sizeof(dp_pdu);
+
+        bzero(par, DP_MAX_DGRAM_SZ);
+        par->proto_ver = DP_PROTO_VER_1;
+        par->mtype = DP_MT_PARITY;
+        par->seqnum = DP_SEQ_WIRE(g->baseSeq);
+        par->grp_idx = j;
+        par->grp_k = g->count;
+        par->grp_m = m;
+
+        for (i = j; i < g->count; i += m) {
+            dp_pdu *d = (dp_pdu *)g->dgram[i];
+            char *dp_data = (char *)d + sizeof(dp_pdu);
+
+            for (b = 0; b < d->dgram_sz; b++)
+                pp[b] ^= dp_data[b];
+            par->err_num ^= d->dgram_sz;
+            par->stream_id ^= d->stream_id;
+            if (d->dgram_sz > par->dgram_sz)
+                par->dgram_sz = d->dgram_sz;
+        }
+    }
+    return DP_NO_ERROR;
+}
+
+/*
+ *  Rebuilds any data dgram that is the only one missing from a stripe we
+ *  have the parity for.  Returns true once every data dgram is present.
+ */
+static int dpfecrepair(dp_connp dp, dp_fec_grp *g){
+    int i, j, b, miss, missing, len;
+    uint32_t sid;
+    uint64_t full;
+
+    if (g->count == 0)
+        return false;
+    full = (1ULL << g->count) - 1;
+
+    for (j = 0; (j < g->stripes) && (g->have != full); j++) {
+        if (!(g->parityHave & (1u << j)))
+            continue;
+
+        miss = 0;
+        missing = -1;
+        for (i = j; i < g->count; i += g->stripes) {
+            if (!(g->have & (1ULL << i))) {
+                miss++;
+                missing = i;
+            }
+        }
+        if (miss != 1)
+            continue;
+
+        dp_pdu *par = (dp_pdu *)g->dgram[DP_FEC_PARITY_SLOT(j)];
+        dp_pdu *out = (dp_pdu *)dpfecslot(g, missing);
+        if (out == NULL)
+            return false;
+        char *op = (char *)out + sizeof(dp_pdu);
+
+        memcpy(op, (char *)par + sizeof(dp_pdu), DP_MAX_BUFF_SZ);
+        len = par->err_num;
+        sid = par->stream_id;
+        for (i = j; i < g->count; i += g->stripes) {
+            if (i == missing)
+                continue;
+            dp_pdu *d = (dp_pdu *)g->dgram[i];
+            char *dp_data = (char *)d + sizeof(dp_pdu);
+
+            for (b = 0; b < d->dgram_sz; b++)
+                op[b] ^= dp_data[b];
+            len ^= d->dgram_sz;
+            sid ^= d->stream_id;
+        }
+        //an empty dgram (a FIN) cannot be told apart from nothing, the
+        //group gets NACKed and sent again instead
+        if ((len <= 0) || (len > DP_MAX_BUFF_SZ))
+            continue;
+
+        bzero(out, sizeof(dp_pdu));
+        out->proto_ver = DP_PROTO_VER_1;
+        out->mtype = DP_MT_SND;
+        out->dgram_sz = len;
+        out->grp_idx = missing;
+        out->grp_k = g->count;
+        out->grp_m = g->stripes;
+        out->stream_id = sid;
+        g->have |= (1ULL << missing);
+        dp->stats.fecRecovered++;
+    }
+    return g->have == full;
+}
+
+static int dpfecack(dp_connp dp, int mtype, uint64_t seq){
+    dp_pdu outPdu = {0};
+
+    outPdu.proto_ver = DP_PROTO_VER_1;
+    outPdu.mtype = mtype;
+    outPdu.seqnum = DP_SEQ_WIRE(seq);
+    if (dpsendraw(dp, &outPdu, sizeof(dp_pdu)) != sizeof(dp_pdu))
+        return DP_ERROR_PROTOCOL;
+    return DP_NO_ERROR;
+}
+
+/*
+ *  Returns the buffer for a group slot, taking one from the dgram pool the
+ *  first time a slot is used.  Buffers stay with the group until it goes
+ *  back to the pool in dpfecfree().
+ */
+static char *dpfecslot(dp_fec_grp *g, int slot){
+    if (g->dgram[slot] == NULL)
+        g->dgram[slot] = dppool_alloc(DP_POOL_DGRAM);
+    return g->dgram[slot];
+}
+
+static void dpfecfree(dp_fec_grp *g){
+    int i;
+
+    if (g == NULL)
+        return;
+    for (i = 0; i <= DP_FEC_SPARE_SLOT; i++)
+        dppool_free(DP_POOL_DGRAM, g->dgram[i]);
+    dppool_free(DP_POOL_FEC_GRP, g);
+}
+
+static void dpfecreset(dp_fec_grp *g, uint64_t baseSeq){
+    g->baseSeq = baseSeq;
+    g->count = 0;
+    g->stripes = 0;
+    g->next = 0;
+    g->acked = false;
+    g->have = 0;
+    g->parityHave = 0;
+}
+
+/*
+ *  Receive side of FEC mode.  Collects the dgrams of a group, rebuilds
+ *  what it can from parity, ACKs the group as soon as it is complete and
+ *  then hands the data dgrams to the app one per call, in order.
+ */
+static int dpfecrecv(dp_connp dp, uint32_t *streamId, void *buff, int buff_sz){
+    dp_fec_grp *g = dp->fecRx;
+    dp_pdu *inPdu;
+    char *in, **slot;
+    int i, rc, bytes, tries = 0;
+    uint64_t seq;
+
+    while (1) {
+        //hand out what is left of a group we already acknowledged
+        if (g->acked) {
+            if (g->next < g->count) {
+                dp_pdu *d = (dp_pdu *)g->dgram[g->next++];
+                *streamId = d->stream_id;
+                if (d->mtype & DP_MT_FIN)
+                    return DP_STREAM_CLOSED;
+                if (d->dgram_sz > buff_sz)
+                    return DP_BUFF_UNDERSIZED;
+                memcpy(buff, (char *)d + sizeof(dp_pdu), d->dgram_sz);
+                return d->dgram_sz;
+            }
+            dpfecreset(g, dp->seqNum);
+        }
+        if ((g->have == 0) && (g->parityHave == 0))
+            g->baseSeq = dp->seqNum;
+
+        //block for the first dgram of a group, but not for the rest of it
+        rc = dpwaitraw(dp, ((g->have | g->parityHave) != 0) ? dp->fecWaitMs : -1);
+        if (rc < 0)
+            return rc;
+        if (rc == 0) {
+            if (++tries > DP_FEC_MAX_RETRY)
+                return DP_ERROR_TIMEOUT;
+            dp->stats.fecNacks++;
+            dpfecack(dp, DP_MT_NACK, g->baseSeq);
+            continue;
+        }
+
+        //receive straight into a spare pooled buffer, a dgram we keep just
+        //trades places with the buffer in its slot
+        if ((in = dpfecslot(g, DP_FEC_SPARE_SLOT)) == NULL)
+            return DP_ERROR_GENERAL;
+        inPdu = (dp_pdu *)in;
+        bytes = dprecvraw(dp, in, DP_MAX_DGRAM_SZ);
+        if (bytes < (int)sizeof(dp_pdu))
+            continue;
+
+        if (inPdu->mtype == DP_MT_CLOSE) {
+            dp->seqNum++;
+            if (dpfecack(dp, DP_MT_CLOSEACK, dp->seqNum) != DP_NO_ERROR)
+                return DP_ERROR_PROTOCOL;
+            dpclose(dp);
+            return DP_CONNECTION_CLOSED;
+        }
+        if ((inPdu->mtype != DP_MT_SND) && (inPdu->mtype != (DP_MT_SND | DP_MT_FIN)) &&
+            (inPdu->mtype != DP_MT_PARITY)) {
+            printf("ERROR: Unexpected or bad mtype in header %d\n", inPdu->mtype);
+            return DP_ERROR_PROTOCOL;
+        }
+
+        seq = dp_seq_extend(g->baseSeq, inPdu->seqnum);
+        if (seq < g->baseSeq) {
+            //resend of a group we already took, our ACK must have been lost
+            dpfecack(dp, DP_MT_SNDACK, dp->seqNum);
+            continue;
+        }
+        if ((inPdu->grp_k == 0) || (inPdu->grp_k > DP_FEC_MAX_K) ||
+            (inPdu->grp_m > DP_FEC_MAX_M) || (inPdu->dgram_sz < 0) ||
+            (inPdu->dgram_sz > DP_MAX_BUFF_SZ) ||
+            (bytes != (int)sizeof(dp_pdu) + inPdu->dgram_sz))
+            continue;
+
+        g->count = inPdu->grp_k;
+        g->stripes = inPdu->grp_m;
+        if (inPdu->mtype != DP_MT_PARITY) {
+            if ((inPdu->grp_idx >= g->count) || (g->have & (1ULL << inPdu->grp_idx)))
+                continue;
+            slot = &g->dgram[inPdu->grp_idx];
+            g->have |= (1ULL << inPdu->grp_idx);
+        } else {
+            if ((inPdu->grp_idx >= g->stripes) || (g->parityHave & (1u << inPdu->grp_idx)))
+                continue;
+            //parity is XORed over the full buffer, it has to be zero padded
+            bzero(in + bytes, DP_MAX_DGRAM_SZ - bytes);
+            slot = &g->dgram[DP_FEC_PARITY_SLOT(inPdu->grp_idx)];
+            g->parityHave |= (1u << inPdu->grp_idx);
+        }
+        g->dgram[DP_FEC_SPARE_SLOT] = *slot;
+        *slot = in;
+
+        if (dpfecrepair(dp, g)) {
+            dp->seqNum = g->baseSeq;
+            for (i = 0; i < g->count; i++)
+                dp->seqNum += ((dp_pdu *)g->dgram[i])->dgram_sz;
+            if (dpfecack(dp, DP_MT_SNDACK, dp->seqNum) != DP_NO_ERROR)
+                return DP_ERROR_PROTOCOL;
+            g->acked = true;
+            g->next = 0;
+            tries = 0;
+            dp->stats.fecGroups++;
+        }
+    }
+}
+
+/*
+ *  Sets the send pacing rate in bytes/sec.  DP_PACE_OFF turns pacing off,
+ *  DP_PACE_AUTO derives the rate from the measured delivery rate (there is
+ *  nothing to pace against until the first ACK).  burst <= 0 picks
+ *  DP_PACE_DEF_BURST.
+ */
+int dpsetpacing(dp_connp dp, int64_t bytesPerSec, int burst){
+    if (bytesPerSec < DP_PACE_AUTO)
+        return DP_ERROR_GENERAL;
+
+    dp->pacer.autoRate = (bytesPerSec == DP_PACE_AUTO);
+    dp->pacer.rateBps = bytesPerSec;
+    if (dp->pacer.autoRate)
+        dp->pacer.rateBps = (dp->deliveryBps > 0) ? 
+            (int64_t)(DP_PACE_GAIN * dp->deliveryBps) : 0;
+    dp->pacer.burst = (burst > 0) ? burst : DP_PACE_DEF_BURST;
+    dp->pacer.tokens = dp->pacer.burst;
+    dp->pacer.lastNs = dpnowns();
+    return DP_NO_ERROR;
+}
+
+static uint64_t dpnowns(){
+    struct timespec ts;
+
+    if (_dpClock != NULL)
+        return _dpClock->now(_dpClock->ctx);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+/*
+ *  Points this thread's du-proto clock at clock, NULL goes back to the
+ *  system clocks.  Every connection the thread drives follows it.
+ */
+void dpsetclock(const dp_clock *clock){
+    _dpClock = clock;
+}
+
+//turns the per dgram trace and the stats printed on dpclose() on or off
+void dpsetdebug(int on){
+    _debugMode = on ? 1 : 0;
+}
+
+/*
+ *  Token bucket, holds the caller until bytes worth of tokens are there.
+ *  Long waits sleep, the last DP_PACE_SPIN_NS is spun so dgrams leave on
+ *  time instead of whenever the scheduler wakes us up.
+ */
+static void dppace(dp_connp dp, int bytes){
+    dp_pacer *pc = &dp->pacer;
+    uint64_t now = dpnowns();
+    uint64_t start = now;
+    uint64_t waitNs;
+
+    pc->tokens += (double)(now - pc->lastNs) * pc->rateBps / 1e9;
+    if (pc->tokens > pc->burst)
+        pc->tokens = pc->burst;
+    pc->lastNs = now;
+
+    if (pc->tokens < bytes) {
+        waitNs = (uint64_t)((bytes - pc->tokens) * 1e9 / pc->rateBps);
+        if (_dpClock != NULL)
+            _dpClock->sleep(_dpClock->ctx, waitNs);
+        else if (waitNs > DP_PACE_SPIN_NS) {
+            struct timespec ts;
+            ts.tv_sec = (waitNs - DP_PACE_SPIN_NS) / 1000000000ULL;
+            ts.tv_nsec = (waitNs - DP_PACE_SPIN_NS) % 1000000000ULL;
+            nanosleep(&ts, NULL);
+        }
+        while ((now = dpnowns()) - start < waitNs)
+            ;
+        pc->tokens += (double)(now - pc->lastNs) * pc->rateBps / 1e9;
+        pc->lastNs = now;
+        dp->stats.paceWaits++;
+        dp->stats.paceWaitNs += now - start;
+    }
+    pc->tokens -= bytes;
+}
+
+/*
+ *  Takes a delivery rate sample from bytes that were sent at sentNs and
+ *  just got acknowledged.  In auto mode the pacer follows the delivery
+ *  rate, and socket buffer sizing works from it too.
+ */
+static void dpsample(dp_connp dp, uint64_t sentNs, uint64_t bytes){
+    uint64_t elapsed = dpnowns() - sentNs;
+    uint64_t rate;
+
+    //the RTT comes from the timestamp echo, see dpechoed()
+    if (elapsed == 0)
+        return;
+
+    rate = bytes * 1000000000ULL / elapsed;
+    dp->deliveryBps = (dp->deliveryBps == 0) ? rate : (7 * dp->deliveryBps + rate) / 8;
+
+    if (dp->pacer.autoRate) {
+        dp->pacer.rateBps = (int64_t)(DP_PACE_GAIN * dp->deliveryBps);
+        if (dp->pacer.rateBps < DP_PACE_MIN_BPS)
+            dp->pacer.rateBps = DP_PACE_MIN_BPS;
+    }
+    if (dp->bufMin > 0)
+        dpsizebufs(dp);
+}
+
+/*
+ *  Microseconds since the epoch, cut to 32 bits.  Only ever subtracted
+ *  from another value of this clock, so the wrap does not matter.
+ */
+static uint32_t dpwallus(){
+    struct timespec ts;
+
+    if (_dpClock != NULL)
+        return (uint32_t)(_dpClock->now(_dpClock->ctx) / 1000);
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint32_t)(((uint64_t)ts.tv_sec * 1000000ULL) + (ts.tv_nsec / 1000));
+}
+
+//stamps a dgram on its way out, a zero ts_val means "none" to the peer
+static void dpstamp(dp_connp dp, dp_pdu *pdu){
+    pdu->ts_val = dpwallus();
+    if (pdu->ts_val == 0)
+        pdu->ts_val = 1;
+    pdu->ts_ecr = dp->tsRecent;
+    if (dp->kernTs) {
+        dp_txstamp *t = &dp->txStamps[dp->txId % DP_TS_RING];
+        t->id = dp->txId;
+        t->tsVal = pdu->ts_val;
+        t->kernNs = 0;
+    }
+}
+
+/*
+ *  Looks at the timestamps of a dgram from the peer.  Its ts_val is what
+ *  we echo next, and if it is an ACK its ts_ecr gives an RTT sample (not a
+ *  NACK, the peer sat on that one for its FEC timeout).  With kernel
+ *  timestamps the sample runs from the kernel sending the dgram the peer
+ *  echoed to the kernel receiving this one, when the kernel stamped that
+ *  send and this receive.
+ */
+static void dpechoed(dp_connp dp, dp_pdu *pdu){
+    uint32_t rxUs, txUs;
+    _Bool kern = false;
+    int i;
+
+    if (dp->kernTs)
+        dperrqueue(dp);
+    if (pdu->ts_val != 0)
+        dp->tsRecent = pdu->ts_val;
+
+    rxUs = dpwallus();
+    if (dp->rxKernNs != 0) {
+        uint32_t kernUs = (uint32_t)(dp->rxKernNs / 1000);
+        if ((int32_t)(rxUs - kernUs) >= 0) {
+            dp->stats.rxStackNs += (uint64_t)(rxUs - kernUs) * 1000;
+            dp->stats.rxStackCnt++;
+        }
+        rxUs = kernUs;
+    }
+
+    if (!(pdu->mtype & DP_MT_ACK) || (pdu->ts_ecr == 0))
+        return;
+    txUs = pdu->ts_ecr;
+    for (i = 0; dp->kernTs && (i < DP_TS_RING); i++) {
+        dp_txstamp *t = &dp->txStamps[i];
+        uint32_t kernUs = (uint32_t)(t->kernNs / 1000);
+
+        if ((t->kernNs == 0) || (t->tsVal != txUs) || ((int32_t)(kernUs - txUs) < 0))
+            continue;
+        dp->stats.txStackNs += (uint64_t)(kernUs - txUs) * 1000;
+        dp->stats.txStackCnt++;
+        t->kernNs = 0;
+        txUs = kernUs;
+        kern = (dp->rxKernNs != 0);
+        break;
+    }
+    dprtt(dp, rxUs - txUs, kern);
+}
+
+//feeds one RTT sample to the estimator, the usual RFC 6298 smoothing,
+//and the stats
+static void dprtt(dp_connp dp, uint32_t rttUs, _Bool kern){
+    int b;
+
+    //the wall clock stepped back under us
+    if ((int32_t)rttUs < 0)
+        return;
+    if (rttUs == 0)
+        rttUs = 1;
+
+    if (dp->srttUs == 0) {
+        dp->srttUs = rttUs;
+        dp->rttvarUs = rttUs / 2;
+    } else {
+        uint32_t err = (rttUs > dp->srttUs) ? rttUs - dp->srttUs : dp->srttUs - rttUs;
+        dp->rttvarUs = (3 * dp->rttvarUs + err) / 4;
+        dp->srttUs = (7 * dp->srttUs + rttUs) / 8;
+    }
+
+    for (b = 0; (b < DP_RTT_BUCKETS - 1) && (rttUs >> (b + 1)); b++)
+        ;
+    dp->stats.rttHist[b]++;
+    if ((dp->stats.rttSamples == 0) || (rttUs < dp->stats.rttMinUs))
+        dp->stats.rttMinUs = rttUs;
+    if (rttUs > dp->stats.rttMaxUs)
+        dp->stats.rttMaxUs = rttUs;
+    dp->stats.rttSamples++;
+    if (kern)
+        dp->stats.kernRttSamples++;
+}
+
+/*
+ *  Turns kernel (software) send and receive timestamps on or off for a
+ *  UDP connection.  Send times come back on the socket error queue, tagged
+ *  with a per socket count of sends (SOF_TIMESTAMPING_OPT_ID) that txId
+ *  tracks.  A run of dgrams sent in one sendmsg() (GSO) shares one time.
+ *  Not available on the io_uring backend, its receives carry no control
+ *  messages.
+ */
+int dpsettimestamps(dp_connp dp, int on){
+#ifdef SO_TIMESTAMPING
+    int flags = 0;
+
+    if (!on && !dp->kernTs)
+        return DP_NO_ERROR;
+    if ((dp->udp_sock < 0) || (dp->inSockAddr.addr.sa.sa_family != AF_INET) ||
+        (dp->uring != NULL))
+        return on ? DP_ERROR_GENERAL : DP_NO_ERROR;
+
+    if (on)
+        flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_TX_SOFTWARE |
+                SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_OPT_ID |
+                SOF_TIMESTAMPING_OPT_TSONLY;
+    if (setsockopt(dp->udp_sock, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0) {
+        perror("setsockopt(SO_TIMESTAMPING) failed");
+        return DP_ERROR_GENERAL;
+    }
+    //the kernel starts counting sends from 0 when OPT_ID goes on
+    if (on && !dp->kernTs)
+        dp->txId = 0;
+    dp->kernTs = on;
+    bzero(dp->txStamps, sizeof(dp->txStamps));
+    return DP_NO_ERROR;
+#else
+    return on ? DP_ERROR_GENERAL : DP_NO_ERROR;
+#endif
+}
+
+/*
+ *  Empties the socket error queue, send timestamps go into txStamps and
+ *  zerocopy completions hand their PDUs back to the pool.
+ */
+static void dperrqueue(dp_connp dp){
+#ifdef SO_TIMESTAMPING
+    char ctrl[CMSG_SPACE(3 * sizeof(struct timespec)) + 
+              CMSG_SPACE(sizeof(struct sock_extended_err) + sizeof(struct sockaddr_in))];
+    struct msghdr msg;
+    struct cmsghdr *cm;
+    struct sock_extended_err ee;
+    struct timespec ts;
+    _Bool haveTs, haveId;
+
+    while (1) {
+        bzero(&msg, sizeof(msg));
+        msg.msg_control = ctrl;
+        msg.msg_controllen = sizeof(ctrl);
+        if (recvmsg(dp->udp_sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+            return;
+
+        haveTs = haveId = false;
+        for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+            if ((cm->cmsg_level == SOL_SOCKET) && (cm->cmsg_type == SO_TIMESTAMPING)) {
+                memcpy(&ts, CMSG_DATA(cm), sizeof(ts));
+                haveTs = true;
+            } else if ((cm->cmsg_level == SOL_IP) && (cm->cmsg_type == IP_RECVERR)) {
+                memcpy(&ee, CMSG_DATA(cm), sizeof(ee));
+                haveId = (ee.ee_errno == ENOMSG) && 
+                         (ee.ee_origin == SO_EE_ORIGIN_TIMESTAMPING);
+#ifdef SO_EE_ORIGIN_ZEROCOPY
+                //ee_info..ee_data is the range of zerocopy sends done with
+                if ((ee.ee_errno == 0) && (ee.ee_origin == SO_EE_ORIGIN_ZEROCOPY))
+                    dpzcdone(dp, ee.ee_info, ee.ee_data, 
+                             ee.ee_code & SO_EE_CODE_ZEROCOPY_COPIED);
+#endif
+            }
+        }
+        if (haveTs && haveId && (dp->txStamps[ee.ee_data % DP_TS_RING].id == ee.ee_data))
+            dp->txStamps[ee.ee_data % DP_TS_RING].kernNs = 
+                ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+    }
+#endif
+}
+
+//recvfrom() that also picks up the kernel receive time and drop count
+static int dprecvcmsg(dp_connp dp, void *buff, int buff_sz, dp_addr *from, socklen_t *fromLen){
+#ifdef SO_TIMESTAMPING
+    struct iovec iov = {buff, buff_sz};
+    struct msghdr msg = {0};
+    char ctrl[CMSG_SPACE(3 * sizeof(struct timespec)) + CMSG_SPACE(sizeof(uint32_t))];
+    struct cmsghdr *cm;
+    struct timespec ts;
+    int bytes;
+
+    msg.msg_name = &(from->sa);
+    msg.msg_namelen = *fromLen;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl;
+    msg.msg_controllen = sizeof(ctrl);
+
+    bytes = recvmsg(dp->udp_sock, &msg, MSG_WAITALL);
+    if (bytes < 0)
+        return bytes;
+    *fromLen = msg.msg_namelen;
+    for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+        if ((cm->cmsg_level == SOL_SOCKET) && (cm->cmsg_type == SO_TIMESTAMPING)) {
+            memcpy(&ts, CMSG_DATA(cm), sizeof(ts));
+            dp->rxKernNs = ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+        }
+#ifdef SO_RXQ_OVFL
+        if ((cm->cmsg_level == SOL_SOCKET) && (cm->cmsg_type == SO_RXQ_OVFL)) {
+            uint32_t drops;
+            memcpy(&drops, CMSG_DATA(cm), sizeof(drops));
+            dp->stats.rxqDrops = drops;
+        }
+#endif
+    }
+    return bytes;
+#else
+    return recvfrom(dp->udp_sock, (char *)buff, buff_sz, MSG_WAITALL, &(from->sa), fromLen);
+#endif
+}
+
+/*
+ *  Waits up to timeout_ms (-1 forever) for a dgram to arrive.  Returns 1 if
+ *  one is ready, 0 on timeout.  With timers on this thread's wheel the
+ *  wait is cut into naps that end when the next one may be due, and it
+ *  fails with DP_ERROR_TIMEOUT once dp's peer has been quiet for idleMs.
+ */
+static int dpwaitraw(dp_connp dp, int timeout_ms){
+    uint64_t start, now;
+    int rc, nap, left;
+
+    //split GRO dgrams still waiting to be handed out
+    if (dp->groOff < dp->groLen)
+        return 1;
+
+    start = now = dpnowns();
+    do {
+        dpwheel_run(&_dpWheel, now);
+        if (dp->idleOut) {
+            dp->stats.idleTimeouts++;
+            return DP_ERROR_TIMEOUT;
+        }
+        nap = dpwheel_wait(&_dpWheel, now);
+        left = (timeout_ms < 0) ? -1 : timeout_ms - (int)((now - start) / 1000000);
+        if ((timeout_ms >= 0) && (left < 0))
+            left = 0;
+        if ((nap < 0) || ((left >= 0) && (left < nap)))
+            nap = left;
+
+        if ((rc = dp->xport->poll(dp, nap)) < 0) {
+            perror("dpwaitraw: transport poll failed");
+            return DP_ERROR_GENERAL;
+        }
+        now = dpnowns();
+    } while ((rc == 0) && (nap != left));
+    return rc;
+}
+
+void * dp_prepare_send(dp_pdu *pdu_ptr, void *buff, int buff_sz) {
+    if (buff_sz < sizeof(dp_pdu)) {
+        perror("Expected CNTACT Message but didnt get it");
+        return NULL;
+    }
+    bzero(buff, buff_sz);
+    memcpy(buff, pdu_ptr, sizeof(dp_pdu));
+
+    return buff + sizeof(dp_pdu);
+}
+
+
+//// MISC HELPERS
+void print_out_pdu(dp_pdu *pdu) {
+    if (_debugMode != 1)
+        return;
+    printf("PDU DETAILS ===>  [OUT]\n");
+    print_pdu_details(pdu);
+}
+void print_in_pdu(dp_pdu *pdu) {
+    if (_debugMode != 1)
+        return;
+    printf("===> PDU DETAILS  [IN]\n");
+    print_pdu_details(pdu);
 }
 static void print_pdu_details(dp_pdu *pdu){
     
     printf("\tVersion:  %d\n", pdu->proto_ver);
     printf("\tMsg Type: %s\n", pdu_msg_to_string(pdu));
     printf("\tMsg Size: %d\n", pdu->dgram_sz);
-    printf("\tSeq Numb: %d\n", pdu->seqnum);
+    printf("\tSeq Numb: %u\n", pdu->seqnum);
+    if (pdu->stream_id != DP_STREAM_DEFAULT)
+        printf("\tStream:   %u\n", pdu->stream_id);
+    if (pdu->grp_k > 0)
+        printf("\tFEC Grp:  idx %d of %d, %d parity\n", 
+            pdu->grp_idx, pdu->grp_k, pdu->grp_m);
+    printf("\n");
+}
+
+void print_dp_stats(dp_connp dp) {
+    int i;
+
+    printf("DP STATS ===========================\n");
+    printf("\tDgrams Out:   %llu (%llu bytes)\n", 
+        (unsigned long long)dp->stats.dgramsOut, 
+        (unsigned long long)dp->stats.bytesOut);
+    printf("\tDgrams In:    %llu (%llu bytes)\n", 
+        (unsigned long long)dp->stats.dgramsIn, 
+        (unsigned long long)dp->stats.bytesIn);
+    printf("\tRetransmits:  %llu\n", (unsigned long long)dp->stats.retransmits);
+    if (dp->fecK > 1) {
+        printf("\tFEC Group:    %d data + %d parity (%.1f%% overhead)\n",
+            dp->fecK, dp->fecM, 100.0 * dp->fecM / dp->fecK);
+        printf("\tFEC Groups:   %llu\n", (unsigned long long)dp->stats.fecGroups);
+        printf("\tParity Out:   %llu\n", (unsigned long long)dp->stats.fecParityOut);
+        printf("\tRecovered:    %llu\n", (unsigned long long)dp->stats.fecRecovered);
+        printf("\tNACKs:        %llu\n", (unsigned long long)dp->stats.fecNacks);
+    }
+    if (dp->srttUs > 0)
+        printf("\tSRTT:         %u us (var %u us), %llu bytes/sec delivered\n",
+            dp->srttUs, dp->rttvarUs, (unsigned long long)dp->deliveryBps);
+    if (dp->stats.rttSamples > 0) {
+        printf("\tRTT Samples:  %llu (%llu kernel), min %u us, max %u us\n",
+            (unsigned long long)dp->stats.rttSamples,
+            (unsigned long long)dp->stats.kernRttSamples,
+            dp->stats.rttMinUs, dp->stats.rttMaxUs);
+        for (i = 0; i < DP_RTT_BUCKETS; i++) {
+            if (dp->stats.rttHist[i] == 0)
+                continue;
+            if (i < DP_RTT_BUCKETS - 1)
+                printf("\t  < %7u us: %llu\n", 2u << i, (unsigned long long)dp->stats.rttHist[i]);
+            else
+                printf("\t  >= %6u us: %llu\n", 1u << i, (unsigned long long)dp->stats.rttHist[i]);
+        }
+    }
+    if ((dp->stats.txStackCnt > 0) || (dp->stats.rxStackCnt > 0))
+        printf("\tStack Delay:  send %llu us, receive %llu us (avg)\n",
+            (unsigned long long)(dp->stats.txStackCnt ? 
+                dp->stats.txStackNs / dp->stats.txStackCnt / 1000 : 0),
+            (unsigned long long)(dp->stats.rxStackCnt ? 
+                dp->stats.rxStackNs / dp->stats.rxStackCnt / 1000 : 0));
+    if (dp->pacer.rateBps != 0)
+        printf("\tPacing:       %lld bytes/sec%s, held %llu sends for %llu us\n",
+            (long long)dp->pacer.rateBps, dp->pacer.autoRate ? " (auto)" : "",
+            (unsigned long long)dp->stats.paceWaits,
+            (unsigned long long)(dp->stats.paceWaitNs / 1000));
+    if (dp->pmtud)
+        printf("\tPath MTU:     %d byte payload, %llu probes (%llu lost), %llu drops\n",
+            dp->maxPayload, (unsigned long long)dp->stats.pmtuProbes,
+            (unsigned long long)dp->stats.pmtuLost, (unsigned long long)dp->stats.pmtuDrops);
+    if (dp->bufMin > 0) {
+        int snd = 0, rcv = 0;
+        socklen_t len = sizeof(int);
+
+        //the kernel reports twice what it lets the queue hold
+        getsockopt(dp->udp_sock, SOL_SOCKET, SO_SNDBUF, &snd, &len);
+        len = sizeof(int);
+        getsockopt(dp->udp_sock, SOL_SOCKET, SO_RCVBUF, &rcv, &len);
+        printf("\tSock Bufs:    send %d, receive %d bytes, %llu resizes\n",
+            snd / 2, rcv / 2, (unsigned long long)dp->stats.bufResizes);
+    }
+    if (dp->busyPollUs > 0)
+        printf("\tBusy Poll:    %d us spins on cpu %d, %llu hits, %llu sleeps, %llu us spinning\n",
+            dp->busyPollUs, dp->busyCpu, (unsigned long long)dp->stats.busyHits,
+            (unsigned long long)dp->stats.busySleeps,
+            (unsigned long long)(dp->stats.busySpinNs / 1000));
+    if (dp->zcMin > 0)
+        printf("\tZerocopy:     %llu sends, %llu copied by the kernel, %llu waits timed out\n",
+            (unsigned long long)dp->stats.zcSends, (unsigned long long)dp->stats.zcCopied,
+            (unsigned long long)dp->stats.zcTimeouts);
+    if (dp->cookies)
+        printf("\tCookies:      %llu sent, %llu bad\n",
+            (unsigned long long)dp->stats.cookiesSent,
+            (unsigned long long)dp->stats.cookiesBad);
+    if (dp->stats.earlyBytes || dp->stats.earlyResent)
+        printf("\t0-RTT:        %llu bytes taken, %llu resent\n",
+            (unsigned long long)dp->stats.earlyBytes,
+            (unsigned long long)dp->stats.earlyResent);
+    if (dp->pathCnt > 1) {
+        printf("\tPaths:        %d, %llu probes\n", dp->pathCnt,
+            (unsigned long long)dp->stats.pathProbes);
+        for (i = 0; i < dp->pathCnt; i++) {
+            dp_path *p = &dp->path[i];
+            char ip[INET_ADDRSTRLEN] = "?";
+
+            inet_ntop(AF_INET, &p->addr.in.sin_addr, ip, sizeof(ip));
+            if (p->sock < 0)
+                printf("\t  %d: %s:%d, %llu dgrams\n", i, ip, ntohs(p->addr.in.sin_port),
+                    (unsigned long long)p->dgrams);
+            else
+                printf("\t  %d: %s:%d, %llu dgrams, srtt %u us, %.0f%% loss%s\n", i, ip,
+                    ntohs(p->addr.in.sin_port), (unsigned long long)p->dgrams, p->srttUs,
+                    100.0 * p->loss, p->joined ? "" : ", never joined");
+        }
+    }
+    if (dp->keepMs || dp->idleMs)
+        printf("\tKeepalive:    every %d ms, idle after %d ms, %llu sent, %llu idle timeouts\n",
+            dp->keepMs, dp->idleMs, (unsigned long long)dp->stats.keepalives,
+            (unsigned long long)dp->stats.idleTimeouts);
+    if (dp->rxqOvfl)
+        printf("\tKernel Drops: %llu (receive queue full)\n",
+            (unsigned long long)dp->stats.rxqDrops);
+    if (dp->gsoOn || dp->groOn) {
+        printf("\tGSO Sends:    %llu\n", (unsigned long long)dp->stats.gsoSends);
+        printf("\tGRO Recvs:    %llu\n", (unsigned long long)dp->stats.groRecvs);
+    }
+    if (dp->uring != NULL) {
+        printf("\tRing Enters:  %llu\n", 
+            (unsigned long long)dpuring_enters(dp->uring));
+    }
+    if (dp->stats.coalescedDgrams > 0)
+        printf("\tCoalesced:    %llu msgs in %llu dgrams\n", 
+            (unsigned long long)dp->stats.coalescedMsgs,
+            (unsigned long long)dp->stats.coalescedDgrams);
+    if (dp->stats.sendDrops > 0)
+        printf("\tSend Drops:   %llu (peer queue full)\n", 
+            (unsigned long long)dp->stats.sendDrops);
+    if (dp->stats.batchSends > 0)
+        printf("\tBatch Sends:  %llu (%s)\n", 
+            (unsigned long long)dp->stats.batchSends, dp->xport->name);
     printf("\n");
 }
 
+/*
+ *  Rebuilds a full 64 bit sequence number from the 32 bits carried in a
+ *  PDU.  The result is the value with those low bits that is closest to
+ *  ref (normally the seq number we expect next), which keeps working
+ *  across the 4GB wrap as long as the two sides are within 2GB.
+ */
+static uint64_t dp_seq_extend(uint64_t ref, uint32_t wire) {
+    uint64_t seq = (ref & ~(uint64_t)0xFFFFFFFF) | wire;
+
+    if ((seq > ref) && (seq - ref > 0x80000000ULL) && (seq >= 0x100000000ULL))
+        seq -= 0x100000000ULL;
+    else if ((ref > seq) && (ref - seq > 0x80000000ULL))
+        seq += 0x100000000ULL;
+    return seq;
+}
+
+/*
+ *  Wraparound safe "a comes before b" for 32 bit wire seq numbers
+ */
+static int dp_seq_before(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
 static char * pdu_msg_to_string(dp_pdu *pdu) {
     switch(pdu->mtype){
         case DP_MT_ACK:
@@ -478,6 +3409,26 @@ static char * pdu_msg_to_string(dp_pdu *pdu) {
             return "CONNECT/ACK";    
         case DP_MT_CLOSEACK:
             return "CLOSE/ACK";
+        case DP_MT_PARITY:
+            return "PARITY";
+        case DP_MT_SND | DP_MT_COALESCE:
+            return "SEND (COALESCED)";
+        case DP_MT_SND | DP_MT_FIN:
+            return "SEND (FIN)";
+        case DP_MT_PROBE:
+            return "PROBE";
+        case DP_MT_PROBE | DP_MT_ACK:
+            return "PROBE/ACK";
+        case DP_MT_COOKIE:
+            return "COOKIE";
+        case DP_MT_KEEPALIVE:
+            return "KEEPALIVE";
+        case DP_MT_KEEPALIVE | DP_MT_ACK:
+            return "KEEPALIVE/ACK";
+        case DP_MT_PATH:
+            return "PATH";
+        case DP_MT_PATH | DP_MT_ACK:
+            return "PATH/ACK";
         default:
             return "***UNKNOWN***";  
     }
@@ -498,16 +3449,21 @@ static char * pdu_msg_to_string(dp_pdu *pdu) {
  *              dprand(99) will return true 99% of the time
  */
 int dprand(int threshold){
+    static _Bool seeded = false;
 
     if (threshold < 1)
         return 0;
     if (threshold > 99)
         return 1;
-    //initialize randome number seed
-    srand(time(0));
+    //initialize randome number seed, once - reseeding every call with the
+    //time would hand back the same answer for a whole second
+    if (!seeded) {
+        srand(time(0) ^ getpid());
+        seeded = true;
+    }
 
     int rndInRange = (rand() % (100-1+1)) + 1;
-    if (threshold < rndInRange)
+    if (rndInRange <= threshold)
         return 1;
     else
         return 0;
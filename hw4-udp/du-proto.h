@@ -1,22 +1,269 @@
 #pragma once
 
+#include <stdint.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <arpa/inet.h>
 
+#include "du-wheel.h"
+
+
+//a peer address on any of the transports, see dp_xport
+typedef union dp_addr{
+    struct sockaddr    sa;
+    struct sockaddr_in in;
+    struct sockaddr_un un;
+} dp_addr;
 
 struct dp_sock{
     socklen_t          len;
     _Bool              isAddrInit;
-    struct sockaddr_in addr;
+    dp_addr            addr;
 };
 
+//RTT histogram, bucket b counts samples under 2^(b+1) us, the last
+//bucket takes everything slower
+#define     DP_RTT_BUCKETS          20
+
+typedef struct dp_stats{
+    uint64_t           dgramsOut;
+    uint64_t           dgramsIn;
+    uint64_t           bytesOut;
+    uint64_t           bytesIn;
+    uint64_t           retransmits;     //dgrams sent again after NACK/timeout
+    uint64_t           fecGroups;       //FEC groups acknowledged
+    uint64_t           fecParityOut;    //parity dgrams sent
+    uint64_t           fecRecovered;    //data dgrams rebuilt from parity
+    uint64_t           fecNacks;        //groups we could not rebuild
+    uint64_t           gsoSends;        //multi dgram sends handed to UDP GSO
+    uint64_t           groRecvs;        //receives the kernel coalesced (GRO)
+    uint64_t           batchSends;      //multi dgram transport sends (io_uring, rings)
+    uint64_t           coalescedMsgs;   //dpsend()s that shared a dgram
+    uint64_t           coalescedDgrams;
+    uint64_t           sendDrops;       //dgrams a full peer (Unix, ring) would not take
+    uint64_t           strays;          //dgrams from someone other than the peer
+    uint64_t           paceWaits;       //sends the pacer held back
+    uint64_t           paceWaitNs;      //total time spent held back
+    uint64_t           rttSamples;      //from timestamp echoes, see dprtt()
+    uint64_t           kernRttSamples;  //of those, taken with kernel timestamps
+    uint32_t           rttMinUs;
+    uint32_t           rttMaxUs;
+    uint64_t           rttHist[DP_RTT_BUCKETS];
+    uint64_t           txStackNs;       //dgram built until the kernel sent it
+    uint64_t           txStackCnt;
+    uint64_t           rxStackNs;       //kernel got it until we read it
+    uint64_t           rxStackCnt;
+    uint64_t           pmtuProbes;      //path MTU probes sent
+    uint64_t           pmtuLost;        //of those, never answered
+    uint64_t           pmtuDrops;       //times the payload had to come down
+    uint64_t           bufResizes;      //socket buffers grown, see dpsizebufs()
+    uint64_t           rxqDrops;        //socket total the kernel dropped, receive queue full
+    uint64_t           busyHits;        //waits a busy poll spin answered
+    uint64_t           busySleeps;      //waits that spun out and slept
+    uint64_t           busySpinNs;      //total time spent spinning
+    uint64_t           zcSends;         //MSG_ZEROCOPY sends, see dpsetzerocopy()
+    uint64_t           zcCopied;        //of those, the kernel copied after all
+    uint64_t           zcTimeouts;      //sends we gave up waiting to complete
+    uint64_t           cookiesSent;     //CONNECTs answered with a cookie, see dpsetcookies()
+    uint64_t           cookiesBad;      //of those echoed back, wrong or expired
+    uint64_t           keepalives;      //KEEPALIVEs sent, see dpsetkeepalive()
+    uint64_t           idleTimeouts;    //waits given up on a quiet peer
+    uint64_t           pathProbes;      //PATH probes sent, see dpaddpath()
+    uint64_t           earlyBytes;      //0-RTT bytes taken with a CONNECT, see dpconnectdata()
+    uint64_t           earlyResent;     //0-RTT payloads the server left for a dpsend()
+} dp_stats;
+
+/*
+ * Token bucket send pacing, applied to every dgram in dpsendraw().  The
+ * bucket fills at rateBps up to burst bytes and a send waits until the
+ * bucket holds its size.  With autoRate the rate follows the measured
+ * delivery rate (times DP_PACE_GAIN so it can still grow).
+ */
+typedef struct dp_pacer{
+    int64_t            rateBps;         //bytes per second, 0 = not pacing
+    _Bool              autoRate;
+    int                burst;           //bucket depth in bytes
+    double             tokens;          //bytes we may send right now
+    uint64_t           lastNs;          //when tokens was last refilled
+} dp_pacer;
+
+//the last DP_TS_RING sends, matching kernel send times up with ts_val
+#define     DP_TS_RING              64
+
+typedef struct dp_txstamp{
+    uint32_t           id;              //txId of the send
+    uint32_t           tsVal;
+    uint64_t           kernNs;          //0 until the kernel reports it
+} dp_txstamp;
+
+//MSG_ZEROCOPY sends the kernel may still be reading from
+#define     DP_ZC_RING              16
+
+typedef struct dp_zcslot{
+    uint32_t           id;              //the kernel's count of zerocopy sends
+    char               *hdr;            //pooled PDU, NULL when the slot is free
+} dp_zcslot;
+
+/*
+ * Multipath.  A client can add paths with dpaddpath(), each an extra UDP
+ * socket bound to a local address and/or port, path 0 is the socket it
+ * was created with.  The server hands out a token in the CONNECT/ACK
+ * (err_num and stream_id), a DP_MT_PATH carrying it from a new address
+ * adds that address to the session's paths.  The server answers a dgram
+ * on the path it came in on, so every path gets its own ACKs.
+ *
+ * The client sends PATH probes on every path each DP_PATH_PROBE_MS while
+ * it is sending.  The answer is that path's RTT, a probe still out at the
+ * next round counts as lost (smoothed by DP_PATH_LOSS_GAIN).  A dgram
+ * goes on the path with the lowest RTT for what gets through, srtt /
+ * (1 - loss), and the dgrams of a FEC group are spread over the paths in
+ * that proportion.  The FEC receiver already puts a group together by
+ * seq number, so the order they arrive in does not matter.  Paths losing
+ * more than DP_PATH_DEAD_LOSS are left out while any other is up.
+ */
+#define     DP_MAX_PATHS            4
+#define     DP_PATH_PROBE_MS        50
+#define     DP_PATH_LOSS_GAIN       0.25
+#define     DP_PATH_DEAD_LOSS       0.5
+#define     DP_PATH_DEF_RTT_US      1000        //until a path is measured
+#define     DP_MP_CLIENT(dp)        (((dp)->pathCnt > 1) && ((dp)->path[0].sock >= 0))
+#define     DP_MP_SERVER(dp)        (((dp)->pathCnt > 0) && ((dp)->path[0].sock < 0))
+
+typedef struct dp_path{
+    dp_addr            addr;            //client: our end, server: the peer's end
+    socklen_t          len;
+    int                sock;            //client only, -1 on the server
+    _Bool              joined;          //the server answered a probe on it
+    uint32_t           srttUs;          //0 until measured
+    double             loss;            //smoothed probe loss, 0 to 1
+    uint32_t           probeTs;         //ts_val of the probe still out, 0 = none
+    uint64_t           dgrams;          //sent on it (client), received (server)
+} dp_path;
+
+struct dp_connection;
+
+/*
+ * Transports.  Everything du-proto puts on or takes off the wire goes
+ * through the connection's xport, so the protocol logic does not care if
+ * it is talking over UDP, a Unix datagram socket or an in-process ring.
+ *
+ *   send  - cnt dgrams (one iovec each) to the peer in outSockAddr,
+ *           returns the total bytes sent or -1
+ *   recv  - one dgram, like recvfrom(), from may be left zero length if
+ *           the transport has no addresses
+ *   poll  - 1 if a dgram is waiting, 0 after timeout_ms (-1 forever)
+ *   close - releases whatever the owning connection set up
+ */
+typedef struct dp_xport{
+    const char         *name;
+    int                (*send)(struct dp_connection *dp, struct iovec *iov, int cnt);
+    int                (*recv)(struct dp_connection *dp, void *buff, int buff_sz,
+                               dp_addr *from, socklen_t *fromLen);
+    int                (*poll)(struct dp_connection *dp, int timeout_ms);
+    void               (*close)(struct dp_connection *dp);
+} dp_xport;
+
+/*
+ * Clock.  du-proto tells time (timeouts, pacing, RTT and rate samples)
+ * from CLOCK_MONOTONIC and CLOCK_REALTIME unless the thread points it at
+ * a clock of its own with dpsetclock(), which the simulated link in
+ * du-xport.h does to run on virtual time.  sleep has to move now on by
+ * (at least) ns before it returns.
+ */
+typedef struct dp_clock{
+    uint64_t           (*now)(void *ctx);          //ns, never goes back
+    void               (*sleep)(void *ctx, uint64_t ns);
+    void               *ctx;
+} dp_clock;
+
 typedef struct dp_connection{
-    unsigned int       seqNum;
-    int                udp_sock;
+    uint64_t           seqNum;          //logical (64 bit) byte sequence number
+    int                udp_sock;        //UDP or Unix dgram socket, -1 if none
+    const dp_xport     *xport;
+    void               *xportCtx;       //transport private state
+    int                maxPayload;      //dpsend() limit, see dpsetpayload()
+    char               *bigBuff;        //dgram buffer when maxPayload is big
+    int                coalesceMs;      //small send coalescing, 0 is off
+    char               *coTx;           //messages waiting to go out
+    int                coLen;
+    int                coMsgs;
+    uint32_t           coStream;        //stream they all belong to
+    uint64_t           coStartNs;       //when the oldest one went in
+    char               *coRx;           //coalesced dgram being handed out
+    int                coRxLen;
+    int                coRxOff;
+    uint32_t           coRxStream;
     _Bool              isConnected;
     struct dp_sock     outSockAddr;
     struct dp_sock     inSockAddr;
     int                dbgMode;
+    int                fecK;            //FEC data dgrams per group, <= 1 is off
+    int                fecM;            //FEC parity dgrams per group
+    int                fecWaitMs;       //how long to wait on a partial group
+    int                lossPct;         //simulated outbound loss (testing)
+    struct dp_fec_grp  *fecTx;
+    struct dp_fec_grp  *fecRx;
+    _Bool              gsoOn;           //Linux UDP_SEGMENT for dgram runs
+    _Bool              groOn;           //Linux UDP_GRO, see groBuff
+    char               *groBuff;        //coalesced receive, split per dgram
+    int                groLen;
+    int                groOff;
+    int                groSeg;
+    dp_addr            groFrom;
+    socklen_t          groFromLen;
+    uint64_t           groKernNs;       //kernel receive time of groBuff
+    struct dp_connection *listener;     //set on sessions from dpaccept()
+    struct dp_backlog  *backlog;        //CONNECTs parked while busy
+    int                backlogCnt;
+    dp_pacer           pacer;
+    uint32_t           srttUs;          //smoothed RTT, 0 until measured
+    uint32_t           rttvarUs;
+    uint32_t           tsRecent;        //peer's last ts_val, echoed back
+    _Bool              kernTs;          //SO_TIMESTAMPING, see dpsettimestamps()
+    uint64_t           rxKernNs;        //kernel receive time of the last dgram, 0 if none
+    uint32_t           txId;            //sendmsg()s so far, the kernel's OPT_ID
+    dp_txstamp         txStamps[DP_TS_RING];
+    uint64_t           deliveryBps;     //smoothed bytes/sec acked by the peer
+    _Bool              pmtud;           //path MTU discovery, see dpsetpmtud()
+    int                pmtuStep;        //next entry of the probe table
+    int                pmtuLost;        //probes of that size lost so far
+    uint64_t           pmtuNextNs;      //no probing before this
+    _Bool              pmtuTooBig;      //the last send failed with EMSGSIZE
+    int                bufMin;          //socket buffer sizing bounds, 0 = off
+    int                bufMax;
+    int                sndBuf;          //what we last asked the kernel for
+    int                rcvBuf;
+    uint64_t           rxRateBps;       //smoothed receive rate, for sizing
+    uint64_t           rxRateNs;        //start of the current rate window
+    uint64_t           rxRateBytes;
+    _Bool              rxqOvfl;         //SO_RXQ_OVFL drop counts on receives
+    int                busyPollUs;      //spin before sleeping, 0 = off
+    int                busyCpu;         //core the spinning thread is on, -1 = any
+    _Bool              busyReady;       //the last poll saw a dgram, no need to spin
+    int                zcMin;           //MSG_ZEROCOPY payloads from this size, 0 = off
+    uint32_t           zcNext;          //id of the next zerocopy send
+    int                zcPending;
+    dp_zcslot          zcRing[DP_ZC_RING];
+    _Bool              cookies;         //stateless CONNECT cookies, see dpsetcookies()
+    uint64_t           cookieKey[2];    //SipHash key the cookies are made with
+    int                keepMs;          //KEEPALIVE after this long quiet, 0 = off
+    int                idleMs;          //peer is gone after this long quiet, 0 = never
+    uint64_t           lastRxNs;        //when we last heard from the peer
+    _Bool              idleOut;         //idleTimer ran out
+    dp_timer           keepTimer;
+    dp_timer           idleTimer;
+    dp_path            path[DP_MAX_PATHS];  //see dpaddpath(), unused when pathCnt is 0
+    int                pathCnt;
+    int                pathTx;          //client: the path the next send goes on
+    int                pathRx;          //the path the last dgram came in on
+    _Bool              pathReady;       //client: the last poll found pathRx ready
+    uint64_t           pathToken;       //lets a new path join this session
+    uint64_t           pathProbeNs;     //next round of PATH probes
+    char               *early;          //server: 0-RTT data for the first dprecv()
+    int                earlyLen;
+    struct dp_uring    *uring;          //io_uring backend, NULL for plain sockets
+    dp_stats           stats;
 } dp_connection;
 
 typedef struct dp_connection *dp_connp;
@@ -29,14 +276,18 @@ typedef struct dp_connection *dp_connp;
 
 //THIS IS HOW YOU DO A BIT FIELD
 //
-//   64  32  16  8   4   2   1
-// |---+---+---+---+---+---+---|
-//   E   F   N   C   C   S   A
-//   R   R   A   L   O   E   C
-//   R   A   C   O   N   N   K
-//   O   G   K   S   C   D
-//   R           E   T
-//-------------------------------
+// 8192 4096 2048 1024 512 256 128  64  32  16  8   4   2   1
+// |----+----+----+----+---+---+---+---+---+---+---+---+---+---|
+//   P    K    C    P    F   C   P   E   F   N   C   C   S   A
+//   A    E    O    R    I   O   A   R   R   A   L   O   E   C
+//   T    E    O    O    N   A   R   R   A   C   O   N   N   K
+//   H    P    K    B        L   I   O   G   K   S   C   D
+//        A    I    E            T   R           E   T
+//        L    E
+//        I
+//        V
+//        E
+//------------------------------------------------------------
 #define DP_MT_ACK        1              //ACK MSG
 #define DP_MT_SND        2              //SND MSG
 #define DP_MT_CONNECT    4              //Connect MSG
@@ -44,6 +295,13 @@ typedef struct dp_connection *dp_connp;
 #define DP_MT_NACK       16             //NEG ACK
 #define DP_MT_FRAGMENT   32             //DGRAM IS A FRAGMENT
 #define DP_MT_ERROR      64             //SIMULATE ERROR
+#define DP_MT_PARITY     128            //FEC PARITY DGRAM
+#define DP_MT_COALESCE   256            //SND carrying several messages
+#define DP_MT_FIN        512            //SND ending its stream, no payload
+#define DP_MT_PROBE      1024           //PATH MTU PROBE, padding only
+#define DP_MT_COOKIE     2048           //CONNECT again with this cookie
+#define DP_MT_KEEPALIVE  4096           //ARE YOU THERE, takes no seq number
+#define DP_MT_PATH       8192           //JOIN OR PROBE A PATH, see dpaddpath()
 
 //Message ACKS, ACK OR'ed with Message Type
 #define DP_MT_SNDACK    (DP_MT_SND     | DP_MT_ACK)
@@ -51,15 +309,209 @@ typedef struct dp_connection *dp_connp;
 #define DP_MT_CLOSEACK  (DP_MT_CLOSE   | DP_MT_ACK)
 
 typedef struct dp_pdu {
-    int     proto_ver;
-    int     mtype;
-    int     seqnum;
-    int     dgram_sz;
-    int     err_num;
+    int         proto_ver;
+    int         mtype;
+    uint32_t    seqnum;         //low 32 bits of the logical seq number
+    int         dgram_sz;
+    int         err_num;        //for PARITY, XOR of the covered dgram_sz, see DP_PDU_GET64
+    uint16_t    grp_idx;        //FEC: slot in the group (parity: stripe)
+    uint8_t     grp_k;          //FEC: data dgrams in this group
+    uint8_t     grp_m;          //FEC: parity dgrams in this group
+    uint32_t    stream_id;      //see dpsendstream(), parity: XOR of its stripe
+    uint32_t    ts_val;         //sender's clock (us) when it went out
+    uint32_t    ts_ecr;         //the newest ts_val we got from the peer
 } dp_pdu;
 
+/*
+ * Timestamp echo.  Every dgram carries the sender's clock in ts_val and
+ * echoes the last ts_val it received in ts_ecr, so an ACK (or NACK) gives
+ * an RTT sample straight from its ts_ecr.  That holds for retransmissions
+ * too and leaves out whatever the sender did between building a dgram
+ * and reading the answer.  With dpsettimestamps() the kernel's software
+ * send and receive times replace our own clock at both ends, taking the
+ * scheduler out of the sample as well.  The clock is CLOCK_REALTIME in
+ * microseconds (wrapping), since that is what the kernel stamps with, and
+ * only ever compared with itself, so the peers need not be in sync.
+ */
+
+/*
+ * Streams.  Every SND belongs to a stream, an id the app picks, and
+ * dprecvstream() says which one each message came in on.  Streams share
+ * the connection (one handshake, one seq space, one pacer and RTT) but
+ * are otherwise independent, the receiver can hand each one to its own
+ * consumer.  Plain dpsend()/dprecv() use DP_STREAM_DEFAULT.  A stream ends
+ * with dpclosestream(), the peer then gets DP_STREAM_CLOSED for it.
+ */
+#define     DP_STREAM_DEFAULT       0
+
+//Sequence numbers are tracked as 64 bit byte counters inside a connection,
+//but only the low 32 bits go out on the wire.  The receiver rebuilds the
+//full value from the closest match to the sequence number it expects, so
+//a session can carry any amount of data as long as the peers never drift
+//more than 2GB apart.  Every 4GB of traffic is one "epoch".
+#define     DP_SEQ_WIRE(s)          ((uint32_t)(s))
+#define     DP_SEQ_EPOCH(s)         ((uint32_t)((uint64_t)(s) >> 32))
+
 #define     DP_MAX_BUFF_SZ          512
 #define     DP_MAX_DGRAM_SZ         (DP_MAX_BUFF_SZ + sizeof(dp_pdu))
+#define     DP_DGRAM_SZ(dp)         ((dp)->bigBuff != NULL ? \
+                                        (dp)->maxPayload + sizeof(dp_pdu) : DP_MAX_DGRAM_SZ)
+
+/*
+ * Forward error correction.  Sends are collected into groups of fecK
+ * data dgrams that go out back to back followed by fecM parity dgrams,
+ * and the whole group is acknowledged with a single SND/ACK.  Parity
+ * dgram j is the XOR of every data dgram i with (i % fecM) == j, so the
+ * receiver can rebuild one loss per stripe (up to fecM per group, e.g.
+ * any burst of fecM consecutive losses) without a round trip.  Groups it
+ * cannot rebuild are NACKed and sent again.  Overhead is fecM / fecK.
+ */
+#define     DP_FEC_MAX_K            32
+#define     DP_FEC_MAX_M            8
+#define     DP_FEC_WAIT_MS          200
+#define     DP_FEC_MAX_RETRY        10
+
+/*
+ * Segmentation offload (Linux).  Runs of equal sized dgrams (like most of
+ * a FEC group) go to the kernel in one sendmsg() with UDP_SEGMENT, and
+ * with UDP_GRO the kernel may hand us several dgrams from one peer in a
+ * single receive that we split up again.
+ */
+#define     DP_GSO_MAX_SEGS         64
+#define     DP_GRO_BUFF_SZ          65536
+
+#define     DP_PACE_OFF             0
+#define     DP_PACE_AUTO            -1
+#define     DP_PACE_GAIN            1.25
+#define     DP_PACE_MIN_BPS         65536
+#define     DP_PACE_DEF_BURST       (4 * DP_MAX_DGRAM_SZ)
+#define     DP_PACE_SPIN_NS         50000       //spin, dont sleep, below this
+
+/*
+ * Sharded servers.  With DP_INIT_REUSEPORT several server connections
+ * (one per worker thread) bind the same port and the kernel hashes each
+ * peer to one of them.  Each worker then pulls sessions off its own
+ * socket with dpaccept(), a CONNECT that shows up while the worker is
+ * busy with another peer is parked in its backlog until the next accept.
+ */
+#define     DP_INIT_REUSEPORT       1
+#define     DP_INIT_URING           2       //io_uring socket I/O, see du-uring.h
+#define     DP_PEER_WAIT_US         20000   //how long a full peer (Unix, ring) may stall us
+#define     DP_PEER_RETRY_US        100
+#define     DP_BACKLOG_SZ           16
+
+typedef struct dp_backlog {
+    dp_pdu              pdu;
+    dp_addr             addr;
+    socklen_t           len;
+} dp_backlog;
+
+/*
+ * Path MTU discovery (PLPMTUD, RFC 8899 style) for plain UDP sends.  The
+ * socket sets DF and leaves the kernel's PMTU cache out of it
+ * (IP_PMTUDISC_PROBE), so nothing goes out IP fragmented and the probes
+ * alone decide the size.  Before a dpsend() the sender may probe the next
+ * size from a table of common link MTUs with a padded DP_MT_PROBE dgram
+ * that takes no seq number.  The receiver grows its buffer to match and
+ * answers PROBE/ACK with the payload it can take.  A size lost
+ * DP_PMTU_MAX_LOST times is left alone for DP_PMTU_RAISE_S, a send the
+ * host refuses (EMSGSIZE, the link shrank) drops the payload back to
+ * dpmaxdgram() and starts over.  Not used with FEC, whose dgrams are
+ * always dpmaxdgram() sized.
+ */
+#define     DP_PMTU_HDR_SZ          28          //IPv4 + UDP headers
+#define     DP_PMTU_MAX             9000        //jumbo frames
+#define     DP_PMTU_MAX_PAYLOAD     (DP_PMTU_MAX - DP_PMTU_HDR_SZ - (int)sizeof(dp_pdu))
+#define     DP_PMTU_STEPS           3           //1280, 1500 (Ethernet), DP_PMTU_MAX
+#define     DP_PMTU_MAX_LOST        3
+#define     DP_PMTU_PROBE_MS        50          //at least, 3 x SRTT if longer
+#define     DP_PMTU_RAISE_S         600
+
+/*
+ * Socket buffer sizing.  With dpsetsockbuf() the send and receive buffers
+ * follow the bandwidth-delay product, DP_SOCKBUF_GAIN x (delivery or
+ * receive rate x SRTT, plus the most we put on the wire at once), within
+ * the bounds given.  The receiver has no RTT of its own and assumes
+ * DP_SOCKBUF_RTT_US.  Buffers only grow.  SO_SNDBUFFORCE/SO_RCVBUFFORCE
+ * get past the net.core.[wr]mem_max caps when we have CAP_NET_ADMIN.
+ */
+#define     DP_SOCKBUF_MIN          (256 * 1024)
+#define     DP_SOCKBUF_MAX          (16 * 1024 * 1024)
+#define     DP_SOCKBUF_GAIN         2
+#define     DP_SOCKBUF_RTT_US       10000
+#define     DP_SOCKBUF_CHECK_MS     100         //receive rate window
+
+/*
+ * Busy polling.  With dpsetbusypoll() every wait for a dgram on a socket
+ * first spins on a non-blocking poll() for up to busyPollUs and only then
+ * sleeps in the kernel, which takes the wakeup out of the round trip at
+ * the cost of a core.  SO_BUSY_POLL has the kernel spin on the NIC queue
+ * as well when it is allowed (CAP_NET_ADMIN past net.core.busy_read).
+ */
+#define     DP_BUSY_POLL_MAX_US     1000000
+
+/*
+ * Zerocopy sends.  With dpsetzerocopy() a dpsend() of at least zcMin bytes
+ * goes out with MSG_ZEROCOPY, the PDU from a pooled buffer and the
+ * payload straight from the caller's, so the kernel pins the pages instead
+ * of copying them.  The kernel says when it is done on the socket error
+ * queue, the PDU goes back to the pool then, and dpsend() waits for that
+ * (up to DP_ZC_WAIT_MS, it is normally there by the time the ACK is)
+ * before the caller gets its buffer back.  Pinning costs more than
+ * copying a small dgram, hence DP_ZC_MIN_BYTES.  On loopback the kernel
+ * copies anyway and says so, see zcCopied.
+ */
+#define     DP_ZC_MIN_BYTES         4096
+#define     DP_ZC_WAIT_MS           100
+
+/*
+ * Connect cookies.  With dpsetcookies() a listener answers a CONNECT
+ * without a cookie with a DP_MT_COOKIE and remembers nothing about it.
+ * The cookie is a SipHash-2-4 MAC, keyed when cookies are turned on, of
+ * the peer's address, the CONNECT's seq number and FEC settings and the
+ * DP_COOKIE_SECS period it was made in.  The client sends its CONNECT
+ * again carrying the cookie, and only a CONNECT whose cookie checks out
+ * (for this period or the one before) sets up a session or gets a place
+ * in the backlog.  A flood of CONNECTs from addresses that never answer
+ * then costs a hash and a reply each and leaves the backlog to the real
+ * clients.  The cookie rides in err_num (low half) and stream_id.
+ */
+#define     DP_COOKIE_SECS          30
+#define     DP_COOKIE_TRIES         3           //COOKIEs dpconnect() answers
+
+//a 64 bit value in err_num and stream_id, for cookies and path tokens
+#define     DP_PDU_GET64(pdu)       (((uint64_t)(pdu)->stream_id << 32) | (uint32_t)(pdu)->err_num)
+#define     DP_PDU_SET64(pdu, v)    ((pdu)->err_num = (int)(uint32_t)(v), (pdu)->stream_id = (uint32_t)((v) >> 32))
+#define     DP_ROTL(x, b)           (((x) << (b)) | ((x) >> (64 - (b))))    //for dpsiphash()
+
+/*
+ * Keepalives and idle timeouts.  With dpsetkeepalive() a connected peer
+ * that has been quiet for keepMs gets a DP_MT_KEEPALIVE, and another
+ * every keepMs after that, which it answers whatever it is doing.  Once
+ * nothing at all has come in for idleMs the peer is taken for gone and
+ * the wait it was holding up (dprecv(), an ACK, a CLOSE/ACK) fails with
+ * DP_ERROR_TIMEOUT.  The timers sit on the calling thread's timing wheel
+ * (du-wheel.h), so connect and close a connection on the thread that
+ * drives it.  Every wait on that thread runs the wheel, and a dgram
+ * coming in only moves lastRxNs, the timers catch up when they fire.
+ */
+#define     DP_KEEPALIVE_PROBES     4           //keepMs default, idleMs / this
+
+typedef struct dp_fec_grp {
+    uint64_t    baseSeq;                //seq number of the first data dgram
+    int         count;                  //data dgrams in the group
+    int         stripes;                //parity dgrams in the group
+    int         next;                   //next data dgram to hand to the app
+    _Bool       acked;
+    uint64_t    have;                   //bitmap of data dgrams we hold
+    uint32_t    parityHave;             //bitmap of parity dgrams we hold
+    char        *dgram[DP_FEC_MAX_K + DP_FEC_MAX_M + 1];   //pooled dgram buffers
+} dp_fec_grp;
+
+//receive side layout of dp_fec_grp.dgram, the send side keeps parity
+//right behind the data dgrams instead
+#define     DP_FEC_PARITY_SLOT(j)   (DP_FEC_MAX_K + (j))
+#define     DP_FEC_SPARE_SLOT       (DP_FEC_MAX_K + DP_FEC_MAX_M)
 
 #define     DP_NO_ERROR             0
 #define     DP_ERROR_GENERAL        -1
@@ -68,28 +520,138 @@ typedef struct dp_pdu {
 #define     DP_BUFF_OVERSIZED       -8
 #define     DP_CONNECTION_CLOSED    -16
 #define     DP_ERROR_BAD_DGRAM      -32
+#define     DP_ERROR_TIMEOUT        -64
+#define     DP_STREAM_CLOSED        -128
+#define     DP_PROBED               -256        //internal, a probe came in instead
 
 //PROTOTYPES - INTERNAL HELPERS
 static dp_connp dpinit();
 
 dp_connp dpServerInit(int port);
+dp_connp dpServerInitEx(int port, int flags);
 dp_connp dpClientInit(char *addr, int port);
+dp_connp dpClientInitEx(char *addr, int port, int flags);
+dp_connp dpServerInitUnix(char *path, int flags);
+dp_connp dpClientInitUnix(char *path, int flags);
+int dpPairInit(dp_connp *svr, dp_connp *cli);
+dp_connp dpServerInitShm(char *path);
+dp_connp dpClientInitShm(char *path);
+dp_connp dpInitXport(const dp_xport *xport, void *ctx);
 static char * pdu_msg_to_string(dp_pdu *pdu);
+static uint64_t dp_seq_extend(uint64_t ref, uint32_t wire);
+static int dp_seq_before(uint32_t a, uint32_t b);
 
 //API Interface
 void * dp_prepare_send(dp_pdu *pdu_ptr, void *buff, int buff_sz);
 int dprecv(dp_connp dp, void *buff, int buff_sz);
 int dpsend(dp_connp dp, void *sbuff, int sbuff_sz);
+int dpsendstream(dp_connp dp, uint32_t streamId, void *sbuff, int sbuff_sz);
+int dprecvstream(dp_connp dp, uint32_t *streamId, void *buff, int buff_sz);
+int dpclosestream(dp_connp dp, uint32_t streamId);
 int dplisten(dp_connp dp);
+dp_connp dpaccept(dp_connp listener);
 int dpconnect(dp_connp dp);
+
+/*
+ * 0-RTT data.  dpconnectdata() sends the first payload, up to dpmaxdgram()
+ * bytes on the default stream, in the CONNECT itself (dgram_sz says how
+ * much).  dplisten() keeps it for the first dprecv() and the CNTACK's seq
+ * number covers it, so the client knows it got there without another
+ * round trip.  A CNTACK that only covers the CONNECT (the listener parked
+ * it in the backlog, which keeps no payloads) has the client send it
+ * again the usual way.  With cookies on, it rides on both CONNECTs.  Like
+ * any 0-RTT data a copied CONNECT delivers it twice, keep it to requests
+ * that are safe to repeat.
+ */
+int dpconnectdata(dp_connp dp, void *buff, int len);
+
 int dpdisconnect(dp_connp dp);
+int dpsetfec(dp_connp dp, int grpSz, int paritySz);
+int dpflush(dp_connp dp);
+int dpsetoffload(dp_connp dp, int on);
+int dpsetpacing(dp_connp dp, int64_t bytesPerSec, int burst);
+int dpsetcoalesce(dp_connp dp, int delayMs);
+int dpsettimestamps(dp_connp dp, int on);
+int dpsetpmtud(dp_connp dp, int on);
+int dpsetsockbuf(dp_connp dp, int minBytes, int maxBytes);
+int dpsetbusypoll(dp_connp dp, int spinUs, int cpu);
+int dpsetzerocopy(dp_connp dp, int minBytes);
+int dpsetcookies(dp_connp dp, int on);
+int dpsetkeepalive(dp_connp dp, int keepMs, int idleMs);
+int dpaddpath(dp_connp dp, char *localAddr, int localPort);
+void dpsetclock(const dp_clock *clock);
+void dpsetdebug(int on);
 
 void dpclose(dp_connp dpsession);
 void print_out_pdu(dp_pdu *pdu);
 void print_in_pdu(dp_pdu *pdu);
+void print_dp_stats(dp_connp dp);
+int  dprand(int threshold);
 int  dpmaxdgram();
+int  dpmaxpayload(dp_connp dp);
+int  dpsetpayload(dp_connp dp, int sz);
 static void print_pdu_details(dp_pdu *pdu);
 static int dpsendraw(dp_connp dp, void *sbuff, int sbuff_sz);
 static int dprecvraw(dp_connp dp, void *buff, int buff_sz);
 static int dprecvdgram(dp_connp dp, void *buff, int buff_sz);
-static int dpsenddgram(dp_connp dp, void *sbuff, int sbuff_sz);
+static int dpprobe(dp_connp dp);
+static int dpprobed(dp_connp dp, dp_pdu *pdu);
+static void dppmtudrop(dp_connp dp);
+static int dpsenddgram(dp_connp dp, int mtype, uint32_t streamId, void *sbuff, int sbuff_sz);
+static int dpcosend(dp_connp dp, uint32_t streamId, void *sbuff, int sbuff_sz);
+static int dpcoflush(dp_connp dp);
+static int dpcosplit(dp_connp dp, void *buff, int buff_sz);
+static int dpwaitraw(dp_connp dp, int timeout_ms);
+static int dpsendbatch(dp_connp dp, char **dgrams, int count);
+static int dpsendrawgso(dp_connp dp, struct iovec *iov, int iovcnt, int seg_sz);
+static int dprecvgro(dp_connp dp, void *buff, int buff_sz);
+static int dpsendrawbatch(dp_connp dp, struct iovec *iov, int iovcnt);
+static void dpseturing(dp_connp dp);
+static uint64_t dpnowns();
+static void dppace(dp_connp dp, int bytes);
+static void dpsample(dp_connp dp, uint64_t sentNs, uint64_t bytes);
+static uint32_t dpwallus();
+static void dpstamp(dp_connp dp, dp_pdu *pdu);
+static void dpechoed(dp_connp dp, dp_pdu *pdu);
+static void dprtt(dp_connp dp, uint32_t rttUs, _Bool kern);
+static void dperrqueue(dp_connp dp);
+static int dprecvcmsg(dp_connp dp, void *buff, int buff_sz, dp_addr *from, socklen_t *fromLen);
+static void dpsizebufs(dp_connp dp);
+static int dpsetbuf(dp_connp dp, int opt, int forceOpt, int bytes);
+static void dprxrate(dp_connp dp, int bytes);
+static int dpspin(dp_connp dp, int spinUs);
+static int dpsendrawzc(dp_connp dp, dp_pdu *pdu, void *sbuff, int sbuff_sz);
+static void dpzcdone(dp_connp dp, uint32_t lo, uint32_t hi, _Bool copied);
+static void dpzcwait(dp_connp dp);
+static void dpstray(dp_connp dp, void *buff, int bytes, dp_addr *from, socklen_t len);
+static int dpsameaddr(dp_addr *a, socklen_t aLen, dp_addr *b, socklen_t bLen);
+static uint64_t dpsiphash(const uint64_t key[2], const void *data, int len);
+static void dpsipround(uint64_t v[4], int rounds);
+static uint64_t dpcookie(dp_connp dp, dp_pdu *pdu, dp_addr *from, socklen_t len, uint64_t period);
+static int dpcookieok(dp_connp dp, dp_pdu *pdu, dp_addr *from, socklen_t len);
+static void dpcookiesend(dp_connp dp, dp_pdu *pdu, dp_addr *from, socklen_t len);
+static int dpsendto(dp_connp dp, dp_pdu *pdu, dp_addr *to, socklen_t len);
+static void dprandkey(uint64_t key[2]);
+static void dpkeepstart(dp_connp dp);
+static void dpkeepfire(dp_timer *t, uint64_t nowNs);
+static void dpidlefire(dp_timer *t, uint64_t nowNs);
+static void dpkeepsend(dp_connp dp, int mtype);
+static uint64_t dptoken();
+static int dppathfind(dp_connp dp, dp_addr *addr, socklen_t len);
+static void dppathprobe(dp_connp dp);
+static void dppathed(dp_connp dp, dp_pdu *pdu, dp_addr *from, socklen_t len);
+static int dppathpick(dp_connp dp, int *load);
+static int dppathbatch(dp_connp dp, char **dgrams, int count);
+static int dppathpoll(dp_connp dp, int timeout_ms);
+static int dpsocksend(dp_connp dp, struct iovec *iov, int cnt);
+static int dpsockrecv(dp_connp dp, void *buff, int buff_sz, dp_addr *from, socklen_t *fromLen);
+static int dpsockpoll(dp_connp dp, int timeout_ms);
+static void dpsockclose(dp_connp dp);
+static int dpfecsend(dp_connp dp, int mtype, uint32_t streamId, void *sbuff, int sbuff_sz);
+static int dpfecrecv(dp_connp dp, uint32_t *streamId, void *buff, int buff_sz);
+static int dpfecrepair(dp_connp dp, dp_fec_grp *g);
+static int dpfecparity(dp_connp dp, dp_fec_grp *g);
+static int dpfecack(dp_connp dp, int mtype, uint64_t seq);
+static void dpfecreset(dp_fec_grp *g, uint64_t baseSeq);
+static char *dpfecslot(dp_fec_grp *g, int slot);
+static void dpfecfree(dp_fec_grp *g);
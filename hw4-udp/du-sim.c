@@ -0,0 +1,282 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <getopt.h>
+#include <time.h>
+
+#include "du-sim.h"
+#include "du-proto.h"
+
+/*
+ *  du-sim runs many du-ftp like uploads over the simulated link (see
+ *  dpSimRun() in du-xport.h) and sums up how they went.  Time is virtual,
+ *  so a run over a slow, lossy link finishes as fast as the CPU allows,
+ *  and a given seed always gives the same results, down to the digest
+ *  printed at the end.  Exits 0 only if every run got its data through.
+ */
+
+static void usage(char *prog){
+    printf("USAGE: %s [-n runs] [-s bytes] [-b bytes] [-r KBps] [-d ms] [-j ms] [-l loss_pct] [-e burst]\n", prog);
+    printf("\t[-c loss_pct] [-q KB] [-k grp[:parity]] [-a KBps|auto] [-z seed] [-f] [-v] [-h]\n");
+    printf("WHERE:\n\t[-n runs] uploads to simulate; DEFAULT = %d\n", SIM_DEF_RUNS);
+    printf("\t[-s bytes] size of each upload; DEFAULT = %d\n", SIM_DEF_XFER_SZ);
+    printf("\t[-b bytes] client dpsend() size; DEFAULT = %d\n", SIM_DEF_CHUNK_SZ);
+    printf("\t[-r KBps] link rate both ways, 0 for no limit; DEFAULT = %d\n", SIM_DEF_RATE_KBPS);
+    printf("\t[-d ms] one way delay; DEFAULT = %.0f\n", SIM_DEF_DELAY_MS);
+    printf("\t[-j ms] up to this much more delay per dgram, reorders; DEFAULT = 0\n");
+    printf("\t[-l loss_pct] loss on the data path (client to server); DEFAULT = 0\n");
+    printf("\t[-e burst] mean dgrams lost in a row, 1 for random loss; DEFAULT = 1\n");
+    printf("\t[-c loss_pct] loss on the ACK path (server to client); DEFAULT = 0\n");
+    printf("\t[-q KB] bottleneck queue, drop tail past it, 0 for no limit; DEFAULT = 0\n");
+    printf("\t[-k grp[:parity]] turns on FEC with grp data + parity dgrams per group; DEFAULT = off, parity = 1\n");
+    printf("\t[-a KBps|auto] paces the client's sends; DEFAULT = off\n");
+    printf("\t[-z seed] seeds the link and the data; DEFAULT = 1\n");
+    printf("\t[-f] sends the first dgram with the CONNECT (0-RTT)\n");
+    printf("\t[-v] prints a line per run\n");
+    printf("\t[-h] displays what you are looking at now - the help\n\n");
+}
+
+static void initParams(int argc, char *argv[], sim_config *cfg){
+    int option;
+    double ms;
+
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->runs = SIM_DEF_RUNS;
+    cfg->xfer_sz = SIM_DEF_XFER_SZ;
+    cfg->chunk_sz = SIM_DEF_CHUNK_SZ;
+    cfg->fwd.rateBps = SIM_DEF_RATE_KBPS * 1024L;
+    cfg->fwd.delayUs = SIM_DEF_DELAY_MS * 1000;
+    cfg->pace_rate = DP_PACE_OFF;
+    cfg->seed = 1;
+
+    while ((option = getopt(argc, argv, ":n:s:b:r:d:j:l:e:c:q:k:a:z:fvh")) != -1){
+        switch(option) {
+            case 'n':
+                cfg->runs = atoi(optarg);
+                break;
+            case 's':
+                cfg->xfer_sz = atol(optarg);
+                break;
+            case 'b':
+                cfg->chunk_sz = atoi(optarg);
+                break;
+            case 'r':
+                cfg->fwd.rateBps = atol(optarg) * 1024;
+                break;
+            case 'd':
+                ms = atof(optarg);
+                cfg->fwd.delayUs = ms * 1000;
+                break;
+            case 'j':
+                ms = atof(optarg);
+                cfg->fwd.jitterUs = ms * 1000;
+                break;
+            case 'l':
+                cfg->fwd.lossPct = atof(optarg);
+                break;
+            case 'e':
+                cfg->fwd.burstLen = atof(optarg);
+                break;
+            case 'c':
+                cfg->rev.lossPct = atof(optarg);
+                break;
+            case 'q':
+                cfg->fwd.queueBytes = atoi(optarg) * 1024;
+                break;
+            case 'k':
+                cfg->fec_parity = 1;
+                sscanf(optarg, "%d:%d", &cfg->fec_grp, &cfg->fec_parity);
+                break;
+            case 'a':
+                if (strcmp(optarg, "auto") == 0)
+                    cfg->pace_rate = DP_PACE_AUTO;
+                else
+                    cfg->pace_rate = atol(optarg) * 1024;
+                break;
+            case 'z':
+                cfg->seed = strtoull(optarg, NULL, 0);
+                break;
+            case 'f':
+                cfg->fast_open = 1;
+                break;
+            case 'v':
+                cfg->verbose = 1;
+                break;
+            case 'h':
+                usage(argv[0]);
+                exit(0);
+            case ':':
+                perror ("Option missing value");
+                exit(-1);
+            default:
+            case '?':
+                perror ("Unknown option");
+                exit(-1);
+        }
+    }
+
+    //the ACK path is the same link the other way, lossy only if asked
+    cfg->rev.rateBps = cfg->fwd.rateBps;
+    cfg->rev.delayUs = cfg->fwd.delayUs;
+    cfg->rev.jitterUs = cfg->fwd.jitterUs;
+    cfg->rev.burstLen = cfg->fwd.burstLen;
+    cfg->rev.queueBytes = cfg->fwd.queueBytes;
+    if ((cfg->runs <= 0) || (cfg->xfer_sz < 0) || (cfg->chunk_sz <= 0)) {
+        usage(argv[0]);
+        exit(-1);
+    }
+}
+
+static uint64_t fnv1a(uint64_t h, const char *buff, int len){
+    int i;
+
+    for (i = 0; i < len; i++) {
+        h ^= (unsigned char)buff[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+//the upload's bytes, a function of the run's seed only
+static void fill(char *buff, int len, uint64_t *state){
+    int i;
+
+    for (i = 0; i < len; i++) {
+        *state = *state * 6364136223846793005ULL + 1442695040888963407ULL;
+        buff[i] = (char)(*state >> 56);
+    }
+}
+
+static int sim_server(dp_connp dpc, void *arg){
+    sim_run *run = arg;
+    char *rBuff = malloc(SIM_RBUFF_SZ);
+    int rcvSz;
+
+    run->rcvdHash = 0xcbf29ce484222325ULL;
+    if ((rBuff == NULL) || (dplisten(dpc) < 0)) {
+        free(rBuff);
+        return DP_ERROR_GENERAL;
+    }
+    while ((rcvSz = dprecv(dpc, rBuff, SIM_RBUFF_SZ)) >= 0) {
+        run->rcvdHash = fnv1a(run->rcvdHash, rBuff, rcvSz);
+        run->rcvdBytes += rcvSz;
+    }
+    free(rBuff);
+    return rcvSz;
+}
+
+static int sim_client(dp_connp dpc, void *arg){
+    sim_run *run = arg;
+    sim_config *cfg = run->cfg;
+    uint64_t state = run->seed;
+    char *buff = malloc(cfg->chunk_sz);
+    long off;
+    int sz, rc = DP_NO_ERROR;
+
+    run->sentHash = 0xcbf29ce484222325ULL;
+    if (buff == NULL)
+        return DP_ERROR_GENERAL;
+    if ((cfg->fec_grp > 1) && (dpsetfec(dpc, cfg->fec_grp, cfg->fec_parity) != DP_NO_ERROR)) {
+        printf("ERROR: Bad FEC settings %d:%d\n", cfg->fec_grp, cfg->fec_parity);
+        exit(-1);
+    }
+    if (cfg->pace_rate != DP_PACE_OFF)
+        dpsetpacing(dpc, cfg->pace_rate, 0);
+    //with -f the first dgram's worth rides on the CONNECT
+    off = 0;
+    if (cfg->fast_open) {
+        off = (cfg->xfer_sz < cfg->chunk_sz) ? cfg->xfer_sz : cfg->chunk_sz;
+        if (off > dpmaxdgram())
+            off = dpmaxdgram();
+        fill(buff, off, &state);
+        run->sentHash = fnv1a(run->sentHash, buff, off);
+    }
+    if (dpconnectdata(dpc, buff, off) < 0) {
+        free(buff);
+        return DP_ERROR_GENERAL;
+    }
+
+    for (; (off < cfg->xfer_sz) && (rc >= 0); off += sz) {
+        sz = (cfg->xfer_sz - off < cfg->chunk_sz) ? cfg->xfer_sz - off : cfg->chunk_sz;
+        fill(buff, sz, &state);
+        run->sentHash = fnv1a(run->sentHash, buff, sz);
+        rc = dpsend(dpc, buff, sz);
+    }
+    if (rc >= 0)
+        rc = dpdisconnect(dpc);
+    free(buff);
+    return rc;
+}
+
+int main(int argc, char *argv[])
+{
+    sim_config cfg;
+    sim_run run;
+    dp_simstats st;
+    struct timespec t0, t1;
+    uint64_t digest = 0xcbf29ce484222325ULL;
+    uint64_t minNs = UINT64_MAX, maxNs = 0, okNs = 0;
+    uint64_t dgrams = 0, lost = 0, qdrops = 0, retrans = 0, fecRec = 0, fecNacks = 0;
+    int i, rc, ok = 0, stalled = 0, failed = 0;
+    double wall;
+
+    initParams(argc, argv, &cfg);
+    dpsetdebug(false);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    for (i = 0; i < cfg.runs; i++) {
+        memset(&run, 0, sizeof(run));
+        run.cfg = &cfg;
+        run.seed = cfg.seed * 1000003ULL + i;
+
+        rc = dpSimRun(&cfg.fwd, &cfg.rev, run.seed, sim_server, sim_client, &run, &st);
+        if ((rc == DP_NO_ERROR) && 
+            ((run.rcvdBytes != cfg.xfer_sz) || (run.rcvdHash != run.sentHash)))
+            rc = DP_ERROR_PROTOCOL;
+
+        if (rc == DP_NO_ERROR) {
+            ok++;
+            okNs += st.elapsedNs;
+            minNs = (st.elapsedNs < minNs) ? st.elapsedNs : minNs;
+            maxNs = (st.elapsedNs > maxNs) ? st.elapsedNs : maxNs;
+        } else if (rc == DP_ERROR_TIMEOUT)
+            stalled++;
+        else
+            failed++;
+        dgrams += st.dgrams[0] + st.dgrams[1];
+        lost += st.lost[0] + st.lost[1];
+        qdrops += st.queueDrops[0] + st.queueDrops[1];
+        retrans += st.cli.retransmits;
+        fecRec += st.svr.fecRecovered;
+        fecNacks += st.svr.fecNacks;
+        digest = fnv1a(digest, (char *)&rc, sizeof(rc));
+        digest = fnv1a(digest, (char *)&st.elapsedNs, sizeof(st.elapsedNs));
+        digest = fnv1a(digest, (char *)&run.rcvdBytes, sizeof(run.rcvdBytes));
+
+        if (cfg.verbose)
+            printf("run %4d: %s, %ld/%ld bytes in %.3f ms, %llu dgrams, %llu lost, %llu retransmits\n",
+                i, (rc == DP_NO_ERROR) ? "ok" : (rc == DP_ERROR_TIMEOUT) ? "STALLED" : "FAILED",
+                run.rcvdBytes, cfg.xfer_sz, st.elapsedNs / 1e6,
+                (unsigned long long)(st.dgrams[0] + st.dgrams[1]),
+                (unsigned long long)(st.lost[0] + st.lost[1]),
+                (unsigned long long)st.cli.retransmits);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    wall = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+    printf("%d runs of %ld bytes in %.2f s: %d ok, %d stalled, %d failed\n",
+        cfg.runs, cfg.xfer_sz, wall, ok, stalled, failed);
+    if (ok > 0)
+        printf("\tTime:         %.3f ms avg, %.3f min, %.3f max (virtual)\n"
+               "\tGoodput:      %.1f KB/sec avg\n",
+            okNs / 1e6 / ok, minNs / 1e6, maxNs / 1e6,
+            (okNs > 0) ? (double)cfg.xfer_sz * ok / 1024 / (okNs / 1e9) : 0.0);
+    printf("\tLink:         %llu dgrams, %llu lost, %llu queue drops\n",
+        (unsigned long long)dgrams, (unsigned long long)lost, (unsigned long long)qdrops);
+    printf("\tRecovery:     %llu retransmits, %llu FEC rebuilds, %llu FEC NACKs\n",
+        (unsigned long long)retrans, (unsigned long long)fecRec, (unsigned long long)fecNacks);
+    printf("\tDigest:       %016llx\n", (unsigned long long)digest);
+    return (ok == cfg.runs) ? 0 : 1;
+}
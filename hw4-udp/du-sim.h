@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "du-xport.h"
+
+#define SIM_DEF_RUNS        100
+#define SIM_DEF_XFER_SZ     100000
+#define SIM_DEF_CHUNK_SZ    500
+#define SIM_DEF_RATE_KBPS   10000       //10 MB/sec
+#define SIM_DEF_DELAY_MS    10.0
+#define SIM_RBUFF_SZ        (64 * 1024)
+
+typedef struct sim_config{
+    int         runs;
+    long        xfer_sz;            //bytes the client uploads each run
+    int         chunk_sz;           //client dpsend() size
+    dp_simlink  fwd;                //client to server, the data
+    dp_simlink  rev;                //server to client, the ACKs
+    int         fec_grp;            //FEC data dgrams per group, 0 = off
+    int         fec_parity;
+    long        pace_rate;          //bytes/sec, 0 = off, DP_PACE_AUTO
+    uint64_t    seed;
+    int         fast_open;          //first dgram goes with the CONNECT
+    int         verbose;            //a line per run
+} sim_config;
+
+//one run, both sides see it
+typedef struct sim_run{
+    sim_config  *cfg;
+    uint64_t    seed;               //of the data sent
+    uint64_t    sentHash;           //FNV-1a of what went out
+    uint64_t    rcvdHash;           //and of what came in
+    long        rcvdBytes;
+} sim_run;
@@ -0,0 +1,420 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include "du-uring.h"
+
+#ifdef __linux__
+
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#define DP_URING_RECV_TAG   0xFFFFFFFFULL
+
+//the user space half of one ring, pointers into the kernel's mappings
+typedef struct dp_ring {
+    int                 fd;
+    unsigned            entries;
+    void                *sqMap;
+    size_t              sqMapSz;
+    void                *cqMap;
+    size_t              cqMapSz;
+    unsigned            *sqHead;
+    unsigned            *sqTail;
+    unsigned            *sqMask;
+    unsigned            *sqArray;
+    struct io_uring_sqe *sqes;
+    unsigned            *cqHead;
+    unsigned            *cqTail;
+    unsigned            *cqMask;
+    struct io_uring_cqe *cqes;
+} dp_ring;
+
+struct dp_uring {
+    int                 sock;
+    dp_ring             rx;
+    dp_ring             tx;
+    _Bool               rxArmed;
+    struct msghdr       rxMsg;                  //layout template for RECVMSG
+    struct io_uring_buf_ring *bufRing;
+    size_t              bufRingSz;
+    uint16_t            bufTail;
+    char                *bufs;
+    struct msghdr       txMsg[DP_URING_ENTRIES];
+    uint64_t            enters;
+};
+
+static int dpring_enter(dp_uring *ur, dp_ring *r, unsigned submit, unsigned wait){
+    int rc;
+
+    ur->enters++;
+    do {
+        rc = syscall(__NR_io_uring_enter, r->fd, submit, wait,
+                     wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    } while ((rc < 0) && (errno == EINTR));
+    return rc;
+}
+
+static int dpring_init(dp_ring *r, unsigned entries){
+    struct io_uring_params p = {0};
+
+    r->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd < 0)
+        return -1;
+    r->entries = p.sq_entries;
+
+    r->sqMapSz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cqMapSz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cqMapSz > r->sqMapSz)
+            r->sqMapSz = r->cqMapSz;
+        r->cqMapSz = r->sqMapSz;
+    }
+
+    r->sqMap = mmap(NULL, r->sqMapSz, PROT_READ | PROT_WRITE, 
+                    MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sqMap == MAP_FAILED)
+        return -1;
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+        r->cqMap = r->sqMap;
+    else {
+        r->cqMap = mmap(NULL, r->cqMapSz, PROT_READ | PROT_WRITE, 
+                        MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (r->cqMap == MAP_FAILED)
+            return -1;
+    }
+    r->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), 
+                   PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, 
+                   r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+        return -1;
+
+    r->sqHead  = (unsigned *)((char *)r->sqMap + p.sq_off.head);
+    r->sqTail  = (unsigned *)((char *)r->sqMap + p.sq_off.tail);
+    r->sqMask  = (unsigned *)((char *)r->sqMap + p.sq_off.ring_mask);
+    r->sqArray = (unsigned *)((char *)r->sqMap + p.sq_off.array);
+    r->cqHead  = (unsigned *)((char *)r->cqMap + p.cq_off.head);
+    r->cqTail  = (unsigned *)((char *)r->cqMap + p.cq_off.tail);
+    r->cqMask  = (unsigned *)((char *)r->cqMap + p.cq_off.ring_mask);
+    r->cqes    = (struct io_uring_cqe *)((char *)r->cqMap + p.cq_off.cqes);
+    return 0;
+}
+
+static void dpring_free(dp_ring *r){
+    if (r->sqes != NULL && r->sqes != MAP_FAILED)
+        munmap(r->sqes, r->entries * sizeof(struct io_uring_sqe));
+    if (r->cqMap != NULL && r->cqMap != MAP_FAILED && r->cqMap != r->sqMap)
+        munmap(r->cqMap, r->cqMapSz);
+    if (r->sqMap != NULL && r->sqMap != MAP_FAILED)
+        munmap(r->sqMap, r->sqMapSz);
+    if (r->fd > 0)
+        close(r->fd);
+}
+
+//next free SQE, the caller fills it in and dpring_commit()s it
+static struct io_uring_sqe *dpring_sqe(dp_ring *r){
+    unsigned tail = *r->sqTail;
+    unsigned head = __atomic_load_n(r->sqHead, __ATOMIC_ACQUIRE);
+    struct io_uring_sqe *sqe;
+
+    if (tail - head >= r->entries)
+        return NULL;
+    sqe = &r->sqes[tail & *r->sqMask];
+    memset(sqe, 0, sizeof(*sqe));
+    r->sqArray[tail & *r->sqMask] = tail & *r->sqMask;
+    return sqe;
+}
+
+static void dpring_commit(dp_ring *r, unsigned cnt){
+    __atomic_store_n(r->sqTail, *r->sqTail + cnt, __ATOMIC_RELEASE);
+}
+
+static struct io_uring_cqe *dpring_cqe(dp_ring *r){
+    unsigned head = *r->cqHead;
+
+    if (head == __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE))
+        return NULL;
+    return &r->cqes[head & *r->cqMask];
+}
+
+static void dpring_cqe_done(dp_ring *r){
+    __atomic_store_n(r->cqHead, *r->cqHead + 1, __ATOMIC_RELEASE);
+}
+
+//hands receive buffer bid back to the kernel
+static void dpuring_recycle(dp_uring *ur, int bid){
+    struct io_uring_buf *b = &ur->bufRing->bufs[ur->bufTail & (DP_URING_BUFS - 1)];
+
+    b->addr = (uint64_t)(uintptr_t)(ur->bufs + (size_t)bid * DP_URING_BUF_SZ);
+    b->len = DP_URING_BUF_SZ;
+    b->bid = bid;
+    ur->bufTail++;
+    __atomic_store_n(&ur->bufRing->tail, ur->bufTail, __ATOMIC_RELEASE);
+}
+
+//(re)arms the multishot receive, it stays armed until the kernel says not
+static int dpuring_arm(dp_uring *ur){
+    struct io_uring_sqe *sqe = dpring_sqe(&ur->rx);
+
+    if (sqe == NULL)
+        return -1;
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = ur->sock;
+    sqe->addr = (uint64_t)(uintptr_t)&ur->rxMsg;
+    sqe->len = 1;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = DP_URING_BGID;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->user_data = DP_URING_RECV_TAG;
+    dpring_commit(&ur->rx, 1);
+
+    if (dpring_enter(ur, &ur->rx, 1, 0) != 1)
+        return -1;
+    ur->rxArmed = true;
+    return 0;
+}
+
+dp_uring *dpuring_open(int sock){
+    struct io_uring_buf_reg reg = {0};
+    dp_uring *ur;
+    int i;
+
+    if ((ur = calloc(1, sizeof(dp_uring))) == NULL)
+        return NULL;
+    ur->sock = sock;
+    ur->rx.fd = ur->tx.fd = -1;
+
+    if ((dpring_init(&ur->rx, DP_URING_ENTRIES) < 0) ||
+        (dpring_init(&ur->tx, DP_URING_ENTRIES) < 0)) {
+        perror("dpuring_open: io_uring_setup failed");
+        goto fail;
+    }
+
+    //receive buffers, registered with the rx ring as a provided buffer ring
+    ur->bufRingSz = DP_URING_BUFS * sizeof(struct io_uring_buf);
+    ur->bufRing = mmap(NULL, ur->bufRingSz, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ur->bufRing == MAP_FAILED) {
+        ur->bufRing = NULL;
+        goto fail;
+    }
+    if (posix_memalign((void **)&ur->bufs, 4096, (size_t)DP_URING_BUFS * DP_URING_BUF_SZ) != 0)
+        goto fail;
+
+    reg.ring_addr = (uint64_t)(uintptr_t)ur->bufRing;
+    reg.ring_entries = DP_URING_BUFS;
+    reg.bgid = DP_URING_BGID;
+    if (syscall(__NR_io_uring_register, ur->rx.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        perror("dpuring_open: cannot register receive buffers");
+        goto fail;
+    }
+    for (i = 0; i < DP_URING_BUFS; i++)
+        dpuring_recycle(ur, i);
+
+    ur->rxMsg.msg_namelen = sizeof(struct sockaddr_storage);
+    if (dpuring_arm(ur) < 0) {
+        perror("dpuring_open: cannot arm multishot receive");
+        goto fail;
+    }
+    return ur;
+
+fail:
+    dpuring_close(ur);
+    return NULL;
+}
+
+void dpuring_close(dp_uring *ur){
+    if (ur == NULL)
+        return;
+    dpring_free(&ur->rx);
+    dpring_free(&ur->tx);
+    if (ur->bufRing != NULL)
+        munmap(ur->bufRing, ur->bufRingSz);
+    free(ur->bufs);
+    free(ur);
+}
+
+/*
+ *  Sends cnt dgrams (one iovec each) to the same peer with a single
+ *  io_uring_enter().  Returns the total bytes sent or -1.
+ */
+int dpuring_send(dp_uring *ur, struct sockaddr *to, socklen_t toLen,
+                 struct iovec *iov, int cnt){
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    int i, rc, submit, sent, done, total = 0, err = 0;
+
+    if (cnt > DP_URING_ENTRIES)
+        cnt = DP_URING_ENTRIES;
+    for (i = 0; i < cnt; i++) {
+        if ((sqe = dpring_sqe(&ur->tx)) == NULL)
+            break;
+        memset(&ur->txMsg[i], 0, sizeof(struct msghdr));
+        ur->txMsg[i].msg_name = to;
+        ur->txMsg[i].msg_namelen = toLen;
+        ur->txMsg[i].msg_iov = &iov[i];
+        ur->txMsg[i].msg_iovlen = 1;
+
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = ur->sock;
+        sqe->addr = (uint64_t)(uintptr_t)&ur->txMsg[i];
+        sqe->len = 1;
+        sqe->user_data = i;
+        dpring_commit(&ur->tx, 1);
+    }
+    cnt = i;
+
+    //the kernel may take fewer SQEs than asked, the rest go in on the next
+    //enter.  Every one that went in gets reaped here, a CQE left behind
+    //would pass for one of the next call's.
+    for (sent = done = 0; done < cnt; ) {
+        if ((cqe = dpring_cqe(&ur->tx)) != NULL) {
+            if (cqe->res < 0)
+                err = -cqe->res;
+            else
+                total += cqe->res;
+            dpring_cqe_done(&ur->tx);
+            done++;
+            continue;
+        }
+        //only wait with something in flight, or nothing may ever wake us.
+        //A failed wait goes round again, the sends in flight still complete.
+        submit = cnt - sent;
+        rc = dpring_enter(ur, &ur->tx, submit, (sent > done) ? 1 : 0);
+        if ((rc == 0) && (submit > 0) && (sent == done)) {
+            rc = -1;
+            errno = EAGAIN;
+        }
+        if ((rc < 0) && (submit > 0)) {
+            //none of these went in, take them back off the ring
+            err = errno;
+            __atomic_store_n(ur->tx.sqTail, *ur->tx.sqTail - submit, __ATOMIC_RELEASE);
+            cnt = sent;
+        } else if (rc > 0)
+            sent += rc;
+    }
+    if (err != 0) {
+        errno = err;
+        return -1;
+    }
+    return total;
+}
+
+/*
+ *  Blocks until the multishot receive hands us a dgram and copies it out,
+ *  the same contract as recvfrom().
+ */
+int dpuring_recv(dp_uring *ur, void *buff, int buff_sz,
+                 struct sockaddr *from, socklen_t *fromLen){
+    struct io_uring_cqe *cqe;
+    struct io_uring_recvmsg_out *out;
+    char *buf, *payload;
+    int bid, len, res, flags;
+
+    while (1) {
+        if (!ur->rxArmed && (dpuring_arm(ur) < 0))
+            return -1;
+        while ((cqe = dpring_cqe(&ur->rx)) == NULL) {
+            if (dpring_enter(ur, &ur->rx, 0, 1) < 0)
+                return -1;
+        }
+        res = cqe->res;
+        flags = cqe->flags;
+        dpring_cqe_done(&ur->rx);
+
+        if (!(flags & IORING_CQE_F_MORE))
+            ur->rxArmed = false;
+        if (res == -ENOBUFS)
+            continue;
+        if (res < 0) {
+            errno = -res;
+            return -1;
+        }
+        if (!(flags & IORING_CQE_F_BUFFER))
+            continue;
+
+        bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        buf = ur->bufs + (size_t)bid * DP_URING_BUF_SZ;
+        out = (struct io_uring_recvmsg_out *)buf;
+        payload = buf + sizeof(*out) + ur->rxMsg.msg_namelen + ur->rxMsg.msg_controllen;
+
+        len = out->payloadlen;
+        if (payload + len > buf + res)
+            len = (buf + res) - payload;
+        if (len > buff_sz)
+            len = buff_sz;
+        memcpy(buff, payload, len);
+        if (from != NULL) {
+            if (*fromLen > out->namelen)
+                *fromLen = out->namelen;
+            memcpy(from, buf + sizeof(*out), *fromLen);
+        }
+        dpuring_recycle(ur, bid);
+        return len;
+    }
+}
+
+/*
+ *  poll() stand in, 1 if a dgram is waiting, 0 on timeout (-1 waits
+ *  forever).  The ring fd polls readable whenever completions are queued.
+ */
+int dpuring_wait(dp_uring *ur, int timeout_ms){
+    struct pollfd pfd = {0};
+    int rc;
+
+    if (dpring_cqe(&ur->rx) != NULL)
+        return 1;
+    if (!ur->rxArmed && (dpuring_arm(ur) < 0))
+        return -1;
+
+    pfd.fd = ur->rx.fd;
+    pfd.events = POLLIN;
+    do {
+        rc = poll(&pfd, 1, timeout_ms);
+    } while ((rc < 0) && (errno == EINTR));
+    if (rc < 0)
+        return -1;
+    return (dpring_cqe(&ur->rx) != NULL) ? 1 : 0;
+}
+
+uint64_t dpuring_enters(dp_uring *ur){
+    return ur->enters;
+}
+
+#else   //no io_uring outside of Linux
+
+dp_uring *dpuring_open(int sock){
+    errno = ENOSYS;
+    return NULL;
+}
+
+void dpuring_close(dp_uring *ur){
+}
+
+int dpuring_send(dp_uring *ur, struct sockaddr *to, socklen_t toLen,
+                 struct iovec *iov, int cnt){
+    errno = ENOSYS;
+    return -1;
+}
+
+int dpuring_recv(dp_uring *ur, void *buff, int buff_sz,
+                 struct sockaddr *from, socklen_t *fromLen){
+    errno = ENOSYS;
+    return -1;
+}
+
+int dpuring_wait(dp_uring *ur, int timeout_ms){
+    errno = ENOSYS;
+    return -1;
+}
+
+uint64_t dpuring_enters(dp_uring *ur){
+    return 0;
+}
+
+#endif
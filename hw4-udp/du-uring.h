@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+/*
+ * io_uring socket I/O backend for du-proto (Linux only, talks to the
+ * kernel directly, no liburing).  Each backend owns two rings on one UDP
+ * socket:
+ *
+ *   rx - a single multishot RECVMSG that stays armed, the kernel picks a
+ *        buffer from a registered (provided) buffer ring for every dgram,
+ *        so receiving costs no syscalls while dgrams keep arriving.
+ *   tx - a whole batch of dgrams goes in as SENDMSG SQEs with one
+ *        io_uring_enter() that also waits for all of them to complete.
+ *
+ * dpuring_open() returns NULL where io_uring is not available.
+ */
+#define DP_URING_ENTRIES    128
+#define DP_URING_BUFS       256         //power of 2
+#define DP_URING_BUF_SZ     2048
+#define DP_URING_BGID       1
+
+//biggest dgram a receive buffer holds, the kernel puts a 16 byte
+//io_uring_recvmsg_out and the peer address in front of it
+#define DP_URING_MAX_DGRAM  (DP_URING_BUF_SZ - 16 - (int)sizeof(struct sockaddr_storage))
+
+typedef struct dp_uring dp_uring;
+
+dp_uring *dpuring_open(int sock);
+void dpuring_close(dp_uring *ur);
+int  dpuring_send(dp_uring *ur, struct sockaddr *to, socklen_t toLen,
+                  struct iovec *iov, int cnt);
+int  dpuring_recv(dp_uring *ur, void *buff, int buff_sz,
+                  struct sockaddr *from, socklen_t *fromLen);
+int  dpuring_wait(dp_uring *ur, int timeout_ms);
+uint64_t dpuring_enters(dp_uring *ur);
@@ -0,0 +1,119 @@
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "du-wheel.h"
+
+static void dpwheel_init(dp_wheel *w, uint64_t nowNs){
+    int i;
+
+    for (i = 0; i < DP_WHEEL_SLOTS; i++)
+        w->slot[i].next = w->slot[i].prev = &w->slot[i];
+    w->tick = nowNs / DP_WHEEL_TICK_NS;
+    w->armed = 0;
+    w->init = true;
+}
+
+static void dptimer_link(dp_timer *head, dp_timer *t){
+    t->next = head->next;
+    t->prev = head;
+    head->next->prev = t;
+    head->next = t;
+}
+
+/*
+ *  Arms t (cancelling it first if it is armed) to fire at dueNs, or on
+ *  the next tick if that has already gone by.
+ */
+void dptimer_arm(dp_wheel *w, dp_timer *t, uint64_t nowNs, uint64_t dueNs){
+    uint64_t tick = (dueNs + DP_WHEEL_TICK_NS - 1) / DP_WHEEL_TICK_NS;
+
+    if (!w->init)
+        dpwheel_init(w, nowNs);
+    if (t->wheel != NULL)
+        dptimer_cancel(t);
+    if (tick <= w->tick)
+        tick = w->tick + 1;
+    t->tick = tick;
+    t->wheel = w;
+    dptimer_link(&w->slot[tick % DP_WHEEL_SLOTS], t);
+    w->armed++;
+}
+
+//safe on a timer that is not armed
+void dptimer_cancel(dp_timer *t){
+    if (t->wheel == NULL)
+        return;
+    t->prev->next = t->next;
+    t->next->prev = t->prev;
+    t->next = t->prev = NULL;
+    t->wheel->armed--;
+    t->wheel = NULL;
+}
+
+/*
+ *  Fires every timer due by nowNs and returns how many did.  A timer may
+ *  arm itself again or cancel others from its fire(), the due ones are
+ *  moved off the wheel before any of them runs.  After a long gap each
+ *  slot is looked at once, not once per tick missed.
+ */
+int dpwheel_run(dp_wheel *w, uint64_t nowNs){
+    uint64_t now = nowNs / DP_WHEEL_TICK_NS;
+    uint64_t i, steps;
+    dp_timer due, *t, *next;
+    int fired = 0;
+
+    if (!w->init || (w->armed == 0) || (now <= w->tick)) {
+        if (w->init && (now > w->tick))
+            w->tick = now;
+        return 0;
+    }
+
+    due.next = due.prev = &due;
+    steps = now - w->tick;
+    if (steps > DP_WHEEL_SLOTS)
+        steps = DP_WHEEL_SLOTS;
+    for (i = 1; i <= steps; i++) {
+        dp_timer *head = &w->slot[(w->tick + i) % DP_WHEEL_SLOTS];
+        for (t = head->next; t != head; t = next) {
+            next = t->next;
+            if (t->tick > now)
+                continue;
+            t->prev->next = t->next;
+            t->next->prev = t->prev;
+            dptimer_link(due.prev, t);
+        }
+    }
+    w->tick = now;
+
+    //still counted in armed until they fire, so a cancel from another
+    //fire() unlinks them from the due list instead
+    while (due.next != &due) {
+        t = due.next;
+        dptimer_cancel(t);
+        t->fire(t, nowNs);
+        fired++;
+    }
+    return fired;
+}
+
+/*
+ *  How long (ms) a thread may sleep before the wheel needs to run again,
+ *  -1 if nothing is armed.  That is up to the next slot with a timer on
+ *  it, which may hold only timers for a later turn, then the wait simply
+ *  comes up empty.
+ */
+int dpwheel_wait(dp_wheel *w, uint64_t nowNs){
+    uint64_t now = nowNs / DP_WHEEL_TICK_NS;
+    uint64_t i;
+
+    if (!w->init || (w->armed == 0))
+        return -1;
+    if (now > w->tick)
+        return 0;
+    for (i = 1; i <= DP_WHEEL_SLOTS; i++) {
+        dp_timer *head = &w->slot[(now + i) % DP_WHEEL_SLOTS];
+        if (head->next != head)
+            break;
+    }
+    return (int)(((now + i) * DP_WHEEL_TICK_NS - nowNs + 999999) / 1000000);
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Hashed timing wheel (Varghese and Lauck's scheme 6) for du-proto's per
+ * connection timers.  Time is cut into DP_WHEEL_TICK_MS ticks and a timer
+ * due at tick t hangs off slot t % DP_WHEEL_SLOTS in an unsorted list, so
+ * arming and cancelling cost the same however many timers there are.  A
+ * tick only looks at its own slot, timers more than a turn of the wheel
+ * out just stay put until their tick comes around again.  The timers have
+ * no clock of their own, whoever runs the wheel says what time it is.
+ */
+#define DP_WHEEL_TICK_MS    10
+#define DP_WHEEL_TICK_NS    (DP_WHEEL_TICK_MS * 1000000ULL)
+#define DP_WHEEL_SLOTS      512         //a turn is 5.12 seconds
+
+struct dp_wheel;
+
+typedef struct dp_timer {
+    struct dp_timer     *next;          //slot list
+    struct dp_timer     *prev;
+    struct dp_wheel     *wheel;         //NULL when not armed
+    uint64_t            tick;           //when it is due
+    void                (*fire)(struct dp_timer *t, uint64_t nowNs);
+    void                *arg;
+} dp_timer;
+
+typedef struct dp_wheel {
+    dp_timer            slot[DP_WHEEL_SLOTS];   //list heads
+    uint64_t            tick;           //the last tick that ran
+    int                 armed;          //timers on the wheel
+    _Bool               init;
+} dp_wheel;
+
+void dptimer_arm(dp_wheel *w, dp_timer *t, uint64_t nowNs, uint64_t dueNs);
+void dptimer_cancel(dp_timer *t);
+int  dpwheel_run(dp_wheel *w, uint64_t nowNs);
+int  dpwheel_wait(dp_wheel *w, uint64_t nowNs);
@@ -0,0 +1,786 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+#include "du-xport.h"
+#include "du-pool.h"
+
+typedef struct dp_memslot {
+    int                 len;
+    char                data[DP_MEM_SLOT_SZ];
+} dp_memslot;
+
+//head and tail on their own cache lines so the two sides dont fight
+typedef struct dp_memring {
+    _Alignas(DP_CACHE_LINE) uint32_t head;      //next slot to read
+    _Alignas(DP_CACHE_LINE) uint32_t tail;      //next slot to write
+    dp_memslot          slot[DP_MEM_SLOTS];
+} dp_memring;
+
+typedef struct dp_memend {
+    dp_memring          *tx;
+    dp_memring          *rx;
+    struct dp_mempair   *pair;
+} dp_memend;
+
+typedef struct dp_mempair {
+    dp_memring          ring[2];
+    dp_memend           end[2];
+    int                 refs;
+} dp_mempair;
+
+static int dpmemsend(dp_connp dp, struct iovec *iov, int cnt);
+static int dpmemrecv(dp_connp dp, void *buff, int buff_sz, dp_addr *from, socklen_t *fromLen);
+static int dpmempoll(dp_connp dp, int timeout_ms);
+static void dpmemclose(dp_connp dp);
+
+const dp_xport dpMemXport = {
+    "mem ring", dpmemsend, dpmemrecv, dpmempoll, dpmemclose
+};
+
+static uint64_t dpmemnowms(){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/*
+ *  Creates the two ends of a ring pair.  svr is then used like a server
+ *  from dpServerInit() (dplisten()), cli like a client from dpClientInit()
+ *  (dpconnect()).
+ */
+int dpPairInit(dp_connp *svr, dp_connp *cli){
+    dp_mempair *pair;
+    int i;
+
+    if (posix_memalign((void **)&pair, DP_CACHE_LINE, sizeof(dp_mempair)) != 0) {
+        perror("dpPairInit: cannot allocate rings");
+        return DP_ERROR_GENERAL;
+    }
+    memset(pair, 0, sizeof(dp_mempair));
+    for (i = 0; i < 2; i++) {
+        pair->end[i].tx = &pair->ring[i];
+        pair->end[i].rx = &pair->ring[1 - i];
+        pair->end[i].pair = pair;
+    }
+
+    *svr = dpInitXport(&dpMemXport, &pair->end[0]);
+    *cli = dpInitXport(&dpMemXport, &pair->end[1]);
+    if ((*svr == NULL) || (*cli == NULL)) {
+        perror("dpPairInit: cannot create connections");
+        return DP_ERROR_GENERAL;
+    }
+    pair->refs = 2;
+
+    //the client knows its peer up front, the server learns it on CONNECT
+    (*cli)->outSockAddr.isAddrInit = true;
+    return DP_NO_ERROR;
+}
+
+static int dpmemsend(dp_connp dp, struct iovec *iov, int cnt){
+    dp_memend *end = dp->xportCtx;
+    dp_memring *r = end->tx;
+    uint32_t tail = r->tail;
+    dp_memslot *slot;
+    int i, waitUs, total = 0;
+
+    for (i = 0; i < cnt; i++) {
+        //full, let the reader see what we have so far and wait for it, but
+        //not forever, the reader may be stuck sending to us (see dpsocksend())
+        for (waitUs = 0; tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) >= DP_MEM_SLOTS; 
+             waitUs += DP_PEER_RETRY_US) {
+            __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+            if (waitUs >= DP_PEER_WAIT_US)
+                break;
+            usleep(DP_PEER_RETRY_US);
+        }
+        if (waitUs >= DP_PEER_WAIT_US) {
+            dp->stats.sendDrops++;
+            total += iov[i].iov_len;
+            continue;
+        }
+        slot = &r->slot[tail & (DP_MEM_SLOTS - 1)];
+        slot->len = (iov[i].iov_len < DP_MEM_SLOT_SZ) ? iov[i].iov_len : DP_MEM_SLOT_SZ;
+        memcpy(slot->data, iov[i].iov_base, slot->len);
+        total += slot->len;
+        tail++;
+    }
+    __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+    return total;
+}
+
+static int dpmemrecv(dp_connp dp, void *buff, int buff_sz, dp_addr *from, socklen_t *fromLen){
+    dp_memend *end = dp->xportCtx;
+    dp_memring *r = end->rx;
+    uint32_t head = r->head;
+    dp_memslot *slot;
+    int len;
+
+    while (head == __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE))
+        sched_yield();
+
+    slot = &r->slot[head & (DP_MEM_SLOTS - 1)];
+    len = (slot->len < buff_sz) ? slot->len : buff_sz;
+    memcpy(buff, slot->data, len);
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+
+    *fromLen = 0;
+    return len;
+}
+
+static int dpmempoll(dp_connp dp, int timeout_ms){
+    dp_memend *end = dp->xportCtx;
+    dp_memring *r = end->rx;
+    uint64_t deadline = dpmemnowms() + timeout_ms;
+
+    while (r->head == __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE)) {
+        if ((timeout_ms >= 0) && (dpmemnowms() >= deadline))
+            return 0;
+        sched_yield();
+    }
+    return 1;
+}
+
+static void dpmemclose(dp_connp dp){
+    dp_memend *end = dp->xportCtx;
+
+    if (__atomic_sub_fetch(&end->pair->refs, 1, __ATOMIC_ACQ_REL) == 0)
+        free(end->pair);
+}
+
+//// SHARED MEMORY
+
+//lives in the shared file, so only plain data in here
+typedef struct dp_shmring {
+    _Alignas(DP_CACHE_LINE) uint32_t head;      //next slot to read
+    _Alignas(DP_CACHE_LINE) uint32_t tail;      //next slot to write, futex word
+    uint32_t            sleeping;               //reader is waiting on tail
+    uint32_t            len[DP_SHM_SLOTS];
+} dp_shmring;
+
+typedef struct dp_shmhdr {
+    uint32_t            magic;
+    uint32_t            slotSz;
+    dp_shmring          ring[2];                //0 is client to server
+} dp_shmhdr;
+
+#define DP_SHM_HDR_SZ       DP_SHM_SLOT_SZ      //keeps the slots page aligned
+#define DP_SHM_FILE_SZ      (DP_SHM_HDR_SZ + 2 * (size_t)DP_SHM_SLOTS * DP_SHM_SLOT_SZ)
+#define DP_SHM_SLOT(base, ring, idx) \
+    ((char *)(base) + DP_SHM_HDR_SZ + \
+     ((size_t)(ring) * DP_SHM_SLOTS + ((idx) & (DP_SHM_SLOTS - 1))) * DP_SHM_SLOT_SZ)
+
+typedef struct dp_shmend {
+    dp_shmhdr           *hdr;
+    int                 txRing;
+    int                 rxRing;
+    _Bool               owner;                  //the server, removes the file
+    char                path[108];
+} dp_shmend;
+
+static int dpshmsend(dp_connp dp, struct iovec *iov, int cnt);
+static int dpshmrecv(dp_connp dp, void *buff, int buff_sz, dp_addr *from, socklen_t *fromLen);
+static int dpshmpoll(dp_connp dp, int timeout_ms);
+static void dpshmclose(dp_connp dp);
+
+const dp_xport dpShmXport = {
+    "shared memory", dpshmsend, dpshmrecv, dpshmpoll, dpshmclose
+};
+
+static void dpshmsleep(uint32_t *word, uint32_t val, int timeout_ms){
+#ifdef __linux__
+    struct timespec ts, *tsp = NULL;
+
+    if (timeout_ms >= 0) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = (long)(timeout_ms % 1000) * 1000000;
+        tsp = &ts;
+    }
+    //not FUTEX_PRIVATE, the word is shared with the other process
+    syscall(SYS_futex, word, FUTEX_WAIT, val, tsp, NULL, 0);
+#else
+    usleep(50);
+#endif
+}
+
+static void dpshmwake(uint32_t *word){
+#ifdef __linux__
+    syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+#endif
+}
+
+static dp_connp dpshmopen(char *path, _Bool owner){
+    dp_shmend *end;
+    dp_shmhdr *hdr;
+    dp_connp dpc;
+    int fd;
+
+    if (owner) {
+        //whatever an earlier server left in there is stale.  The path is
+        //usually in a world writable /dev/shm, so make a new file of our
+        //own rather than following whatever someone put there.
+        unlink(path);
+        fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW, 0600);
+        if ((fd >= 0) && (ftruncate(fd, DP_SHM_FILE_SZ) < 0)) {
+            close(fd);
+            fd = -1;
+        }
+    } else
+        fd = open(path, O_RDWR);
+    if (fd < 0) {
+        perror("dpshmopen: cannot open the shared memory file");
+        return NULL;
+    }
+
+    hdr = mmap(NULL, DP_SHM_FILE_SZ, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED) {
+        perror("dpshmopen: cannot map the shared memory file");
+        return NULL;
+    }
+    if (owner) {
+        hdr->slotSz = DP_SHM_SLOT_SZ;
+        __atomic_store_n(&hdr->magic, DP_SHM_MAGIC, __ATOMIC_RELEASE);
+    } else if ((__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != DP_SHM_MAGIC) ||
+               (hdr->slotSz != DP_SHM_SLOT_SZ)) {
+        printf("ERROR: %s is not a du-proto shared memory file\n", path);
+        munmap(hdr, DP_SHM_FILE_SZ);
+        return NULL;
+    }
+
+    if ((end = calloc(1, sizeof(dp_shmend))) == NULL) {
+        munmap(hdr, DP_SHM_FILE_SZ);
+        return NULL;
+    }
+    end->hdr = hdr;
+    end->owner = owner;
+    end->txRing = owner ? 1 : 0;
+    end->rxRing = owner ? 0 : 1;
+    strncpy(end->path, path, sizeof(end->path) - 1);
+
+    dpc = dpInitXport(&dpShmXport, end);
+    if ((dpc == NULL) || (dpsetpayload(dpc, DP_SHM_PAYLOAD_SZ) != DP_NO_ERROR)) {
+        if (dpc != NULL)
+            dpclose(dpc);
+        return NULL;
+    }
+    return dpc;
+}
+
+dp_connp dpServerInitShm(char *path){
+    return dpshmopen(path, true);
+}
+
+dp_connp dpClientInitShm(char *path){
+    dp_connp dpc = dpshmopen(path, false);
+
+    if (dpc != NULL)
+        dpc->outSockAddr.isAddrInit = true;
+    return dpc;
+}
+
+static int dpshmsend(dp_connp dp, struct iovec *iov, int cnt){
+    dp_shmend *end = dp->xportCtx;
+    dp_shmring *r = &end->hdr->ring[end->txRing];
+    uint32_t tail = r->tail;
+    int i, len, waitUs, total = 0;
+
+    for (i = 0; i < cnt; i++) {
+        //as with the in-process rings, a full ring drops after a while
+        for (waitUs = 0; tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) >= DP_SHM_SLOTS; 
+             waitUs += DP_PEER_RETRY_US) {
+            __atomic_store_n(&r->tail, tail, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&r->sleeping, __ATOMIC_SEQ_CST))
+                dpshmwake(&r->tail);
+            if (waitUs >= DP_PEER_WAIT_US)
+                break;
+            usleep(DP_PEER_RETRY_US);
+        }
+        if (waitUs >= DP_PEER_WAIT_US) {
+            dp->stats.sendDrops++;
+            total += iov[i].iov_len;
+            continue;
+        }
+        len = (iov[i].iov_len < DP_SHM_SLOT_SZ) ? iov[i].iov_len : DP_SHM_SLOT_SZ;
+        memcpy(DP_SHM_SLOT(end->hdr, end->txRing, tail), iov[i].iov_base, len);
+        r->len[tail & (DP_SHM_SLOTS - 1)] = len;
+        total += len;
+        tail++;
+    }
+
+    //pairs with the reader setting sleeping then checking tail again
+    __atomic_store_n(&r->tail, tail, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&r->sleeping, __ATOMIC_SEQ_CST))
+        dpshmwake(&r->tail);
+    return total;
+}
+
+/*
+ *  Waits up to timeout_ms (-1 forever) for something to read, spinning a
+ *  little first since the peer usually answers right away.
+ */
+static int dpshmwait(dp_shmring *r, int timeout_ms){
+    uint32_t head = r->head;
+    uint32_t tail;
+    uint64_t deadline = dpmemnowms() + timeout_ms;
+    int spin, left = -1;
+
+    for (spin = 0; ; spin++) {
+        if (__atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) != head)
+            return 1;
+        if (spin < DP_SHM_SPIN)
+            continue;
+        if (timeout_ms >= 0) {
+            uint64_t now = dpmemnowms();
+            if (now >= deadline)
+                return 0;
+            left = deadline - now;
+        }
+
+        __atomic_store_n(&r->sleeping, 1, __ATOMIC_SEQ_CST);
+        tail = __atomic_load_n(&r->tail, __ATOMIC_SEQ_CST);
+        if (tail == head)
+            dpshmsleep(&r->tail, tail, left);
+        __atomic_store_n(&r->sleeping, 0, __ATOMIC_RELAXED);
+    }
+}
+
+static int dpshmrecv(dp_connp dp, void *buff, int buff_sz, dp_addr *from, socklen_t *fromLen){
+    dp_shmend *end = dp->xportCtx;
+    dp_shmring *r = &end->hdr->ring[end->rxRing];
+    uint32_t head;
+    uint32_t len;
+
+    //the other process writes the lengths, one past the slot is a bad
+    //dgram and gets dropped like any other
+    while (1) {
+        dpshmwait(r, -1);
+        head = r->head;
+        len = __atomic_load_n(&r->len[head & (DP_SHM_SLOTS - 1)], __ATOMIC_RELAXED);
+        if (len <= DP_SHM_SLOT_SZ)
+            break;
+        __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+    }
+    if (len > buff_sz)
+        len = buff_sz;
+    memcpy(buff, DP_SHM_SLOT(end->hdr, end->rxRing, head), len);
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+
+    *fromLen = 0;
+    return len;
+}
+
+static int dpshmpoll(dp_connp dp, int timeout_ms){
+    dp_shmend *end = dp->xportCtx;
+
+    return dpshmwait(&end->hdr->ring[end->rxRing], timeout_ms);
+}
+
+static void dpshmclose(dp_connp dp){
+    dp_shmend *end = dp->xportCtx;
+
+    munmap(end->hdr, DP_SHM_FILE_SZ);
+    if (end->owner)
+        unlink(end->path);
+    free(end);
+}
+
+//// SIMULATED LINK
+
+#define DP_SIM_WAIT         0           //dp_simend.state
+#define DP_SIM_RUN          1
+#define DP_SIM_DONE         2
+#define DP_SIM_NEVER        UINT64_MAX
+
+typedef struct dp_simpkt {
+    struct dp_simpkt    *next;
+    uint64_t            atNs;           //when it gets to the far end
+    uint64_t            order;          //ties arrive in send order
+    int                 len;
+    char                data[];
+} dp_simpkt;
+
+//one direction of the link
+typedef struct dp_simdir {
+    dp_simlink          link;
+    uint64_t            txFreeNs;       //the bottleneck is busy until then
+    _Bool               bad;            //Gilbert-Elliott state
+    dp_simpkt           *flight;        //on the wire, by arrival time
+    dp_simpkt           *inbox;         //arrived, not read yet
+    dp_simpkt           **inboxTail;
+} dp_simdir;
+
+typedef struct dp_simend {
+    struct dp_simnet    *net;
+    int                 id;             //0 the server, 1 the client
+    pthread_t           tid;
+    dp_connp            dp;
+    dp_simfn            fn;
+    void                *arg;
+    int                 rc;
+    int                 state;
+    uint64_t            wakeNs;         //waiting until then
+    _Bool               wantDgram;      //or until a dgram shows up
+    pthread_cond_t      cond;
+    dp_clock            clock;
+} dp_simend;
+
+typedef struct dp_simnet {
+    pthread_mutex_t     lock;
+    uint64_t            nowNs;
+    uint64_t            order;
+    uint64_t            rng;
+    int                 running;        //end allowed to run, -1 for none
+    dp_simdir           dir[2];         //[i] is what end i receives
+    dp_simend           end[2];
+    dp_simstats         *stats;
+} dp_simnet;
+
+static int dpsimsend(dp_connp dp, struct iovec *iov, int cnt);
+static int dpsimrecv(dp_connp dp, void *buff, int buff_sz, dp_addr *from, socklen_t *fromLen);
+static int dpsimpoll(dp_connp dp, int timeout_ms);
+static void dpsimclose(dp_connp dp);
+
+const dp_xport dpSimXport = {
+    "simulated link", dpsimsend, dpsimrecv, dpsimpoll, dpsimclose
+};
+
+//xorshift64*, the simulation's only source of randomness
+static double dpsimrand(dp_simnet *n){
+    n->rng ^= n->rng >> 12;
+    n->rng ^= n->rng << 25;
+    n->rng ^= n->rng >> 27;
+    return ((n->rng * 0x2545F4914F6CDD1DULL) >> 11) * 0x1.0p-53;
+}
+
+/*
+ *  The loss model.  With burstLen > 1 it has two states, bad loses every
+ *  dgram and is left after burstLen of them on average, good is entered
+ *  just often enough for lossPct to come out on average.
+ */
+static _Bool dpsimlost(dp_simnet *n, dp_simdir *d){
+    double p = d->link.lossPct / 100;
+    double toGood, toBad;
+
+    if (p <= 0)
+        return false;
+    if ((p >= 1) || (d->link.burstLen <= 1))
+        return dpsimrand(n) < p;
+
+    toGood = 1 / d->link.burstLen;
+    toBad = p * toGood / (1 - p);
+    if (dpsimrand(n) < (d->bad ? toGood : toBad))
+        d->bad = !d->bad;
+    return d->bad;
+}
+
+//puts one dgram on the link towards dir, lock held
+static void dpsimtx(dp_simnet *n, int dir, void *buff, int len){
+    dp_simdir *d = &n->dir[dir];
+    dp_simlink *l = &d->link;
+    uint64_t start = (d->txFreeNs > n->nowNs) ? d->txFreeNs : n->nowNs;
+    dp_simpkt *pkt, **pp;
+
+    n->stats->dgrams[1 - dir]++;
+    //what is still queued at the bottleneck ahead of this one
+    if ((l->queueBytes > 0) && (l->rateBps > 0) &&
+        ((start - n->nowNs) * l->rateBps / 1000000000ULL + len > (uint64_t)l->queueBytes)) {
+        n->stats->queueDrops[1 - dir]++;
+        return;
+    }
+    if (l->rateBps > 0)
+        d->txFreeNs = start + (uint64_t)len * 1000000000ULL / l->rateBps;
+    else
+        d->txFreeNs = start;
+    if (dpsimlost(n, d)) {
+        n->stats->lost[1 - dir]++;
+        return;
+    }
+
+    if ((pkt = malloc(sizeof(dp_simpkt) + len)) == NULL)
+        return;
+    pkt->atNs = d->txFreeNs + (uint64_t)l->delayUs * 1000;
+    if (l->jitterUs > 0)
+        pkt->atNs += (uint64_t)(dpsimrand(n) * (l->jitterUs + 1)) * 1000;
+    pkt->order = n->order++;
+    pkt->len = len;
+    memcpy(pkt->data, buff, len);
+
+    for (pp = &d->flight; *pp != NULL; pp = &(*pp)->next)
+        if (((*pp)->atNs > pkt->atNs) || 
+            (((*pp)->atNs == pkt->atNs) && ((*pp)->order > pkt->order)))
+            break;
+    pkt->next = *pp;
+    *pp = pkt;
+}
+
+static _Bool dpsimready(dp_simnet *n, dp_simend *e){
+    if (e->state != DP_SIM_WAIT)
+        return false;
+    return (e->wantDgram && (n->dir[e->id].inbox != NULL)) || 
+           (n->nowNs >= e->wakeNs) || n->stats->stalled;
+}
+
+/*
+ *  Picks the end to run next, called by the end giving up the CPU with the
+ *  lock held.  When neither has anything to do the clock moves on to the
+ *  next arrival or timeout, and if there is none the run has stalled.
+ */
+static void dpsimschedule(dp_simnet *n){
+    uint64_t next;
+    int i;
+
+    while (1) {
+        for (i = 0; i < 2; i++) {
+            dp_simdir *d = &n->dir[i];
+            while ((d->flight != NULL) && (d->flight->atNs <= n->nowNs)) {
+                dp_simpkt *pkt = d->flight;
+                d->flight = pkt->next;
+                pkt->next = NULL;
+                *d->inboxTail = pkt;
+                d->inboxTail = &pkt->next;
+            }
+        }
+        for (i = 0; i < 2; i++) {
+            if (dpsimready(n, &n->end[i])) {
+                n->running = i;
+                pthread_cond_signal(&n->end[i].cond);
+                return;
+            }
+        }
+        if ((n->end[0].state == DP_SIM_DONE) && (n->end[1].state == DP_SIM_DONE)) {
+            n->running = -1;
+            return;
+        }
+
+        next = DP_SIM_NEVER;
+        for (i = 0; i < 2; i++) {
+            if ((n->dir[i].flight != NULL) && (n->dir[i].flight->atNs < next))
+                next = n->dir[i].flight->atNs;
+            if ((n->end[i].state == DP_SIM_WAIT) && (n->end[i].wakeNs < next))
+                next = n->end[i].wakeNs;
+        }
+        if ((next == DP_SIM_NEVER) || (next > DP_SIM_MAX_S * 1000000000ULL))
+            n->stats->stalled = true;
+        else
+            n->nowNs = next;
+    }
+}
+
+//gives up the CPU until the scheduler picks e again, lock held
+static void dpsimwait(dp_simend *e, uint64_t wakeNs, _Bool wantDgram){
+    dp_simnet *n = e->net;
+
+    e->state = DP_SIM_WAIT;
+    e->wakeNs = wakeNs;
+    e->wantDgram = wantDgram;
+    dpsimschedule(n);
+    while (n->running != e->id)
+        pthread_cond_wait(&e->cond, &n->lock);
+    e->state = DP_SIM_RUN;
+}
+
+static uint64_t dpsimnow(void *ctx){
+    dp_simend *e = ctx;
+
+    return e->net->nowNs;
+}
+
+static void dpsimsleep(void *ctx, uint64_t ns){
+    dp_simend *e = ctx;
+
+    pthread_mutex_lock(&e->net->lock);
+    dpsimwait(e, e->net->nowNs + ns, false);
+    pthread_mutex_unlock(&e->net->lock);
+}
+
+static void *dpsimthread(void *arg){
+    dp_simend *e = arg;
+    dp_simnet *n = e->net;
+
+    dpsetclock(&e->clock);
+    pthread_mutex_lock(&n->lock);
+    while (n->running != e->id)
+        pthread_cond_wait(&e->cond, &n->lock);
+    e->state = DP_SIM_RUN;
+    pthread_mutex_unlock(&n->lock);
+
+    e->rc = e->fn(e->dp, e->arg);
+
+    pthread_mutex_lock(&n->lock);
+    e->state = DP_SIM_DONE;
+    dpsimschedule(n);
+    pthread_mutex_unlock(&n->lock);
+    return NULL;
+}
+
+static void dpsimfree(dp_simpkt *pkt){
+    while (pkt != NULL) {
+        dp_simpkt *next = pkt->next;
+        free(pkt);
+        pkt = next;
+    }
+}
+
+/*
+ *  Runs server and client (each given its connection and arg) against
+ *  each other over the simulated link, see DP_SIM_MAX_S.  The server side
+ *  is used like one from dpServerInit() (dplisten()), the client side like
+ *  one from dpClientInit() (dpconnect()).  A side still open when its
+ *  function returns (no dpdisconnect()) is closed here.  Fills in stats,
+ *  returns DP_ERROR_TIMEOUT if the run stalled, DP_ERROR_GENERAL if either
+ *  side failed.
+ */
+int dpSimRun(const dp_simlink *toSvr, const dp_simlink *toCli, uint64_t seed,
+             dp_simfn server, dp_simfn client, void *arg, dp_simstats *stats){
+    dp_simnet *n;
+    int i, rc = DP_NO_ERROR;
+
+    if ((n = calloc(1, sizeof(dp_simnet))) == NULL)
+        return DP_ERROR_GENERAL;
+    memset(stats, 0, sizeof(*stats));
+    pthread_mutex_init(&n->lock, NULL);
+    n->rng = seed ? seed : 1;
+    n->running = -1;
+    n->stats = stats;
+    n->dir[0].link = *toSvr;
+    n->dir[1].link = *toCli;
+
+    for (i = 0; i < 2; i++) {
+        dp_simend *e = &n->end[i];
+
+        n->dir[i].inboxTail = &n->dir[i].inbox;
+        e->net = n;
+        e->id = i;
+        e->fn = i ? client : server;
+        e->arg = arg;
+        e->state = DP_SIM_WAIT;         //and ready, wakeNs is 0
+        e->clock.now = dpsimnow;
+        e->clock.sleep = dpsimsleep;
+        e->clock.ctx = e;
+        pthread_cond_init(&e->cond, NULL);
+        e->dp = dpInitXport(&dpSimXport, e);
+    }
+    if ((n->end[0].dp == NULL) || (n->end[1].dp == NULL)) {
+        perror("dpSimRun: cannot create connections");
+        rc = DP_ERROR_GENERAL;
+        goto done;
+    }
+    //the client knows its peer up front, the server learns it on CONNECT
+    n->end[1].dp->outSockAddr.isAddrInit = true;
+
+    //a side that cannot start is done and failed, the other one stalls
+    for (i = 0; i < 2; i++) {
+        if (pthread_create(&n->end[i].tid, NULL, dpsimthread, &n->end[i]) != 0) {
+            perror("dpSimRun: cannot start a side");
+            n->end[i].state = DP_SIM_DONE;
+            n->end[i].rc = DP_ERROR_GENERAL;
+            n->end[i].fn = NULL;
+        }
+    }
+    pthread_mutex_lock(&n->lock);
+    dpsimschedule(n);
+    pthread_mutex_unlock(&n->lock);
+    for (i = 0; i < 2; i++)
+        if (n->end[i].fn != NULL)
+            pthread_join(n->end[i].tid, NULL);
+
+    stats->elapsedNs = n->nowNs;
+    for (i = 0; i < 2; i++)
+        if ((n->end[i].rc < 0) && (n->end[i].rc != DP_CONNECTION_CLOSED))
+            rc = DP_ERROR_GENERAL;
+    if (stats->stalled)
+        rc = DP_ERROR_TIMEOUT;
+
+done:
+    for (i = 0; i < 2; i++) {
+        if (n->end[i].dp != NULL)
+            dpclose(n->end[i].dp);
+        pthread_cond_destroy(&n->end[i].cond);
+        dpsimfree(n->dir[i].flight);
+        dpsimfree(n->dir[i].inbox);
+    }
+    pthread_mutex_destroy(&n->lock);
+    free(n);
+    return rc;
+}
+
+static int dpsimsend(dp_connp dp, struct iovec *iov, int cnt){
+    dp_simend *e = dp->xportCtx;
+    int i, total = 0;
+
+    pthread_mutex_lock(&e->net->lock);
+    //like UDP, a dgram the link loses still counts as sent
+    for (i = 0; i < cnt; i++) {
+        dpsimtx(e->net, 1 - e->id, iov[i].iov_base, iov[i].iov_len);
+        total += iov[i].iov_len;
+    }
+    pthread_mutex_unlock(&e->net->lock);
+    return total;
+}
+
+static int dpsimrecv(dp_connp dp, void *buff, int buff_sz, dp_addr *from, socklen_t *fromLen){
+    dp_simend *e = dp->xportCtx;
+    dp_simdir *d = &e->net->dir[e->id];
+    dp_simpkt *pkt;
+    int len = -1;
+
+    pthread_mutex_lock(&e->net->lock);
+    while ((d->inbox == NULL) && !e->net->stats->stalled)
+        dpsimwait(e, DP_SIM_NEVER, true);
+    if ((pkt = d->inbox) == NULL)
+        errno = ETIMEDOUT;
+    else {
+        d->inbox = pkt->next;
+        if (d->inbox == NULL)
+            d->inboxTail = &d->inbox;
+        len = (pkt->len < buff_sz) ? pkt->len : buff_sz;
+        memcpy(buff, pkt->data, len);
+        free(pkt);
+    }
+    pthread_mutex_unlock(&e->net->lock);
+
+    *fromLen = 0;
+    return len;
+}
+
+static int dpsimpoll(dp_connp dp, int timeout_ms){
+    dp_simend *e = dp->xportCtx;
+    dp_simnet *n = e->net;
+    int rc;
+
+    pthread_mutex_lock(&n->lock);
+    if ((n->dir[e->id].inbox == NULL) && (timeout_ms != 0) && !n->stats->stalled)
+        dpsimwait(e, (timeout_ms < 0) ? DP_SIM_NEVER : 
+                     n->nowNs + (uint64_t)timeout_ms * 1000000, true);
+    if (n->dir[e->id].inbox != NULL)
+        rc = 1;
+    else if (n->stats->stalled) {
+        errno = ETIMEDOUT;
+        rc = -1;
+    } else
+        rc = 0;
+    pthread_mutex_unlock(&n->lock);
+    return rc;
+}
+
+//dpSimRun() owns the link, all that is left is the connection's stats
+static void dpsimclose(dp_connp dp){
+    dp_simend *e = dp->xportCtx;
+
+    memcpy(e->id ? &e->net->stats->cli : &e->net->stats->svr, &dp->stats, sizeof(dp_stats));
+    e->dp = NULL;
+}
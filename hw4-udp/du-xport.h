@@ -0,0 +1,79 @@
+#pragma once
+
+#include "du-proto.h"
+
+/*
+ * Transports other than the socket one in du-proto.c.
+ *
+ * In-process ring pair (dpPairInit()).  Two connections in one process
+ * talk over a pair of single producer / single consumer rings, one each
+ * way.  Nothing takes a lock or makes a syscall, a side waiting on an
+ * empty ring just yields the CPU, which makes it handy for timing the
+ * protocol logic without the kernel getting in the way.  A ring that stays
+ * full for DP_PEER_WAIT_US drops the dgram, as a UDP socket would.  The
+ * server side has to be driven from its own thread, as with sockets.
+ */
+#define DP_MEM_SLOTS        256         //power of 2
+#define DP_MEM_SLOT_SZ      DP_MAX_DGRAM_SZ
+
+/*
+ * Shared memory (dpServerInitShm() / dpClientInitShm()).  For two
+ * processes on the same host, the server creates a file at path (best on
+ * a tmpfs like /dev/shm) holding one ring of big slots each way and the
+ * client maps the same file.  Dgrams are copied straight into the peer's
+ * ring, a reader with nothing to read sleeps on the ring's tail with a
+ * futex (Linux, elsewhere it naps) that the writer wakes.  Slots are big,
+ * so the connection's dpsend() limit goes up to DP_SHM_PAYLOAD_SZ.  One
+ * client per file.
+ */
+#define DP_SHM_SLOTS        16          //power of 2
+#define DP_SHM_SLOT_SZ      (256 * 1024)
+#define DP_SHM_PAYLOAD_SZ   (DP_SHM_SLOT_SZ - (int)sizeof(dp_pdu))
+#define DP_SHM_SPIN         200         //polls before going to sleep
+#define DP_SHM_MAGIC        0x64707368  //"dpsh"
+
+/*
+ * Simulated link (dpSimRun()).  Runs a server and a client function
+ * against each other in this process over a modeled link, one dp_simlink
+ * per direction: a bottleneck of rateBps with a drop tail queue, a one
+ * way delay plus jitter, and random or bursty (Gilbert-Elliott) loss.
+ * Time is virtual.  Each side runs on its own thread with its du-proto
+ * clock (dpsetclock()) on the simulation's, but only one runs at a time:
+ * a side that has to wait (for a dgram, a timeout or the pacer) hands
+ * over, and when both are waiting the clock jumps to the next arrival or
+ * timeout.  A transfer takes as long as the CPU needs rather than as long
+ * as the link would, and the same seed gives the same run every time.
+ * When both sides wait with nothing left that could wake them (a lost
+ * dgram nobody retransmits), or the clock passes DP_SIM_MAX_S, the run
+ * has stalled and every wait fails from then on so the sides can return.
+ */
+#define DP_SIM_MAX_S        3600
+
+typedef struct dp_simlink {
+    int64_t             rateBps;        //bytes/sec, 0 = no limit
+    uint32_t            delayUs;        //one way
+    uint32_t            jitterUs;       //up to this much more per dgram, reorders
+    double              lossPct;        //average loss
+    double              burstLen;       //mean dgrams lost in a row, <= 1 for random loss
+    int                 queueBytes;     //bottleneck queue, 0 = no limit
+} dp_simlink;
+
+typedef struct dp_simstats {
+    uint64_t            elapsedNs;      //virtual time the run took
+    _Bool               stalled;
+    uint64_t            dgrams[2];      //sent, [0] is client to server
+    uint64_t            lost[2];        //to the loss model
+    uint64_t            queueDrops[2];  //to the full bottleneck queue
+    dp_stats            svr;            //the connections' own stats
+    dp_stats            cli;
+} dp_simstats;
+
+//one side of a run, returns < 0 if it failed (DP_CONNECTION_CLOSED is fine)
+typedef int (*dp_simfn)(dp_connp dp, void *arg);
+
+int dpSimRun(const dp_simlink *toSvr, const dp_simlink *toCli, uint64_t seed,
+             dp_simfn server, dp_simfn client, void *arg, dp_simstats *stats);
+
+extern const dp_xport dpMemXport;
+extern const dp_xport dpShmXport;
+extern const dp_xport dpSimXport;